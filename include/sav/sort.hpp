@@ -68,7 +68,8 @@ public:
 
     file_data_format_ = format;
     file_path_ = file_path;
-    input_stream_ = savvy::detail::make_unique<shrinkwrap::zstd::istream>(file_path);
+    minor_version_ = savvy::sav::writer::options().minor_version;
+    input_stream_ = savvy::detail::make_unique<savvy::detail::zstd_istream>(file_path);
     for (auto it = headers_beg; it != headers_end; ++it)
     {
       if (it->first == "INFO")
@@ -91,6 +92,7 @@ public:
     }
 
     this->sample_ids_.assign(samples_beg, samples_end);
+    this->file_data_formats_.assign(1, file_data_format_);
 
   }
 };
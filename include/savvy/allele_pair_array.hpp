@@ -0,0 +1,73 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_ALLELE_PAIR_ARRAY_HPP
+#define LIBSAVVY_ALLELE_PAIR_ARRAY_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace savvy
+{
+  namespace sav
+  {
+    namespace detail
+    {
+      /**
+       * Decodes one pair of an ALLELE_PAIR_ARRAY (see sav_spec.md). Same as
+       * prefixed_varint<BitWidth>::decode(), but with compile time masks so that they aren't
+       * reloaded after every prefix store.
+       * @param in_it Beginning of the pair. Advanced past the pair.
+       * @param end_it End of readable input.
+       * @param next_offset Running absolute offset, which the pair's offset is added to.
+       * @return false if input is truncated.
+       */
+      template <std::uint8_t BitWidth>
+      inline bool decode_allele_pair(const char*& in_it, const char* end_it, std::uint8_t& prefix, std::uint64_t& next_offset)
+      {
+        const std::uint8_t continue_flag = std::uint8_t(1u << (7u - BitWidth));
+        if (in_it == end_it)
+          return false;
+
+        std::uint8_t current_byte = static_cast<std::uint8_t>(*in_it);
+        prefix = std::uint8_t(current_byte >> (8u - BitWidth));
+        std::uint64_t offset = current_byte & std::uint8_t(continue_flag - 1u);
+        if (current_byte & continue_flag)
+        {
+          unsigned bits_to_shift = 7u - BitWidth;
+          do
+          {
+            if (++in_it == end_it)
+              return false;
+            current_byte = static_cast<std::uint8_t>(*in_it);
+            offset |= std::uint64_t(current_byte & 0x7F) << bits_to_shift;
+            bits_to_shift += 7;
+          } while (current_byte & 0x80);
+        }
+
+        ++in_it;
+        next_offset += offset;
+        return true;
+      }
+
+      /**
+       * Decodes an entire ALLELE_PAIR_ARRAY into parallel arrays of prefix values and absolute
+       * offsets, which is needed when pairs are reordered (PBWT) or gathered from several blocks
+       * before they are consumed.
+       * @param in_it Beginning of the pair array. Advanced past the last decoded pair.
+       * @param end_it End of readable input.
+       * @param count Number of pairs to decode (APA_SZ).
+       * @param prefixes Destination for count prefix values.
+       * @param offsets Destination for count absolute offsets (i.e., running sum of offset + 1, minus 1).
+       * @return Number of pairs decoded, which is less than count only if input is truncated.
+       */
+      template <std::uint8_t BitWidth>
+      std::size_t decode_allele_pair_array(const char*& in_it, const char* end_it, std::size_t count, std::uint8_t* prefixes, std::uint64_t* offsets);
+    }
+  }
+}
+
+#endif //LIBSAVVY_ALLELE_PAIR_ARRAY_HPP
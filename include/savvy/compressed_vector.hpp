@@ -9,15 +9,22 @@
 
 #include <vector>
 #include <algorithm>
+#include <cstddef>
+#include <cassert>
 
 namespace savvy
 {
-  template<typename T>
+  /**
+   * Sparse vector storing the positions and values of non-zero elements in increasing order.
+   * @tparam IndexT Type of stored positions. std::uint32_t halves index memory when size() fits.
+   */
+  template<typename T, typename IndexT = std::size_t>
   class compressed_vector
   {
   public:
     typedef T value_type;
-    typedef compressed_vector<T> self_type;
+    typedef IndexT index_type;
+    typedef compressed_vector<T, IndexT> self_type;
     static const T const_value_type;
 
     class iterator
@@ -113,9 +120,7 @@ namespace savvy
     {
       if (offsets_.size() && offsets_.back() < pos)
       {
-        offsets_.emplace_back(pos);
-        values_.emplace_back();
-        return values_.back();
+        return append(pos);
       }
       else
       {
@@ -170,18 +175,104 @@ namespace savvy
       resize(0);
     }
 
-    const std::size_t* const index_data() const { return offsets_.data(); }
+    /**
+     * Reserves storage for at least non_zero_count non-zero elements. Capacity grows
+     * geometrically so that reserving a slowly increasing count per record doesn't reallocate
+     * every time.
+     */
+    void reserve(std::size_t non_zero_count)
+    {
+      if (non_zero_count > values_.capacity())
+      {
+        non_zero_count = std::max(non_zero_count, 2 * values_.capacity());
+        values_.reserve(non_zero_count);
+        offsets_.reserve(non_zero_count);
+      }
+    }
+
+    /**
+     * Appends a non-zero element without searching. pos must be less than size() and greater than
+     * the position of every stored element, which is only checked in debug builds.
+     * @return Reference to the appended value.
+     */
+    value_type& append(std::size_t pos, const value_type& val = value_type())
+    {
+      assert(pos < size_ && (offsets_.empty() || offsets_.back() < pos));
+      offsets_.emplace_back(pos);
+      values_.emplace_back(val);
+      return values_.back();
+    }
+
+    /**
+     * Replaces the contents with copies of parallel value and position arrays. Positions must be
+     * increasing and less than sz.
+     */
+    template <typename ValIt, typename IdxIt>
+    void assign(ValIt values_beg, ValIt values_end, IdxIt offsets_beg, std::size_t sz)
+    {
+      values_.assign(values_beg, values_end);
+      offsets_.assign(offsets_beg, offsets_beg + values_.size());
+      size_ = sz;
+    }
+
+    /**
+     * Replaces the contents by taking ownership of parallel value and position arrays. Positions
+     * must be increasing and less than sz.
+     */
+    void assign(std::vector<value_type>&& values, std::vector<index_type>&& offsets, std::size_t sz)
+    {
+      values_ = std::move(values);
+      offsets_ = std::move(offsets);
+      size_ = sz;
+    }
+
+    const index_type* const index_data() const { return offsets_.data(); }
     const value_type* const value_data() const { return values_.data(); }
+    value_type* value_data() { return values_.data(); }
     std::size_t size() const { return size_; }
     std::size_t non_zero_size() const { return values_.size(); }
   private:
     std::vector<value_type> values_;
-    std::vector<std::size_t> offsets_;
+    std::vector<index_type> offsets_;
     std::size_t size_;
   };
 
-  template <typename T>
-  const T compressed_vector<T>::const_value_type = T();
+  template <typename T, typename IndexT>
+  const T compressed_vector<T, IndexT>::const_value_type = T();
+
+  namespace detail
+  {
+    /**
+     * Readers fill destinations in increasing position order through these helpers, which use
+     * plain element access for dense containers and the bulk interface for compressed_vector.
+     */
+    template <typename VecT>
+    inline void reserve_non_zero(VecT&, std::size_t) { }
+
+    template <typename T, typename IndexT>
+    inline void reserve_non_zero(compressed_vector<T, IndexT>& destination, std::size_t non_zero_count)
+    {
+      destination.reserve(std::min(non_zero_count, destination.size()));
+    }
+
+    /**
+     * @return Reference to element at pos, which must not be less than any position previously passed for this record.
+     */
+    template <typename VecT>
+    inline typename VecT::value_type& sorted_element(VecT& destination, std::size_t pos)
+    {
+      return destination[pos];
+    }
+
+    template <typename T, typename IndexT>
+    inline T& sorted_element(compressed_vector<T, IndexT>& destination, std::size_t pos)
+    {
+      const std::size_t nnz = destination.non_zero_size();
+      if (nnz && destination.index_data()[nnz - 1] == pos)
+        return destination.value_data()[nnz - 1];
+      return destination.append(pos);
+    }
+  }
 }
 
 #endif //LIBSAVVY_SPARSE_VECTOR_HPP
@@ -0,0 +1,45 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_DOSAGE_CODE_HPP
+#define LIBSAVVY_DOSAGE_CODE_HPP
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace savvy
+{
+  /**
+   * SAV readers' read_dosage_codes() fills destinations with a std::uint8_t value_type (e.g.,
+   * std::vector<std::uint8_t> or compressed_vector<std::uint8_t>) with quantized haplotype codes
+   * instead of values. Code q represents the value q / dosage_code_scale, which is exactly what 7-bit HDS records store, and
+   * dosage_code_missing represents a missing haplotype. Hard calls are coded as 0 or dosage_code_scale.
+   */
+  static const std::uint8_t dosage_code_scale = 128;
+  static const std::uint8_t dosage_code_missing = 0xFF;
+
+  /**
+   * Lookup table converting dosage codes back to floating point values (NaN for missing).
+   */
+  template <typename T>
+  class dosage_code_table
+  {
+  public:
+    dosage_code_table()
+    {
+      for (std::size_t i = 0; i < values_.size(); ++i)
+        values_[i] = i <= dosage_code_scale ? T(i) / T(dosage_code_scale) : std::numeric_limits<T>::quiet_NaN();
+    }
+
+    T operator[](std::uint8_t code) const { return values_[code]; }
+    const T* data() const { return values_.data(); }
+  private:
+    std::array<T, 256> values_;
+  };
+}
+
+#endif //LIBSAVVY_DOSAGE_CODE_HPP
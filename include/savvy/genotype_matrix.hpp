@@ -0,0 +1,129 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_GENOTYPE_MATRIX_HPP
+#define LIBSAVVY_GENOTYPE_MATRIX_HPP
+
+#include "site_info.hpp"
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace savvy
+{
+  /**
+   * Non-owning genotype destination that writes into a caller provided array, such as one
+   * column of a column-major matrix. Like a vector, growing zero-fills the new elements.
+   *
+   * Sizes beyond capacity are redirected to an internal buffer so that a record that doesn't
+   * fit never writes past the array. Callers detect this by comparing size() to capacity().
+   */
+  template <typename T>
+  class matrix_column
+  {
+  public:
+    typedef T value_type;
+
+    matrix_column(T* data, std::size_t capacity) :
+      data_(data),
+      ptr_(data),
+      capacity_(capacity),
+      size_(0)
+    {
+    }
+
+    void resize(std::size_t sz)
+    {
+      T* prev = ptr_;
+      if (sz > capacity_)
+      {
+        overflow_.resize(sz);
+        ptr_ = overflow_.data();
+      }
+      else
+      {
+        ptr_ = data_;
+      }
+
+      std::fill(ptr_ + (prev == ptr_ ? std::min(size_, sz) : 0), ptr_ + sz, T());
+      size_ = sz;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+
+    T* data() { return ptr_; }
+    const T* data() const { return ptr_; }
+
+    T& operator[](std::size_t pos) { return ptr_[pos]; }
+    const T& operator[](std::size_t pos) const { return ptr_[pos]; }
+  private:
+    T* data_;
+    T* ptr_;
+    std::size_t capacity_;
+    std::size_t size_;
+    std::vector<T> overflow_;
+  };
+
+  /**
+   * Reads up to max_variants records into a column-major matrix with one column per variant.
+   * Column j starts at data + j * rows, so the buffer can be wrapped without copying as, e.g.,
+   * arma::Mat<T>(data, rows, n, false, true) or Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>(data, rows, n).
+   *
+   * rows is the length of a genotype vector in the requested format: the number of (subset)
+   * samples times ploidy for fmt::gt and fmt::hds, or the number of samples for fmt::ac and fmt::ds.
+   *
+   * @param rdr Any savvy reader (savvy::reader, sav::reader, vcf::reader, indexed variants, ...).
+   * @param sites Resized to the number of variants read. Existing elements are reused.
+   * @param data Buffer of at least rows * max_variants elements.
+   * @param rows Number of matrix rows.
+   * @param max_variants Maximum number of columns to fill.
+   * @param mismatched_genotypes Receives the genotypes of a record that isn't rows long. May be null.
+   * @return Number of columns filled. Less than max_variants when the reader reaches the end
+   * or fails, or when a record's genotype vector isn't rows long (e.g., a change in ploidy).
+   * In the latter case the reader is still good() and the record isn't dropped: sites holds
+   * one more element than the returned count for it, and its genotypes are copied to
+   * mismatched_genotypes.
+   */
+  template <typename Reader, typename T>
+  std::size_t read_batch(Reader& rdr, std::vector<site_info>& sites, T* data, std::size_t rows, std::size_t max_variants, std::vector<T>* mismatched_genotypes = nullptr)
+  {
+    if (sites.size() < max_variants)
+      sites.resize(max_variants);
+
+    std::size_t cnt = 0;
+    for ( ; cnt < max_variants; ++cnt)
+    {
+      matrix_column<T> column(data + cnt * rows, rows);
+      if (!rdr.read(sites[cnt], column))
+        break;
+
+      if (column.size() != rows)
+      {
+        if (mismatched_genotypes)
+          mismatched_genotypes->assign(column.data(), column.data() + column.size());
+        sites.resize(cnt + 1);
+        return cnt;
+      }
+    }
+
+    sites.resize(cnt);
+    return cnt;
+  }
+
+  /**
+   * Convenience overload that sizes data to rows * max_variants.
+   */
+  template <typename Reader, typename T>
+  std::size_t read_batch(Reader& rdr, std::vector<site_info>& sites, std::vector<T>& data, std::size_t rows, std::size_t max_variants, std::vector<T>* mismatched_genotypes = nullptr)
+  {
+    data.resize(rows * max_variants);
+    return read_batch(rdr, sites, data.data(), rows, max_variants, mismatched_genotypes);
+  }
+}
+
+#endif //LIBSAVVY_GENOTYPE_MATRIX_HPP
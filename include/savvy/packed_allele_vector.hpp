@@ -0,0 +1,142 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_PACKED_ALLELE_VECTOR_HPP
+#define LIBSAVVY_PACKED_ALLELE_VECTOR_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace savvy
+{
+  namespace detail
+  {
+    inline std::size_t popcount64(std::uint64_t v)
+    {
+#if defined(__GNUC__)
+      return std::size_t(__builtin_popcountll(v));
+#else
+      v = v - ((v >> 1) & 0x5555555555555555ULL);
+      v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+      v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      return std::size_t((v * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+  }
+
+  /**
+   * Haplotype alleles packed one bit per haplotype, plus a parallel bitset marking missing
+   * haplotypes (whose allele bit is always zero). SAV and VCF readers fill it directly when
+   * fmt::gt is requested, and the counting helpers process 64 haplotypes per word.
+   */
+  class packed_allele_vector
+  {
+  public:
+    typedef std::uint64_t word_type;
+    static const std::size_t word_bits = 64;
+
+    packed_allele_vector(std::size_t sz = 0) :
+      size_(0)
+    {
+      resize(sz);
+    }
+
+    /**
+     * Resizes the vector. Haplotypes added by growing are reference alleles.
+     */
+    void resize(std::size_t sz)
+    {
+      const std::size_t word_cnt = (sz + word_bits - 1) / word_bits;
+      alt_.resize(word_cnt);
+      missing_.resize(word_cnt);
+
+      // Bits past size() are kept zero so that growing again yields reference alleles.
+      if (sz % word_bits)
+      {
+        const word_type mask = (word_type(1) << (sz % word_bits)) - 1;
+        alt_.back() &= mask;
+        missing_.back() &= mask;
+      }
+      size_ = sz;
+    }
+
+    void clear() { resize(0); }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    bool operator[](std::size_t pos) const { return is_alt(pos); }
+    bool is_alt(std::size_t pos) const { return (alt_[pos / word_bits] >> (pos % word_bits)) & 1u; }
+    bool is_missing(std::size_t pos) const { return (missing_[pos / word_bits] >> (pos % word_bits)) & 1u; }
+
+    void set_alt(std::size_t pos) { alt_[pos / word_bits] |= word_type(1) << (pos % word_bits); }
+    void set_missing(std::size_t pos) { missing_[pos / word_bits] |= word_type(1) << (pos % word_bits); }
+
+    std::size_t word_count() const { return alt_.size(); }
+    const word_type* alt_words() const { return alt_.data(); }
+    const word_type* missing_words() const { return missing_.data(); }
+
+    /**
+     * @return Number of alternate alleles (AC).
+     */
+    std::size_t alt_count() const
+    {
+      std::size_t ret = 0;
+      for (auto it = alt_.begin(); it != alt_.end(); ++it)
+        ret += detail::popcount64(*it);
+      return ret;
+    }
+
+    /**
+     * @return Number of missing haplotypes.
+     */
+    std::size_t missing_count() const
+    {
+      std::size_t ret = 0;
+      for (auto it = missing_.begin(); it != missing_.end(); ++it)
+        ret += detail::popcount64(*it);
+      return ret;
+    }
+
+    /**
+     * @return Number of haplotypes carrying the alternate allele in both vectors.
+     */
+    std::size_t intersection_count(const packed_allele_vector& other) const
+    {
+      std::size_t ret = 0;
+      const std::size_t word_cnt = std::min(alt_.size(), other.alt_.size());
+      for (std::size_t i = 0; i < word_cnt; ++i)
+        ret += detail::popcount64(alt_[i] & other.alt_[i]);
+      return ret;
+    }
+
+    /**
+     * @return Number of haplotypes that are non-missing in both vectors.
+     */
+    std::size_t non_missing_intersection_count(const packed_allele_vector& other) const
+    {
+      const std::size_t sz = std::min(size_, other.size_);
+      std::size_t ret = sz;
+      const std::size_t word_cnt = (sz + word_bits - 1) / word_bits;
+      for (std::size_t i = 0; i < word_cnt; ++i)
+      {
+        word_type m = missing_[i] | other.missing_[i];
+        if (i + 1 == word_cnt && sz % word_bits)
+          m &= (word_type(1) << (sz % word_bits)) - 1;
+        ret -= detail::popcount64(m);
+      }
+      return ret;
+    }
+  private:
+    std::vector<word_type> alt_;
+    std::vector<word_type> missing_;
+    std::size_t size_;
+  };
+}
+
+#endif //LIBSAVVY_PACKED_ALLELE_VECTOR_HPP
@@ -0,0 +1,145 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_PBWT_HPP
+#define LIBSAVVY_PBWT_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Haplotype order of a positional Burrows-Wheeler transform. Haplotypes that share alleles
+     * at the preceding records are kept next to each other, so encoding a record's alleles in
+     * this order clusters its non-reference alleles into short offsets.
+     *
+     * After each record, haplotypes with a reference allele are moved ahead of the others
+     * while keeping their relative order (a stable partition).
+     */
+    class pbwt_order
+    {
+    public:
+      /**
+       * @param track_positions Also maintain the inverse permutation for position().
+       */
+      pbwt_order(bool track_positions = false) :
+        track_positions_(track_positions)
+      {
+      }
+
+      /**
+       * Restarts from sample order.
+       */
+      void reset(std::size_t haplotype_count)
+      {
+        order_.resize(haplotype_count);
+        for (std::size_t i = 0; i < haplotype_count; ++i)
+          order_[i] = i;
+        if (track_positions_)
+          positions_ = order_;
+      }
+
+      std::size_t size() const { return order_.size(); }
+
+      /**
+       * @return Haplotype index at pos in the current order.
+       */
+      std::uint64_t haplotype(std::uint64_t pos) const { return order_[pos]; }
+
+      /**
+       * @return Position of haplotype in the current order (requires track_positions).
+       */
+      std::uint64_t position(std::uint64_t haplotype) const { return positions_[haplotype]; }
+
+      /**
+       * Advances the order past a record.
+       * @param non_ref_positions Sorted positions (in the current order) of haplotypes without a reference allele.
+       * @param count Number of positions.
+       */
+      void update(const std::uint64_t* non_ref_positions, std::size_t count)
+      {
+        next_.resize(order_.size());
+        auto ref_dest = next_.begin();
+        auto non_ref_dest = next_.begin() + (order_.size() - count);
+        auto src = order_.begin();
+        for (std::size_t j = 0; j < count; ++j)
+        {
+          // Runs of reference haplotypes between non-reference ones are copied in bulk.
+          auto non_ref = order_.begin() + non_ref_positions[j];
+          ref_dest = std::copy(src, non_ref, ref_dest);
+          *(non_ref_dest++) = *non_ref;
+          src = non_ref + 1;
+        }
+        std::copy(src, order_.end(), ref_dest);
+        order_.swap(next_);
+
+        if (track_positions_)
+        {
+          for (std::size_t i = 0; i < order_.size(); ++i)
+            positions_[order_[i]] = i;
+        }
+      }
+
+      /**
+       * Converts the sorted positions of a record's non-reference haplotypes to sorted
+       * haplotype indices in place, moving their allele prefixes along, and then advances the
+       * order past the record. The haplotypes are sorted with a bitset rather than a comparison sort.
+       */
+      void to_haplotypes(std::uint64_t* offsets, std::uint8_t* prefixes, std::size_t count)
+      {
+        haplotype_bits_.resize((order_.size() + 63) / 64);
+        haplotype_prefixes_.resize(order_.size());
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          const std::uint64_t hap = order_[offsets[i]];
+          haplotype_bits_[hap / 64] |= std::uint64_t(1) << (hap % 64);
+          haplotype_prefixes_[hap] = prefixes[i];
+        }
+
+        update(offsets, count);
+
+        std::size_t i = 0;
+        for (std::size_t w = 0; w < haplotype_bits_.size(); ++w)
+        {
+          for (std::uint64_t bits = haplotype_bits_[w]; bits; bits &= bits - 1)
+          {
+            const std::uint64_t hap = w * 64 + lowest_bit(bits);
+            offsets[i] = hap;
+            prefixes[i] = haplotype_prefixes_[hap];
+            ++i;
+          }
+          haplotype_bits_[w] = 0;
+        }
+      }
+    private:
+      static std::uint64_t lowest_bit(std::uint64_t v)
+      {
+#if defined(__GNUC__)
+        return std::uint64_t(__builtin_ctzll(v));
+#else
+        std::uint64_t ret = 0;
+        for ( ; (v & 1) == 0; v >>= 1)
+          ++ret;
+        return ret;
+#endif
+      }
+    private:
+      std::vector<std::uint64_t> order_;
+      std::vector<std::uint64_t> positions_;
+      std::vector<std::uint64_t> next_;
+      std::vector<std::uint64_t> haplotype_bits_;
+      std::vector<std::uint8_t> haplotype_prefixes_;
+      bool track_positions_;
+    };
+  }
+}
+
+#endif //LIBSAVVY_PBWT_HPP
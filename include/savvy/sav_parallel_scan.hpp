@@ -0,0 +1,250 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_SAV_PARALLEL_SCAN_HPP
+#define LIBSAVVY_SAV_PARALLEL_SCAN_HPP
+
+#include "sav_reader.hpp"
+#include "s1r.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace savvy
+{
+  namespace sav
+  {
+    /**
+     * Delivery order of records passed to the parallel_scan() callback.
+     */
+    enum class scan_order
+    {
+      unordered, ///< Frames are handed out to workers dynamically. Callback is invoked concurrently.
+      shard,     ///< Each worker scans a contiguous range of frames in file order. Callback is invoked concurrently.
+      global     ///< Callback is invoked on the calling thread in file order.
+    };
+
+    namespace detail
+    {
+      struct index_frame
+      {
+        std::uint64_t offset;
+        std::uint32_t record_count;
+      };
+
+      /**
+       * Collects the zstd frames of a SAV file from its s1r index.
+       * @return Frames sorted by file offset.
+       */
+      inline bool read_index_frames(const std::string& index_file_path, std::vector<index_frame>& frames)
+      {
+        s1r::reader index(index_file_path);
+        if (!index.good())
+          return false;
+
+        std::vector<region> regions;
+        for (const std::string& chrom : index.tree_names())
+          regions.emplace_back(chrom, 0);
+
+        frames.clear();
+        auto query = index.create_query(regions);
+        for (auto it = query.begin(); it != query.end(); ++it)
+          frames.push_back({(it->value() >> 16) & 0x0000FFFFFFFFFFFF, std::uint32_t(0x000000000000FFFF & it->value()) + 1});
+
+        std::sort(frames.begin(), frames.end(), [](const index_frame& a, const index_frame& b) { return a.offset < b.offset; });
+        return true;
+      }
+
+      class frame_reader : public reader_base
+      {
+      public:
+        frame_reader(const std::string& file_path, savvy::fmt data_format) :
+          reader_base(file_path, data_format)
+        {
+        }
+
+        bool seek_frame(std::uint64_t offset)
+        {
+          this->seek_block(std::streampos(offset));
+          return this->good();
+        }
+
+        template <typename T>
+        bool read(site_info& annotations, T& destination)
+        {
+          this->read_variant_details(annotations);
+          reader_base::read_genotypes(destination);
+          return this->good();
+        }
+      };
+    }
+
+    /**
+     * Scans every record of an indexed SAV file with multiple threads. The frame list is taken
+     * from the s1r index and each worker decodes its frames with its own reader.
+     * @tparam T Genotype container passed to the reader (e.g., std::vector<float> or compressed_vector<float>).
+     * @param file_path Path to SAV file. The index is expected at file_path + ".s1r".
+     * @param n_threads Number of worker threads. Zero uses std::thread::hardware_concurrency().
+     * @param data_format Requested genotype format.
+     * @param callback Invoked as callback(std::size_t worker_index, const site_info&, const T&) for each record.
+     * @param order Delivery order (see scan_order).
+     * @return False if the index or any frame could not be read.
+     */
+    template <typename T, typename Fn>
+    bool parallel_scan(const std::string& file_path, std::size_t n_threads, savvy::fmt data_format, Fn callback, scan_order order = scan_order::unordered)
+    {
+      std::vector<detail::index_frame> frames;
+      if (!detail::read_index_frames(file_path + ".s1r", frames))
+        return false;
+
+      if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+      n_threads = std::max(std::size_t(1), std::min(n_threads, frames.size()));
+
+      std::atomic<bool> failed(false);
+      std::atomic<std::size_t> next_frame(0);
+      std::vector<std::thread> workers;
+      workers.reserve(n_threads);
+
+      if (order == scan_order::unordered || order == scan_order::shard)
+      {
+        for (std::size_t t = 0; t < n_threads; ++t)
+        {
+          workers.emplace_back([&, t]()
+          {
+            detail::frame_reader rdr(file_path, data_format);
+            site_info annotations;
+            T genotypes;
+
+            std::size_t i = next_frame++;
+            std::size_t shard_end = frames.size();
+            if (order == scan_order::shard)
+            {
+              // Shards are contiguous, so seeking to the next frame doesn't reset the decompressor.
+              i = frames.size() * t / n_threads;
+              shard_end = frames.size() * (t + 1) / n_threads;
+            }
+
+            for ( ; i < shard_end && !failed; i = (order == scan_order::shard ? i + 1 : std::size_t(next_frame++)))
+            {
+              if (!rdr.seek_frame(frames[i].offset))
+              {
+                failed = true;
+                break;
+              }
+
+              for (std::uint32_t j = 0; j < frames[i].record_count; ++j)
+              {
+                if (!rdr.read(annotations, genotypes))
+                {
+                  failed = true;
+                  break;
+                }
+                callback(t, annotations, genotypes);
+              }
+            }
+          });
+        }
+
+        for (auto it = workers.begin(); it != workers.end(); ++it)
+          it->join();
+        return !failed;
+      }
+
+      struct frame_batch
+      {
+        std::vector<site_info> sites;
+        std::vector<T> genotypes;
+        std::size_t worker_index;
+        bool ready;
+        bool error;
+      };
+
+      // Bounded window of decoded frames waiting to be delivered in order.
+      const std::size_t window = 2 * n_threads;
+      std::vector<frame_batch> batches(window);
+      std::mutex mtx;
+      std::condition_variable batch_ready;
+      std::condition_variable slot_free;
+      std::size_t delivered = 0;
+
+      for (std::size_t t = 0; t < n_threads; ++t)
+      {
+        workers.emplace_back([&, t]()
+        {
+          detail::frame_reader rdr(file_path, data_format);
+          while (true)
+          {
+            std::size_t i;
+            {
+              std::unique_lock<std::mutex> lock(mtx);
+              i = next_frame++;
+              if (i >= frames.size())
+                return;
+              slot_free.wait(lock, [&]() { return failed || i < delivered + window; });
+              if (failed)
+                return;
+            }
+
+            frame_batch& batch = batches[i % window];
+            batch.sites.resize(frames[i].record_count);
+            batch.genotypes.resize(frames[i].record_count);
+            batch.worker_index = t;
+            bool success = rdr.seek_frame(frames[i].offset);
+            for (std::uint32_t j = 0; success && j < frames[i].record_count; ++j)
+              success = rdr.read(batch.sites[j], batch.genotypes[j]);
+
+            {
+              std::lock_guard<std::mutex> lock(mtx);
+              batch.error = !success;
+              batch.ready = true;
+            }
+            batch_ready.notify_all();
+            if (!success)
+              return;
+          }
+        });
+      }
+
+      for (std::size_t i = 0; i < frames.size(); ++i)
+      {
+        frame_batch& batch = batches[i % window];
+        {
+          std::unique_lock<std::mutex> lock(mtx);
+          batch_ready.wait(lock, [&]() { return batch.ready; });
+        }
+
+        if (batch.error)
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          failed = true;
+          break;
+        }
+
+        for (std::size_t j = 0; j < batch.sites.size(); ++j)
+          callback(batch.worker_index, batch.sites[j], batch.genotypes[j]);
+
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          batch.ready = false;
+          ++delivered;
+        }
+        slot_free.notify_all();
+      }
+
+      slot_free.notify_all();
+      for (auto it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+      return !failed;
+    }
+  }
+}
+
+#endif //LIBSAVVY_SAV_PARALLEL_SCAN_HPP
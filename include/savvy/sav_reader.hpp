@@ -16,11 +16,18 @@
 #include "utility.hpp"
 #include "data_format.hpp"
 #include "compressed_vector.hpp"
+#include "packed_allele_vector.hpp"
+#include "pbwt.hpp"
+#include "dosage_code.hpp"
+#include "zstd_ibuf.hpp"
+#include "zstd_obuf.hpp"
+#include "allele_pair_array.hpp"
 
 #include <cstdint>
 #include <string>
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <functional>
 #include <fstream>
 #include <tuple>
@@ -43,8 +50,10 @@ namespace savvy
       struct allele_decoder
       {
         static const std::uint8_t denom = std::uint8_t(~(std::uint8_t(0xFF) << BitWidth)) + std::uint8_t(1);
+        template <typename T, typename InputIt>
+        static std::tuple<T, std::uint64_t> decode(InputIt& in_it, const InputIt& end_it, const T& missing_value);
         template <typename T>
-        static std::tuple<T, std::uint64_t> decode(std::istreambuf_iterator<char>& in_it, const std::istreambuf_iterator<char>& end_it, const T& missing_value);
+        static T decode_prefix(std::uint8_t prefix, const T& missing_value);
       };
 
       template<std::uint8_t BitWidth>
@@ -56,6 +65,179 @@ namespace savvy
         template <typename T>
         static std::int8_t encode(const T& allele);
       };
+
+      /**
+       * Encodes GT values of multi-allelic records, which are allele indices, as pair prefixes
+       * (zero for missing). Missing values and allele index one are coded as in allele_encoder<1>.
+       */
+      struct allele_index_encoder
+      {
+        template <typename T>
+        static std::int8_t encode(const T& allele)
+        {
+          return std::int8_t(std::isnan(allele) ? 0 : (allele == T() ? -1 : std::int8_t(allele)));
+        }
+      };
+
+      /**
+       * Encodes 1-bit HDS values as rounded hard calls, which are coded like GT (zero for missing).
+       */
+      struct hard_call_encoder
+      {
+        template <typename T>
+        static std::int8_t encode(const T& allele)
+        {
+          return std::int8_t(std::isnan(allele) ? 0 : (std::round(allele) == T() ? -1 : 1));
+        }
+      };
+
+      /**
+       * @return Number of alleles in a comma separated ALT field.
+       */
+      inline std::size_t alt_allele_count(const std::string& alt)
+      {
+        return alt.empty() ? 0 : std::size_t(std::count(alt.begin(), alt.end(), ',')) + 1;
+      }
+
+      /**
+       * @return Width of GT pair prefixes that hold allele indices 1 to alt_count and zero for
+       * missing, which is 1 for biallelic records (at most 127 ALT alleles fit).
+       */
+      inline std::uint8_t allele_index_bit_width(std::size_t alt_count)
+      {
+        std::uint8_t ret = 1;
+        while (ret < 7 && (std::size_t(1) << ret) <= alt_count)
+          ++ret;
+        return ret;
+      }
+
+      /**
+       * Yields the pairs of a genotype block as prefixes and absolute haplotype offsets. Plain
+       * allele pair arrays are decoded one pair at a time straight from the frame buffer. Pairs
+       * that have to be gathered first (sample blocks, PBWT positions, split multi-allelic
+       * records) are read back from the arrays they were decoded into.
+       */
+      template <std::uint8_t BitWidth>
+      class allele_pair_cursor
+      {
+      public:
+        void stream(const char* in_it, const char* end_it, std::uint64_t count, std::uint64_t num_haps)
+        {
+          in_it_ = in_it;
+          end_it_ = end_it;
+          remaining_ = count;
+          num_haps_ = num_haps;
+          next_offset_ = 0;
+          buffered_ = false;
+        }
+
+        void buffer(const std::uint8_t* prefixes, const std::uint64_t* offsets, std::uint64_t count)
+        {
+          prefixes_ = prefixes;
+          offsets_ = offsets;
+          remaining_ = count;
+          buffered_ = true;
+        }
+
+        /**
+         * @return false after the last pair, or if the pair array is truncated or an offset is out of range.
+         */
+        bool next(std::uint8_t& prefix, std::uint64_t& offset)
+        {
+          if (remaining_ == 0)
+            return false;
+
+          if (buffered_)
+          {
+            prefix = *(prefixes_++);
+            offset = *(offsets_++);
+          }
+          else
+          {
+            if (!decode_allele_pair<BitWidth>(in_it_, end_it_, prefix, next_offset_))
+              return false;
+            offset = next_offset_++;
+            if (offset >= num_haps_)
+              return false;
+          }
+          --remaining_;
+          return true;
+        }
+
+        /**
+         * @return Whether every pair has been yielded.
+         */
+        bool done() const { return remaining_ == 0; }
+        bool buffered() const { return buffered_; }
+        const char* position() const { return in_it_; }
+        const char* end() const { return end_it_; }
+      private:
+        const char* in_it_ = nullptr;
+        const char* end_it_ = nullptr;
+        const std::uint8_t* prefixes_ = nullptr;
+        const std::uint64_t* offsets_ = nullptr;
+        std::uint64_t remaining_ = 0;
+        std::uint64_t num_haps_ = 0;
+        std::uint64_t next_offset_ = 0;
+        bool buffered_ = false;
+      };
+
+      static const std::uint8_t site_header_chromosome = 0x2; ///< SITE_HDR prefix bit: CHROM follows and the value is an absolute POS.
+      static const std::uint8_t site_header_snv = 0x1; ///< SITE_HDR prefix bit: REF and ALT are packed into one byte.
+      static const char snv_alphabet[] = "ACGT";
+
+      /**
+       * @return 2-bit code of a single base allele, or -1 if the allele can't be packed.
+       */
+      inline int snv_code(const std::string& allele)
+      {
+        if (allele.size() != 1)
+          return -1;
+        switch (allele[0])
+        {
+          case 'A': return 0;
+          case 'C': return 1;
+          case 'G': return 2;
+          case 'T': return 3;
+        }
+        return -1;
+      }
+
+      /**
+       * Holds a decompressed site frame of a columnar SAV file and exposes the fill(), data(),
+       * data_end() and consume() members of zstd_ibuf so that site fields are parsed the same way
+       * from either.
+       */
+      class site_frame_buffer
+      {
+      public:
+        void assign(const char* data, std::size_t size) { buffer_.assign(data, data + size); pos_ = 0; }
+        void clear() { buffer_.clear(); pos_ = 0; }
+        bool empty() const { return pos_ == buffer_.size(); }
+
+        std::size_t fill(std::size_t /*min_bytes*/) const { return buffer_.size() - pos_; }
+        const char* data() const { return buffer_.data() + pos_; }
+        const char* data_end() const { return buffer_.data() + buffer_.size(); }
+        void consume(const char* pos) { pos_ = std::size_t(pos - buffer_.data()); }
+      private:
+        std::vector<char> buffer_;
+        std::size_t pos_ = 0;
+      };
+
+      /**
+       * Multi-allelic record that a reader presents as one biallelic record per ALT allele,
+       * along with its decoded GT block.
+       */
+      struct split_record
+      {
+        site_info site;
+        std::vector<std::string> alts;
+        std::size_t alt_index = 0; // 1-based index of the ALT allele presented last.
+        bool genotypes_pending = false;
+        std::uint64_t ploidy_level = 0;
+        std::vector<std::uint8_t> prefixes; // Allele indices (zero for missing).
+        std::vector<std::uint64_t> offsets;
+      };
     }
 
 //    namespace detail
@@ -75,12 +257,96 @@ namespace savvy
 
     std::vector<std::string> query_chromosomes(const std::string& file_path);
 
+    /**
+     * Latest minor version of the SAV 1.x format. Version 1.1 added GT_SZ to records, 1.2
+     * added optional sample blocks to the genotype block, 1.3 added an optional zstd
+     * dictionary to the header and 1.4 added the FEATURES header field.
+     */
+    const std::uint16_t latest_minor_version = 4;
+
+    /**
+     * Default of writer::options::minor_version, which selects the oldest minor version that
+     * holds the requested features, so that files are readable by as many readers as possible.
+     */
+    const std::uint16_t auto_minor_version = 0xFFFF;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files that store each block as a frame of site fields followed
+     * by a frame of genotype blocks, so that site-only reads don't decompress genotypes.
+     */
+    const std::uint64_t feature_columnar_frames = 0x1;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files whose records start with a SITE_HDR that stores CHROM
+     * only when it changes (and at the start of each block), POS as a delta from the previous
+     * record and SNV alleles in a single byte.
+     */
+    const std::uint64_t feature_delta_sites = 0x2;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files whose allele pairs are stored in the haplotype order of
+     * a positional Burrows-Wheeler transform, which restarts from sample order at each block.
+     * Genotype blocks start with PBWT_RESET and can't be skipped without decoding them.
+     */
+    const std::uint64_t feature_pbwt = 0x4;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files that store several FORMAT fields (e.g., GT and HDS). The
+     * header has one FORMAT entry per field and each record holds one genotype block per field
+     * in header order, so readers skip the fields that weren't requested.
+     */
+    const std::uint64_t feature_multiple_formats = 0x8;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files that store all ALT alleles of a site in one record. GT
+     * is the only FORMAT field, and pair prefixes of records with more than one ALT allele are
+     * allele indices instead of a single bit (see allele_index_bit_width()).
+     */
+    const std::uint64_t feature_multiallelic = 0x10;
+
+    /**
+     * FEATURES bit (SAV 1.4+) for files whose HDS pair prefixes are narrower than 7 bits. The
+     * width (1 to 7) is the BitWidth sub-field of the HDS FORMAT entry. 1-bit HDS values are
+     * hard calls, which are coded like GT.
+     */
+    const std::uint64_t feature_dosage_bit_width = 0x20;
+
+    /**
+     * FEATURES bits understood by this reader. Files with any other bit set are rejected.
+     */
+    const std::uint64_t supported_features = feature_columnar_frames | feature_delta_sites | feature_pbwt | feature_multiple_formats | feature_multiallelic | feature_dosage_bit_width;
+
     //################################################################//
     class reader_base
     {
     public:
+      struct options
+      {
+        /**
+         * Number of zstd frames to decompress ahead of the caller on a background thread. Zero disables read-ahead.
+         */
+        std::size_t read_ahead_depth;
+        /**
+         * Decompress frames straight from a read-only memory mapping of the file instead of a file stream.
+         */
+        bool memory_map;
+        /**
+         * Present each multi-allelic record (see feature_multiallelic) as one biallelic record
+         * per ALT allele, like VCF readers do. The GT block of such a record is decoded when its
+         * site info is read.
+         */
+        bool split_multiallelic;
+        options() :
+          read_ahead_depth(0),
+          memory_map(false),
+          split_multiallelic(false)
+        {
+        }
+      };
+
       reader_base(const std::string& file_path);
       reader_base(const std::string& file_path, savvy::fmt data_format);
+      reader_base(const std::string& file_path, const options& opts, savvy::fmt data_format);
 
       reader_base(reader_base&& source);
       reader_base& operator=(reader_base&& source);
@@ -110,7 +376,32 @@ namespace savvy
       const std::vector<std::string>& info_fields() const { return metadata_fields_; }
       const std::vector<std::pair<std::string,std::string>>& headers() const { return headers_; }
       savvy::fmt data_format() const { return file_data_format_; }
+      /**
+       * @return FORMAT fields stored in the file in header order. Files without feature_multiple_formats store only data_format().
+       */
+      const std::vector<savvy::fmt>& data_formats() const { return file_data_formats_; }
+      /**
+       * @return Pair prefix width of the file's HDS field (7 if it has none).
+       */
+      std::uint8_t dosage_bit_width() const
+      {
+        auto it = std::find(file_data_formats_.begin(), file_data_formats_.end(), fmt::hds);
+        return it == file_data_formats_.end() ? 7 : file_bit_widths_[it - file_data_formats_.begin()];
+      }
       std::uint32_t ploidy() const { return ploidy_; }
+      std::uint16_t minor_version() const { return minor_version_; }
+      /**
+       * @return Samples per sample block (SAV 1.2+) of the last decoded genotype block, or zero if it has no sample blocks.
+       */
+      std::uint32_t sample_block_size() const { return sample_block_size_; }
+      /**
+       * @return zstd dictionary that the file's variant frames are compressed with (empty if none).
+       */
+      const std::vector<char>& dictionary() const { return dictionary_; }
+      /**
+       * @return FEATURES bits of the file (zero before SAV 1.4).
+       */
+      std::uint64_t features() const { return features_; }
       const std::array<std::uint8_t, 16>& uuid() const { return uuid_; }
 
       /**
@@ -121,204 +412,847 @@ namespace savvy
       std::vector<std::string> subset_samples(const std::set<std::string>& subset);
 
       const std::string& file_path() const { return file_path_; }
-      std::streampos tellg() { return this->input_stream_->tellg(); }
+
+      /**
+       * With columnar frames, this is the offset of the current block's site frame until all of
+       * the block's records have been read.
+       */
+      std::streampos tellg()
+      {
+        if (features_ & feature_columnar_frames)
+        {
+          if (!site_frame_.empty() || genotypes_pending_)
+            return site_frame_offset_;
+          end_genotype_frame();
+        }
+        return this->input_stream_->tellg();
+      }
     protected:
-      void read_variant_details(site_info& annotations)
+      /**
+       * Decodes a VLI directly from the decompressed frame buffer.
+       * @return false if stream is truncated.
+       */
+      template <typename Buf>
+      static bool read_vli(Buf& sbuf, std::uint64_t& destination)
       {
-        if (good())
+        sbuf.fill(10); // Max LEB128 width of a 64 bit integer.
+        const char* in_it = varint_decode(sbuf.data(), sbuf.data_end(), destination);
+        if (in_it == sbuf.data_end())
+          return false;
+        sbuf.consume(++in_it);
+        return true;
+      }
+
+      bool read_vli(std::uint64_t& destination)
+      {
+        return read_vli(*input_stream_->rdbuf(), destination);
+      }
+
+      /**
+       * Reads PLOIDY_LEVEL and APA_SZ and points pairs at the allele pair array. Plain arrays are
+       * decoded while pairs are consumed, so end_allele_pair_array() has to be called afterwards
+       * to move the stream past the array.
+       * @return false if stream is truncated or the array is invalid.
+       */
+      template <std::size_t BitWidth>
+      bool read_allele_pair_array(std::uint64_t& ploidy_level, std::uint64_t& apa_size, detail::allele_pair_cursor<BitWidth>& pairs)
+      {
+        if (split_.genotypes_pending)
+        {
+          load_split_alleles(ploidy_level, apa_size);
+          pairs.buffer(allele_prefixes_.data(), allele_offsets_.data(), apa_size);
+          return true;
+        }
+
+        ::savvy::detail::zstd_ibuf& sbuf = *input_stream_->rdbuf();
+        const char* in_it;
+        const char* end_it;
+        std::uint64_t pbwt_reset = 0;
+
+        if (minor_version_ >= 1)
         {
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
+          // GT_SZ gives the exact extent of the genotype block.
+          std::uint64_t block_size;
+          if (!read_vli(block_size) || sbuf.fill(block_size) < block_size)
+            return false;
 
-          if (in_it == end_it)
+          in_it = sbuf.data();
+          end_it = in_it + block_size;
+
+          if (features_ & feature_pbwt)
           {
-            this->input_stream_->setstate(std::ios::eofbit); // No more markers to read.
+            in_it = varint_decode(in_it, end_it, pbwt_reset);
+            if (in_it == end_it)
+              return false;
+            ++in_it;
+          }
+
+          if (ploidy_ == 0)
+          {
+            in_it = varint_decode(in_it, end_it, ploidy_level);
+            if (in_it == end_it)
+              return false;
+            ++in_it;
           }
           else
           {
-            std::uint64_t sz;
-            if (varint_decode(in_it, end_it, sz) == end_it)
+            ploidy_level = ploidy_;
+          }
+
+          if (minor_version_ >= 2)
+          {
+            std::uint64_t sample_block_haps;
+            in_it = varint_decode(in_it, end_it, sample_block_haps);
+            if (in_it == end_it)
+              return false;
+            ++in_it;
+            sample_block_size_ = ploidy_level ? std::uint32_t(sample_block_haps / ploidy_level) : 0;
+
+            if (sample_block_haps)
             {
-              this->input_stream_->setstate(std::ios::badbit);
+              if ((features_ & feature_pbwt) || !read_allele_pair_blocks<BitWidth>(in_it, end_it, ploidy_level, sample_block_haps, apa_size))
+                return false;
+              sbuf.consume(in_it);
+              pairs.buffer(allele_prefixes_.data(), allele_offsets_.data(), apa_size);
+              return true;
             }
-            else
-            {
-              ++in_it;
-              std::string chrom;
-              chrom.resize(sz);
-              if (sz)
-                input_stream_->read(&chrom[0], sz);
-
-              std::uint64_t locus;
-              if (varint_decode(in_it, end_it, locus) == end_it)
-              {
-                this->input_stream_->setstate(std::ios::badbit);
-              }
-              else
-              {
-                ++in_it;
-                if (varint_decode(in_it, end_it, sz) == end_it)
-                {
-                  this->input_stream_->setstate(std::ios::badbit);
-                }
-                else
-                {
-                  ++in_it;
-                  std::string ref;
-                  ref.resize(sz);
-                  if (sz)
-                    input_stream_->read(&ref[0], sz);
+          }
 
-                  if (varint_decode(in_it, end_it, sz) == end_it)
-                  {
-                    this->input_stream_->setstate(std::ios::badbit);
-                  }
-                  else
-                  {
-                    ++in_it;
-                    std::string alt;
-                    alt.resize(sz);
-                    if (sz)
-                      input_stream_->read(&alt[0], sz);
-
-                    std::unordered_map<std::string, std::string> props;
-                    props.reserve(this->metadata_fields_.size());
-                    std::string prop_val;
-                    for (const std::string& key : metadata_fields_)
-                    {
-                      if (varint_decode(in_it, end_it, sz) == end_it)
-                      {
-                        this->input_stream_->setstate(std::ios::badbit);
-                        break;
-                      }
-                      else
-                      {
-                        ++in_it;
-                        if (sz)
-                        {
-                          prop_val.resize(sz);
-                          input_stream_->read(&prop_val[0], sz);
-                          props[key] = prop_val;
-                        }
-                      }
-                    }
-
-                    annotations = site_info(std::move(chrom), locus, std::move(ref), std::move(alt), std::move(props));
-
-                    if (!this->input_stream_->good())
-                      this->input_stream_->setstate(std::ios::badbit);
-                  }
-                }
-              }
-            }
+          in_it = varint_decode(in_it, end_it, apa_size);
+          if (in_it == end_it)
+            return false;
+          ++in_it;
+        }
+        else
+        {
+          if (ploidy_ == 0)
+          {
+            if (!read_vli(ploidy_level))
+              return false;
           }
+          else
+          {
+            ploidy_level = ploidy_;
+          }
+
+          if (!read_vli(apa_size))
+            return false;
+
+          // No allele pair is wider than the pair encoding the largest possible offset.
+          sbuf.fill(apa_size * prefixed_varint<BitWidth>::encoded_byte_width(samples().size() * ploidy_level));
+          in_it = sbuf.data();
+          end_it = sbuf.data_end();
         }
+
+        const std::uint64_t num_haps = samples().size() * ploidy_level;
+        if (apa_size > num_haps)
+          return false;
+
+        // Prefixes of multi-allelic GT blocks are wider than BitWidth, and PBWT positions have to be mapped to haplotypes before they are consumed.
+        if ((BitWidth == 1 && gt_prefix_width_ != 1) || (features_ & feature_pbwt))
+        {
+          if (allele_prefixes_.size() < apa_size)
+          {
+            allele_prefixes_.resize(apa_size);
+            allele_offsets_.resize(apa_size);
+          }
+
+          std::size_t decoded = decode_pairs<BitWidth>(in_it, end_it, apa_size, allele_prefixes_.data(), allele_offsets_.data());
+          if (minor_version_ >= 1 && in_it != end_it)
+            return false;
+          sbuf.consume(in_it);
+
+          // Offsets are strictly increasing, so only the last one needs to be range checked.
+          if (decoded != apa_size || (apa_size && allele_offsets_[apa_size - 1] >= num_haps))
+            return false;
+          pairs.buffer(allele_prefixes_.data(), allele_offsets_.data(), apa_size);
+          return !(features_ & feature_pbwt) || apply_pbwt(pbwt_reset != 0, apa_size, num_haps);
+        }
+
+        pairs.stream(in_it, end_it, apa_size, num_haps);
+        return true;
       }
 
+      /**
+       * Moves the stream past an allele pair array whose pairs have been consumed.
+       * @return false if the array is truncated or invalid.
+       */
       template <std::uint8_t BitWidth>
-      void discard_genotypes_impl()
+      bool end_allele_pair_array(const detail::allele_pair_cursor<BitWidth>& pairs)
       {
-        if (good())
+        if (!pairs.buffered())
         {
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
+          input_stream_->rdbuf()->consume(pairs.position());
+          if (minor_version_ >= 1 && pairs.position() != pairs.end())
+            return false;
+        }
+        return pairs.done();
+      }
 
-          std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
+      /**
+       * Decodes allele pairs into arrays (see detail::decode_allele_pair_array()). GT blocks of
+       * multi-allelic records have wider prefixes than BitWidth, which hold allele indices.
+       */
+      template <std::size_t BitWidth>
+      std::size_t decode_pairs(const char*& in_it, const char* end_it, std::size_t count, std::uint8_t* prefixes, std::uint64_t* offsets) const
+      {
+        if (BitWidth == 1)
+        {
+          switch (gt_prefix_width_)
           {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
+            case 2: return detail::decode_allele_pair_array<2>(in_it, end_it, count, prefixes, offsets);
+            case 3: return detail::decode_allele_pair_array<3>(in_it, end_it, count, prefixes, offsets);
+            case 4: return detail::decode_allele_pair_array<4>(in_it, end_it, count, prefixes, offsets);
+            case 5: return detail::decode_allele_pair_array<5>(in_it, end_it, count, prefixes, offsets);
+            case 6: return detail::decode_allele_pair_array<6>(in_it, end_it, count, prefixes, offsets);
+            case 7: return detail::decode_allele_pair_array<7>(in_it, end_it, count, prefixes, offsets);
           }
-          else
+        }
+        return detail::decode_allele_pair_array<BitWidth>(in_it, end_it, count, prefixes, offsets);
+      }
+
+      /**
+       * Fills allele_prefixes_ and allele_offsets_ with the pairs of the current split record's
+       * ALT allele, taken from the decoded GT block of the multi-allelic record. Missing
+       * haplotypes are kept and haplotypes with other ALT alleles are left out.
+       */
+      void load_split_alleles(std::uint64_t& ploidy_level, std::uint64_t& apa_size)
+      {
+        split_.genotypes_pending = false;
+        ploidy_level = split_.ploidy_level;
+        if (allele_prefixes_.size() < split_.prefixes.size())
+        {
+          allele_prefixes_.resize(split_.prefixes.size());
+          allele_offsets_.resize(split_.prefixes.size());
+        }
+
+        const std::uint8_t allele = std::uint8_t(split_.alt_index);
+        apa_size = 0;
+        for (std::size_t i = 0; i < split_.prefixes.size(); ++i)
+        {
+          if (split_.prefixes[i] == 0 || split_.prefixes[i] == allele)
           {
-            ploidy_level = ploidy_;
+            allele_prefixes_[apa_size] = split_.prefixes[i] ? 1 : 0;
+            allele_offsets_[apa_size] = split_.offsets[i];
+            ++apa_size;
           }
+        }
+      }
 
+      /**
+       * Maps the decoded PBWT positions in allele_offsets_ to sorted haplotype indices and
+       * advances the PBWT order of the current FORMAT field.
+       * @return false if the order doesn't match the number of haplotypes.
+       */
+      bool apply_pbwt(bool reset, std::uint64_t apa_size, std::uint64_t num_haps)
+      {
+        ::savvy::detail::pbwt_order& order = pbwt_[format_cursor_];
+        if (reset)
+          order.reset(num_haps);
+        else if (order.size() != num_haps)
+          return false;
+
+        order.to_haplotypes(allele_offsets_.data(), allele_prefixes_.data(), apa_size);
+        return true;
+      }
+
+      /**
+       * Decodes the sample blocks of a genotype block into allele_prefixes_ and allele_offsets_.
+       * When samples are subset, blocks without any requested sample are skipped.
+       * @param in_it Beginning of SAMPLE_BLOCK_SIZES. Advanced to the end of the last block.
+       * @param apa_size Total number of pairs decoded.
+       * @return false if the genotype block is truncated or invalid.
+       */
+      template <std::size_t BitWidth>
+      bool read_allele_pair_blocks(const char*& in_it, const char* end_it, std::uint64_t ploidy_level, std::uint64_t block_haps, std::uint64_t& apa_size)
+      {
+        const std::uint64_t num_haps = samples().size() * ploidy_level;
+        const std::uint64_t block_count = (num_haps + block_haps - 1) / block_haps;
+        if (sample_block_sizes_.size() < block_count)
+          sample_block_sizes_.resize(block_count);
+
+        for (std::uint64_t b = 0; b < block_count; ++b)
+        {
+          in_it = varint_decode(in_it, end_it, sample_block_sizes_[b]);
           if (in_it == end_it)
+            return false;
+          ++in_it;
+        }
+
+        const bool subset = subset_size_ != samples().size();
+        apa_size = 0;
+        for (std::uint64_t b = 0; b < block_count; ++b)
+        {
+          if (std::uint64_t(end_it - in_it) < sample_block_sizes_[b])
+            return false;
+          const char* block_end = in_it + sample_block_sizes_[b];
+          const std::uint64_t block_beg_hap = b * block_haps;
+          const std::uint64_t block_end_hap = std::min(block_beg_hap + block_haps, num_haps);
+
+          if (subset && subset_counts_[(block_end_hap - 1) / ploidy_level + 1] == subset_counts_[block_beg_hap / ploidy_level])
+          {
+            in_it = block_end;
+            continue;
+          }
+
+          std::uint64_t sz;
+          in_it = varint_decode(in_it, block_end, sz);
+          if (in_it == block_end)
+            return false;
+          ++in_it;
+
+          if (sz > block_end_hap - block_beg_hap)
+            return false;
+
+          if (allele_prefixes_.size() < apa_size + sz)
+          {
+            allele_prefixes_.resize(apa_size + sz);
+            allele_offsets_.resize(apa_size + sz);
+          }
+
+          std::uint64_t* offsets = allele_offsets_.data() + apa_size;
+          if (decode_pairs<BitWidth>(in_it, block_end, sz, allele_prefixes_.data() + apa_size, offsets) != sz || in_it != block_end)
+            return false;
+          if (sz && offsets[sz - 1] >= block_end_hap - block_beg_hap)
+            return false;
+
+          for (std::uint64_t i = 0; i < sz; ++i)
+            offsets[i] += block_beg_hap;
+          apa_size += sz;
+        }
+
+        return in_it == end_it;
+      }
+
+      /**
+       * Skips the genotype block without decoding it, which is only possible when GT_SZ is stored.
+       * @return false if stream is truncated.
+       */
+      bool skip_genotype_block()
+      {
+        std::uint64_t block_size;
+        ::savvy::detail::zstd_ibuf& sbuf = *input_stream_->rdbuf();
+        if (!read_vli(block_size) || sbuf.fill(block_size) < block_size)
+          return false;
+        sbuf.consume(sbuf.data() + block_size);
+        return true;
+      }
+
+      /**
+       * Moves past the genotype block of the current FORMAT field. PBWT records update the
+       * haplotype order, so they are decoded rather than skipped.
+       * @return false if stream is truncated.
+       */
+      bool pass_genotype_block()
+      {
+        if (minor_version_ >= 1 && !(features_ & feature_pbwt))
+          return skip_genotype_block();
+
+        switch (file_bit_widths_[format_cursor_])
+        {
+          case 1: return pass_allele_pair_array<1>();
+          case 2: return pass_allele_pair_array<2>();
+          case 3: return pass_allele_pair_array<3>();
+          case 4: return pass_allele_pair_array<4>();
+          case 5: return pass_allele_pair_array<5>();
+          case 6: return pass_allele_pair_array<6>();
+          default: return pass_allele_pair_array<7>();
+        }
+      }
+
+      template <std::size_t BitWidth>
+      bool pass_allele_pair_array()
+      {
+        std::uint64_t ploidy_level;
+        std::uint64_t sz;
+        detail::allele_pair_cursor<BitWidth> pairs;
+        if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
+          return false;
+
+        std::uint8_t prefix;
+        std::uint64_t offset;
+        while (pairs.next(prefix, offset)) { }
+        return end_allele_pair_array(pairs);
+      }
+
+      /**
+       * Positions the stream at the genotype block of a FORMAT field of the current record by
+       * passing the blocks in front of it.
+       * @param field Index into data_formats(). The field count passes the whole record.
+       * @return false if stream is truncated.
+       */
+      bool seek_genotype_block(std::size_t field)
+      {
+        if (format_cursor_ == 0 && (features_ & feature_columnar_frames))
+        {
+          // Catch up with the site frame by skipping the genotype blocks of discarded records.
+          for ( ; genotype_lag_; --genotype_lag_, ++genotypes_in_frame_)
+          {
+            for (std::size_t i = 0; i < file_data_formats_.size(); ++i)
+            {
+              if (!skip_genotype_block())
+                return false;
+            }
+          }
+          ++genotypes_in_frame_;
+        }
+
+        for ( ; format_cursor_ < field; ++format_cursor_)
+        {
+          if (!pass_genotype_block())
+            return false;
+        }
+        return true;
+      }
+
+      /**
+       * @return Index of the stored FORMAT field that data_format is decoded from. Hard call
+       * formats prefer GT and dosage formats prefer HDS, but either can be derived from the other.
+       */
+      std::size_t format_field(fmt data_format) const
+      {
+        const fmt preferred = data_format == fmt::gt || data_format == fmt::ac ? fmt::gt : fmt::hds;
+        auto it = std::find(file_data_formats_.begin(), file_data_formats_.end(), preferred);
+        return it == file_data_formats_.end() ? 0 : std::size_t(it - file_data_formats_.begin());
+      }
+
+      /**
+       * Positions the stream at the genotype block that data_format is decoded from.
+       * @return Index of the field, or the field count if no genotypes can be read, in which case
+       * the stream state is set if the request was invalid or the file is truncated.
+       */
+      std::size_t begin_genotype_field(fmt data_format)
+      {
+        if (!good())
+          return file_data_formats_.size();
+
+        if (split_.genotypes_pending)
+          return 0; // Split records only store GT, which was decoded with the site fields.
+
+        const std::size_t field = format_field(data_format);
+        if (field < format_cursor_)
+        {
+          // Fields are stored in header order and the stream can't go back to an earlier one.
+          // Reading the last read field again leaves the destination as is.
+          if (field + 1 != format_cursor_)
+            input_stream_->setstate(std::ios::failbit);
+          return file_data_formats_.size();
+        }
+
+        if (!genotypes_pending_)
+          return file_data_formats_.size();
+
+        if (!seek_genotype_block(field))
+        {
+          assert(!"Truncated file");
+          input_stream_->setstate(std::ios::badbit);
+          return file_data_formats_.size();
+        }
+        return field;
+      }
+
+      /**
+       * Marks the genotype block of the current field as read. The cursor stays past the last
+       * field until the next record's site fields are read.
+       */
+      void end_genotype_field()
+      {
+        if (format_cursor_ < file_data_formats_.size() && ++format_cursor_ == file_data_formats_.size())
+          genotypes_pending_ = false;
+      }
+
+      /**
+       * Reads a VLS into dest, reusing its capacity.
+       * @return false if stream is truncated.
+       */
+      template <typename Buf>
+      static bool read_string(Buf& sbuf, std::string& dest)
+      {
+        std::uint64_t sz;
+        if (!read_vli(sbuf, sz))
+          return false;
+
+        if (sbuf.fill(sz) < sz)
+          return false;
+        dest.assign(sbuf.data(), sz);
+        sbuf.consume(sbuf.data() + sz);
+        return true;
+      }
+
+      /**
+       * Skips what is left of the current block's genotype frame, leaving the stream at the next
+       * site frame. The frame is skipped without being decompressed if none of its genotype
+       * blocks were read.
+       */
+      void end_genotype_frame()
+      {
+        if (sites_in_frame_ && good())
+        {
+          ::savvy::detail::zstd_ibuf& sbuf = *input_stream_->rdbuf();
+          bool success = true;
+          if (genotypes_in_frame_ == 0)
           {
+            success = sbuf.finish_frame() && sbuf.skip_frame();
+          }
+          else
+          {
+            for (std::size_t i = genotypes_in_frame_ * file_data_formats_.size(); i < sites_in_frame_ * file_data_formats_.size() && success; ++i)
+              success = skip_genotype_block();
+            success = success && sbuf.finish_frame();
+          }
+
+          if (!success)
+          {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
+        }
+
+        sites_in_frame_ = 0;
+        genotypes_in_frame_ = 0;
+        genotype_lag_ = 0;
+      }
+
+      /**
+       * Decompresses the next site frame into site_frame_.
+       * @return false at the end of the file or on error.
+       */
+      bool load_site_frame()
+      {
+        end_genotype_frame();
+        if (!good())
+          return false;
+
+        ::savvy::detail::zstd_ibuf& sbuf = *input_stream_->rdbuf();
+        std::size_t avail = sbuf.fill(1);
+        if (avail == 0)
+        {
+          this->input_stream_->setstate(std::ios::eofbit); // No more markers to read.
+          return false;
+        }
+        site_frame_offset_ = this->input_stream_->tellg();
+
+        // The get area never spans two frames, so the frame is complete once a request comes back short.
+        for (std::size_t want = avail * 2; (avail = sbuf.fill(want)) >= want; want = avail * 2) {}
+        site_frame_.assign(sbuf.data(), avail);
+        sbuf.consume(sbuf.data() + avail);
+        return true;
+      }
+
+      /**
+       * Moves the stream to the start of a block (e.g., from an s1r entry), dropping any state
+       * of the current one.
+       */
+      void seek_block(std::streampos pos)
+      {
+        genotypes_pending_ = false;
+        format_cursor_ = 0;
+        reset_split_record();
+        site_frame_.clear();
+        sites_in_frame_ = 0;
+        genotypes_in_frame_ = 0;
+        genotype_lag_ = 0;
+        input_stream_->seekg(pos);
+      }
+
+      /**
+       * Parses the site fields of the next record into annotations. Strings and property values
+       * are assigned in place, so reading into the same site_info does not allocate once its
+       * buffers have grown to fit.
+       */
+      void read_variant_details(site_info& annotations)
+      {
+        if (genotypes_pending_ || split_.genotypes_pending)
+          discard_genotypes(); // Genotypes of the previous record were never requested.
+
+        if (split_.alt_index < split_.alts.size())
+        {
+          if (good())
+            next_split_record(annotations);
+          return;
+        }
+        reset_split_record();
+
+        if (good())
+        {
+          if (features_ & feature_columnar_frames)
+          {
+            if (!site_frame_.empty() || load_site_frame())
+            {
+              ++sites_in_frame_;
+              parse_site_fields(site_frame_, annotations);
+            }
+          }
+          else if (input_stream_->rdbuf()->fill(1) == 0)
+          {
+            this->input_stream_->setstate(std::ios::eofbit); // No more markers to read.
+          }
           else
+          {
+            parse_site_fields(*input_stream_->rdbuf(), annotations);
+          }
+
+          if (good() && (features_ & feature_multiallelic))
+            begin_multiallelic_record(annotations);
+        }
+      }
+
+      /**
+       * Sets the GT prefix width of a record read from a file with the multiallelic feature.
+       * With split_multiallelic, the GT block of a record with several ALT alleles is decoded
+       * right away and the record is presented as its first split record.
+       */
+      void begin_multiallelic_record(site_info& annotations)
+      {
+        const std::size_t alt_count = detail::alt_allele_count(annotations.alt_);
+        gt_prefix_width_ = detail::allele_index_bit_width(alt_count);
+        if (split_multiallelic_ && alt_count > 1)
+        {
+          if (begin_genotype_field(fmt::gt) < file_data_formats_.size())
           {
             std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            for (std::size_t i = 0; i < sz && in_it != end_it; ++i)
+            detail::allele_pair_cursor<1> pairs;
+            bool pairs_read = read_allele_pair_array<1>(split_.ploidy_level, sz, pairs);
+            if (pairs_read)
             {
-              std::uint8_t allele;
-              std::uint64_t offset;
-              in_it = prefixed_varint<BitWidth>::decode(++in_it, end_it, allele, offset);
+              split_.prefixes.resize(sz);
+              split_.offsets.resize(sz);
+              for (std::size_t i = 0; pairs.next(split_.prefixes[i], split_.offsets[i]); ++i) { }
+              pairs_read = end_allele_pair_array(pairs);
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!pairs_read)
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
+              return;
+            }
+            end_genotype_field();
+          }
+
+          if (good())
+          {
+            split_.alts.resize(alt_count);
+            std::size_t start = 0;
+            for (std::size_t i = 0; i < alt_count; ++i)
+            {
+              const std::size_t end = std::min(annotations.alt_.find(',', start), annotations.alt_.size());
+              split_.alts[i].assign(annotations.alt_, start, end - start);
+              start = end + 1;
             }
+            assign_site_fields(annotations, split_.site);
+            split_.alt_index = 0;
+            next_split_record(annotations);
           }
         }
       }
 
-      void discard_genotypes()
+      /**
+       * Presents the multi-allelic record in split_ as a biallelic record of its next ALT allele.
+       */
+      void next_split_record(site_info& annotations)
+      {
+        assign_site_fields(split_.site, annotations);
+        annotations.alt_ = split_.alts[split_.alt_index++];
+        split_.genotypes_pending = true;
+      }
+
+      void reset_split_record()
       {
-        if (this->file_data_format_ == fmt::gt)
-          this->discard_genotypes_impl<1>();
+        split_.alts.clear();
+        split_.alt_index = 0;
+        split_.genotypes_pending = false;
+      }
+
+      /**
+       * Parses SITE_HDR, CHROM, POS, REF and ALT of a file with delta coded sites.
+       * @return false if stream is truncated.
+       */
+      template <typename Buf>
+      bool read_delta_site(Buf& sbuf, site_info& annotations)
+      {
+        sbuf.fill(10);
+        std::uint8_t flags;
+        std::uint64_t pos;
+        const char* in_it = two_bit_prefixed_varint::decode(sbuf.data(), sbuf.data_end(), flags, pos);
+        if (in_it == sbuf.data_end())
+          return false;
+        sbuf.consume(++in_it);
+
+        if (flags & detail::site_header_chromosome)
+        {
+          if (!read_string(sbuf, prev_site_chromosome_))
+            return false;
+          prev_site_position_ = pos;
+        }
         else
-          this->discard_genotypes_impl<7>();
+        {
+          prev_site_position_ += std::uint64_t(zigzag_decode(pos));
+        }
+        annotations.chromosome_ = prev_site_chromosome_;
+        annotations.position_ = prev_site_position_;
+
+        if (flags & detail::site_header_snv)
+        {
+          if (sbuf.fill(1) == 0)
+            return false;
+          const std::uint8_t code = std::uint8_t(*sbuf.data());
+          sbuf.consume(sbuf.data() + 1);
+          annotations.ref_.assign(1, detail::snv_alphabet[(code >> 2) & 0x3]);
+          annotations.alt_.assign(1, detail::snv_alphabet[code & 0x3]);
+          return true;
+        }
+
+        return read_string(sbuf, annotations.ref_) && read_string(sbuf, annotations.alt_);
       }
 
-      template <std::size_t BitWidth, typename T>
-      void read_genotypes_al(site_info& annotations, T& destination)
+      /**
+       * Makes the property slots of annotations refer to exactly the INFO fields of this file,
+       * in header order. Slots left from the previous record are kept, so that values are read
+       * in place without hashing keys. Otherwise properties are rebuilt, which drops those from
+       * other sources (e.g., a different file or prop() calls).
+       */
+      void bind_property_slots(site_info& annotations) const
       {
-        if (good())
+        std::vector<std::pair<const std::string, std::string>*>& slots = annotations.property_slots_;
+        bool bound = slots.size() == metadata_fields_.size() && annotations.properties_.size() == metadata_fields_.size();
+        for (std::size_t i = 0; bound && i < slots.size(); ++i)
+          bound = slots[i]->first == metadata_fields_[i];
+
+        if (!bound)
         {
-          const auto missing_value = std::numeric_limits<typename T::value_type>::quiet_NaN();
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
+          slots.clear();
+          annotations.properties_.clear();
+          for (const std::string& key : metadata_fields_)
+            slots.push_back(&*annotations.properties_.emplace(key, std::string()).first);
+        }
+      }
 
-          std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
+      /**
+       * Assigns the site fields of src, whose property slots are bound, to dest in place.
+       */
+      void assign_site_fields(const site_info& src, site_info& dest) const
+      {
+        dest.chromosome_ = src.chromosome_;
+        dest.position_ = src.position_;
+        dest.ref_ = src.ref_;
+        dest.alt_ = src.alt_;
+        bind_property_slots(dest);
+        for (std::size_t i = 0; i < dest.property_slots_.size(); ++i)
+          dest.property_slots_[i]->second = src.property_slots_[i]->second;
+      }
+
+      /**
+       * Parses the site fields of a record from sbuf, which is either the zstd stream or a columnar site frame.
+       */
+      template <typename Buf>
+      void parse_site_fields(Buf& sbuf, site_info& annotations)
+      {
+        const bool site_read = features_ & feature_delta_sites
+          ? read_delta_site(sbuf, annotations)
+          : read_string(sbuf, annotations.chromosome_) && read_vli(sbuf, annotations.position_) && read_string(sbuf, annotations.ref_) && read_string(sbuf, annotations.alt_);
+        if (!site_read)
+        {
+          this->input_stream_->setstate(std::ios::badbit);
+        }
+        else
+        {
+          bind_property_slots(annotations);
+          for (auto it = annotations.property_slots_.begin(); it != annotations.property_slots_.end(); ++it)
           {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
+            if (!read_string(sbuf, (*it)->second))
+            {
+              this->input_stream_->setstate(std::ios::badbit);
+              break;
+            }
+          }
+
+          if (!this->input_stream_->good())
+          {
+            this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            ploidy_level = ploidy_;
+            genotypes_pending_ = true;
+            format_cursor_ = 0;
           }
+        }
+      }
 
-          if (in_it == end_it)
+      /**
+       * Passes the genotype blocks of the current record that haven't been read.
+       */
+      void discard_genotypes()
+      {
+        split_.genotypes_pending = false;
+        if (genotypes_pending_)
+        {
+          genotypes_pending_ = false;
+          if ((features_ & feature_columnar_frames) && !(features_ & feature_pbwt) && format_cursor_ == 0)
+          {
+            ++genotype_lag_; // Skipped once a later record's genotypes are read, or not at all.
+          }
+          else if (good() && !seek_genotype_block(file_data_formats_.size()))
           {
+            assert(!"Truncated file");
+            this->input_stream_->setstate(std::ios::badbit);
+          }
+          format_cursor_ = 0;
+        }
+      }
+
+      /**
+       * GT prefixes of multi-allelic records are allele indices, which fmt::gt reports as is.
+       * Every other format treats any ALT allele as 1.
+       */
+      template <std::size_t BitWidth, typename T>
+      static T allele_index(std::uint8_t prefix, const T& missing_value)
+      {
+        if (BitWidth == 1 && prefix > 1)
+          return T(prefix);
+        return detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
+      }
+
+      template <std::size_t BitWidth, typename T>
+      void read_genotypes_al(T& destination)
+      {
+        if (good())
+        {
+          const auto missing_value = std::numeric_limits<typename T::value_type>::quiet_NaN();
+
+          std::uint64_t ploidy_level;
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
+          {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            std::uint64_t total_offset = 0;
+            std::uint8_t prefix;
+            std::uint64_t offset;
 
             if (subset_size_ != samples().size())
             {
               destination.resize(subset_size_ * ploidy_level);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-
-                const std::uint64_t sample_index = total_offset / ploidy_level;
+                typename T::value_type allele = allele_index<BitWidth>(prefix, missing_value);
+                const std::uint64_t sample_index = offset / ploidy_level;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
                 {
                   if (BitWidth != 1)
                   {
                     allele = std::round(allele);
                     if (allele != typename T::value_type())
-                      destination[subset_map_[sample_index] * ploidy_level + (total_offset % ploidy_level)] = allele;
+                      ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy_level + (offset % ploidy_level)) = allele;
                   }
                   else
                   {
-                    destination[subset_map_[sample_index] * ploidy_level + (total_offset % ploidy_level)] = allele;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy_level + (offset % ploidy_level)) = allele;
                   }
                 }
               }
@@ -326,28 +1260,25 @@ namespace savvy
             else
             {
               destination.resize(samples().size() * ploidy_level);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-
+                typename T::value_type allele = allele_index<BitWidth>(prefix, missing_value);
                 if (BitWidth != 1)
                 {
                   allele = std::round(allele);
                   if (allele != typename T::value_type())
-                    destination[total_offset] = allele;
+                    ::savvy::detail::sorted_element(destination, offset) = allele;
                 }
                 else
                 {
-                  destination[total_offset] = allele;
+                  ::savvy::detail::sorted_element(destination, offset) = allele;
                 }
               }
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!end_allele_pair_array(pairs))
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
@@ -357,59 +1288,45 @@ namespace savvy
       }
 
       template <std::size_t BitWidth, typename T>
-      void read_genotypes_gt(site_info& annotations, T& destination)
+      void read_genotypes_gt(T& destination)
       {
         if (good())
         {
           const auto missing_value = std::numeric_limits<typename T::value_type>::quiet_NaN();
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
 
           std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
-          {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
-          }
-          else
-          {
-            ploidy_level = ploidy_;
-          }
-
-          if (in_it == end_it)
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
           {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            std::uint64_t total_offset = 0;
-
+            std::uint8_t prefix;
+            std::uint64_t offset;
 
             if (subset_size_ != samples().size())
             {
               destination.resize(subset_size_);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-
-                const std::uint64_t sample_index = total_offset / ploidy_level;
+                typename T::value_type allele = detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
+                const std::uint64_t sample_index = offset / ploidy_level;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
                 {
                   if (BitWidth != 1)
                   {
                     allele = std::round(allele);
                     if (allele != typename T::value_type())
-                      destination[subset_map_[sample_index]] += allele;
+                      ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) += allele;
                   }
                   else
                   {
-                    destination[subset_map_[sample_index]] += allele;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) += allele;
                   }
                 }
               }
@@ -417,28 +1334,25 @@ namespace savvy
             else
             {
               destination.resize(samples().size());
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-
+                typename T::value_type allele = detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
                 if (BitWidth != 1)
                 {
                   allele = std::round(allele);
                   if (allele != typename T::value_type())
-                    destination[total_offset / ploidy_level] += allele;
+                    ::savvy::detail::sorted_element(destination, offset / ploidy_level) += allele;
                 }
                 else
                 {
-                  destination[total_offset / ploidy_level] += allele;
+                  ::savvy::detail::sorted_element(destination, offset / ploidy_level) += allele;
                 }
               }
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!end_allele_pair_array(pairs))
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
@@ -448,118 +1362,172 @@ namespace savvy
       }
 
       template <std::size_t BitWidth, typename T>
-      void read_genotypes_gp(site_info& annotations, T& destination)
+      void read_genotypes_gp(T& destination)
       {
         if (good())
         {
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
-
           std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
+          {
+            assert(!"Truncated file");
+            this->input_stream_->setstate(std::ios::badbit);
+            return;
+          }
+
+          if (ploidy_level == 1)
+          {
+            write_gp<BitWidth, 1>(destination, ploidy_level, sz, pairs);
+          }
+          else if (ploidy_level == 2)
+          {
+            write_gp<BitWidth, 2>(destination, ploidy_level, sz, pairs);
+          }
+          else if (ploidy_level > 2)
           {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
+            write_gp<BitWidth, 0>(destination, ploidy_level, sz, pairs);
           }
           else
           {
-            ploidy_level = ploidy_;
+            destination.resize(subset_size_);
           }
 
-          if (in_it == end_it)
+          if (!end_allele_pair_array(pairs))
           {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
+        }
+      }
+
+      /**
+       * Converts the decoded haplotype dosages of a record to genotype probabilities. Only samples
+       * with stored haplotypes are converted. The ranges of samples in between are homozygous
+       * reference, which is a strided fill.
+       * @tparam Ploidy Compile time ploidy (1 or 2) or 0 for the generic path.
+       */
+      template <std::size_t BitWidth, std::size_t Ploidy, typename T>
+      void write_gp(T& destination, std::uint64_t ploidy_level, std::uint64_t sz, detail::allele_pair_cursor<BitWidth>& pairs)
+      {
+        typedef typename T::value_type value_type;
+        const std::uint64_t ploidy = Ploidy ? Ploidy : ploidy_level;
+        const std::size_t stride = ploidy + 1;
+        const bool subset = subset_size_ != samples().size();
+
+        destination.resize(subset_size_ * stride);
+        ::savvy::detail::reserve_non_zero(destination, subset_size_ + sz * stride);
+
+        // Haplotype and genotype probabilities of the current sample. Ploidy above 8 is rare enough to use the heap.
+        value_type stack_buf[2 * 8 + 1];
+        std::vector<value_type> heap_buf;
+        value_type* hap_probs = stack_buf;
+        if (ploidy > 8)
+        {
+          heap_buf.resize(2 * ploidy + 1);
+          hap_probs = heap_buf.data();
+        }
+        value_type* gp = hap_probs + ploidy;
+
+        std::uint8_t prefix;
+        std::uint64_t offset;
+        bool pair_read = pairs.next(prefix, offset);
+        std::uint64_t next_sample = 0;
+        while (pair_read)
+        {
+          const std::uint64_t sample_index = offset / ploidy;
+          fill_hom_ref_gp(destination, stride, next_sample, sample_index, subset);
+          next_sample = sample_index + 1;
+
+          // Pairs are read one ahead to find the end of the sample's haplotypes.
+          std::fill(hap_probs, hap_probs + ploidy, value_type(0));
+          do
+          {
+            hap_probs[offset % ploidy] = detail::allele_decoder<BitWidth>::decode_prefix(prefix, std::numeric_limits<value_type>::quiet_NaN());
+            pair_read = pairs.next(prefix, offset);
+          } while (pair_read && offset / ploidy == sample_index);
+
+          const std::uint64_t dest_index = subset_map_[sample_index];
+          if (dest_index == std::numeric_limits<std::uint64_t>::max())
+            continue;
+
+          if (Ploidy == 1)
+            hds_to_gp<value_type>::haploid(hap_probs[0], gp);
+          else if (Ploidy == 2)
+            hds_to_gp<value_type>::diploid(hap_probs[0], hap_probs[1], gp);
           else
+            hds_to_gp<value_type>::polyploid(hap_probs, ploidy, gp);
+
+          for (std::size_t g = 0; g < stride; ++g)
           {
-            const std::size_t stride = ploidy_level + 1;
+            if (gp[g] != value_type(0))
+              ::savvy::detail::sorted_element(destination, dest_index * stride + g) = gp[g];
+          }
+        }
 
-            std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            std::uint64_t total_offset = 0;
+        fill_hom_ref_gp(destination, stride, next_sample, samples().size(), subset);
+      }
 
-            {
-              std::size_t num_haps = samples().size() * ploidy_level;
-              destination.resize(subset_size_ * stride);
+      /**
+       * Sets GP of samples [beg_sample, end_sample) to homozygous reference.
+       */
+      template <typename T>
+      void fill_hom_ref_gp(T& destination, std::size_t stride, std::uint64_t beg_sample, std::uint64_t end_sample, bool subset)
+      {
+        if (subset)
+        {
+          beg_sample = subset_counts_[beg_sample];
+          end_sample = subset_counts_[end_sample];
+        }
 
-              std::vector<typename T::value_type> hap_tmp;
-              hap_tmp.reserve(ploidy_level);
+        for (std::uint64_t i = beg_sample; i < end_sample; ++i)
+          ::savvy::detail::sorted_element(destination, i * stride) = typename T::value_type(1);
+      }
 
-              auto write_gp_to_dest = [this, stride, ploidy_level](std::size_t hap_index, const std::vector<typename T::value_type>& hap_probs, T& destination)
-              {
-                const std::uint64_t sample_index = hap_index / ploidy_level;
-                if (this->subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
-                {
-                  typename T::value_type gp = hds_to_gp<typename T::value_type>::get_first_prob(hap_probs);
-                  if (gp != typename T::value_type(0))
-                    destination[this->subset_map_[sample_index] * stride] = gp;
+      template <std::size_t BitWidth, typename T>
+      void read_genotypes_hds(T& destination)
+      {
+        if (good())
+        {
+          const auto missing_value = std::numeric_limits<typename T::value_type>::quiet_NaN();
 
-                  if (ploidy_level == 2)
-                  {
-                    gp = hap_probs[0] * (typename T::value_type(1) - hap_probs[1]) + hap_probs[1] * (typename T::value_type(1) - hap_probs[0]);
-                    if (gp != typename T::value_type(0))
-                      destination[this->subset_map_[sample_index] * stride + 1] = gp;
-                  }
-                  else
-                  {
-                    for (std::size_t g = 1; g < ploidy_level; ++g)
-                    {
-                      gp = hds_to_gp<typename T::value_type>::get_prob(hap_probs, g);
-                      if (gp != typename T::value_type(0))
-                      {
-                        destination[this->subset_map_[sample_index] * stride + g] = gp;
-                      }
-                    }
-                  }
+          std::uint64_t ploidy_level;
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
+          {
+            assert(!"Truncated file");
+            this->input_stream_->setstate(std::ios::badbit);
+          }
+          else
+          {
+            std::uint8_t prefix;
+            std::uint64_t offset;
 
-                  gp = hds_to_gp<typename T::value_type>::get_last_prob(hap_probs);
-                  if (gp != typename T::value_type(0))
-                    destination[this->subset_map_[sample_index] * stride + ploidy_level] = gp;
-                }
-              };
+            if (subset_size_ != samples().size())
+            {
+              destination.resize(subset_size_ * ploidy_level);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              std::size_t h = 0;
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, std::numeric_limits<typename T::value_type>::quiet_NaN());
-                total_offset += offset;
-
-
-                assert(total_offset < num_haps);
-                for ( ; h < total_offset; ++h)
-                {
-                  hap_tmp.push_back(typename T::value_type(0));
-                  if (hap_tmp.size() == ploidy_level)
-                  {
-                    write_gp_to_dest(h, hap_tmp, destination);
-                    hap_tmp.resize(0);
-                  }
-                }
-
-                hap_tmp.push_back(allele);
-                if (hap_tmp.size() == ploidy_level)
+                const std::uint64_t sample_index = offset / ploidy_level;
+                if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
                 {
-                  write_gp_to_dest(h, hap_tmp, destination);
-                  hap_tmp.resize(0);
+                  ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy_level + (offset % ploidy_level)) = detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
                 }
-                ++h;
               }
+            }
+            else
+            {
+              destination.resize(samples().size() * ploidy_level);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              // TODO: This section can be optimized. After hap_tmp is cleared out, the rest will be 1,0,0.
-              for ( ; h < num_haps; ++h)
-              {
-                hap_tmp.push_back(typename T::value_type(0));
-                if (hap_tmp.size() == ploidy_level)
-                {
-                  write_gp_to_dest(h, hap_tmp, destination);
-                  hap_tmp.resize(0);
-                }
-              }
+              while (pairs.next(prefix, offset))
+                ::savvy::detail::sorted_element(destination, offset) = detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!end_allele_pair_array(pairs))
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
@@ -569,71 +1537,49 @@ namespace savvy
       }
 
       template <std::size_t BitWidth, typename T>
-      void read_genotypes_hds(site_info& annotations, T& destination)
+      void read_genotypes_ds(T& destination)
       {
         if (good())
         {
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
+          const typename T::value_type missing_value(std::numeric_limits<typename T::value_type>::quiet_NaN());
 
           std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
-          {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
-          }
-          else
-          {
-            ploidy_level = ploidy_;
-          }
-
-          if (in_it == end_it)
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
           {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            std::uint64_t total_offset = 0;
+            std::uint8_t prefix;
+            std::uint64_t offset;
 
             if (subset_size_ != samples().size())
             {
-              destination.resize(subset_size_ * ploidy_level);
+              destination.resize(subset_size_);
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              while (pairs.next(prefix, offset))
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, std::numeric_limits<typename T::value_type>::quiet_NaN());
-
-                total_offset += offset;
-
-                const std::uint64_t sample_index = total_offset / ploidy_level;
+                const std::uint64_t sample_index = offset / ploidy_level;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
                 {
-                  destination[subset_map_[sample_index] * ploidy_level + (total_offset % ploidy_level)] = allele;
+                  ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) += detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
                 }
               }
             }
             else
             {
-              destination.resize(samples().size() * ploidy_level);
-
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
-              {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, std::numeric_limits<typename T::value_type>::quiet_NaN());
-
-                total_offset += offset;
+              destination.resize(samples().size());
+              ::savvy::detail::reserve_non_zero(destination, sz);
 
-                assert(total_offset < (samples().size() * ploidy_level));
-                destination[total_offset] = allele;
-              }
+              while (pairs.next(prefix, offset))
+                ::savvy::detail::sorted_element(destination, offset / ploidy_level) += detail::allele_decoder<BitWidth>::decode_prefix(prefix, missing_value);
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!end_allele_pair_array(pairs))
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
@@ -642,69 +1588,131 @@ namespace savvy
         }
       }
 
-      template <std::size_t BitWidth, typename T>
-      void read_genotypes_ds(site_info& annotations, T& destination)
+      template <std::size_t BitWidth>
+      void read_genotypes_packed(packed_allele_vector& destination)
       {
         if (good())
         {
-          const typename T::value_type missing_value(std::numeric_limits<typename T::value_type>::quiet_NaN());
-          std::istreambuf_iterator<char> in_it(*input_stream_);
-          std::istreambuf_iterator<char> end_it;
-
           std::uint64_t ploidy_level;
-          if (ploidy_ == 0)
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
           {
-            if (varint_decode(in_it, end_it, ploidy_level) != end_it)
-              ++in_it;
+            assert(!"Truncated file");
+            this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            ploidy_level = ploidy_;
+            std::uint8_t prefix;
+            std::uint64_t offset;
+            const bool subset = subset_size_ != samples().size();
+            destination.resize((subset ? subset_size_ : samples().size()) * ploidy_level);
+
+            while (pairs.next(prefix, offset))
+            {
+              std::uint64_t hap_index = offset;
+              if (subset)
+              {
+                const std::uint64_t sample_index = hap_index / ploidy_level;
+                if (subset_map_[sample_index] == std::numeric_limits<std::uint64_t>::max())
+                  continue;
+                hap_index = subset_map_[sample_index] * ploidy_level + (hap_index % ploidy_level);
+              }
+
+              float allele = detail::allele_decoder<BitWidth>::decode_prefix(prefix, std::numeric_limits<float>::quiet_NaN());
+              if (BitWidth != 1)
+                allele = std::round(allele);
+
+              if (std::isnan(allele))
+                destination.set_missing(hap_index);
+              else if (allele != 0.f)
+                destination.set_alt(hap_index);
+            }
+
+            if (!end_allele_pair_array(pairs))
+            {
+              assert(!"Truncated file");
+              this->input_stream_->setstate(std::ios::badbit);
+            }
           }
+        }
+      }
 
-          if (in_it == end_it)
+      /**
+       * Bit-packed destinations only support fmt::gt.
+       */
+      void read_genotypes(fmt data_format, packed_allele_vector& destination)
+      {
+        destination.resize(0);
+        const std::size_t field = begin_genotype_field(data_format);
+        if (field < file_data_formats_.size())
+        {
+          if (data_format != fmt::gt)
+            input_stream_->setstate(std::ios::failbit);
+          else
+          {
+            switch (file_bit_widths_[field])
+            {
+              case 1: read_genotypes_packed<1>(destination); break;
+              case 2: read_genotypes_packed<2>(destination); break;
+              case 3: read_genotypes_packed<3>(destination); break;
+              case 4: read_genotypes_packed<4>(destination); break;
+              case 5: read_genotypes_packed<5>(destination); break;
+              case 6: read_genotypes_packed<6>(destination); break;
+              default: read_genotypes_packed<7>(destination);
+            }
+          }
+          end_genotype_field();
+        }
+      }
+
+      template <std::size_t BitWidth, typename T>
+      void read_genotypes_quantized(T& destination, bool hard_calls)
+      {
+        if (good())
+        {
+          std::uint64_t ploidy_level;
+          std::uint64_t sz;
+          detail::allele_pair_cursor<BitWidth> pairs;
+          if (!read_allele_pair_array<BitWidth>(ploidy_level, sz, pairs))
           {
+            assert(!"Truncated file");
             this->input_stream_->setstate(std::ios::badbit);
           }
           else
           {
-            std::uint64_t sz;
-            varint_decode(in_it, end_it, sz);
-            std::uint64_t total_offset = 0;
+            std::uint8_t prefix;
+            std::uint64_t offset;
+            const bool subset = subset_size_ != samples().size();
+            destination.resize((subset ? subset_size_ : samples().size()) * ploidy_level);
+            ::savvy::detail::reserve_non_zero(destination, sz);
 
-            if (subset_size_ != samples().size())
+            while (pairs.next(prefix, offset))
             {
-              destination.resize(subset_size_);
-
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+              std::uint64_t hap_index = offset;
+              if (subset)
               {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-
-                const std::uint64_t sample_index = total_offset / ploidy_level;
-                if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
-                {
-                  destination[subset_map_[sample_index]] += allele;
-                }
+                const std::uint64_t sample_index = hap_index / ploidy_level;
+                if (subset_map_[sample_index] == std::numeric_limits<std::uint64_t>::max())
+                  continue;
+                hap_index = subset_map_[sample_index] * ploidy_level + (hap_index % ploidy_level);
               }
-            }
-            else
-            {
-              destination.resize(samples().size());
 
-              for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
-              {
-                typename T::value_type allele;
-                std::uint64_t offset;
-                std::tie(allele, offset) = detail::allele_decoder<BitWidth>::decode(++in_it, end_it, missing_value);
-                total_offset += offset;
-                destination[total_offset / ploidy_level] += allele;
-              }
+              // Stored values are (prefix + 1) / 2^BitWidth, with a 1-bit prefix of zero meaning missing.
+              std::uint8_t code;
+              if (BitWidth == 1)
+                code = prefix ? dosage_code_scale : dosage_code_missing;
+              else
+                code = std::uint8_t((prefix + 1u) << (7u - BitWidth));
+
+              if (hard_calls && code != dosage_code_missing)
+                code = code >= dosage_code_scale / 2 ? dosage_code_scale : 0; // Matches std::round() in read_genotypes_al().
+
+              if (code)
+                ::savvy::detail::sorted_element(destination, hap_index) = code;
             }
 
-            if (input_stream_->get() == std::char_traits<char>::eof())
+            if (!end_allele_pair_array(pairs))
             {
               assert(!"Truncated file");
               this->input_stream_->setstate(std::ios::badbit);
@@ -714,44 +1722,135 @@ namespace savvy
       }
 
       template <typename T>
-      void read_genotypes(site_info& annotations, T& destination)
+      void read_genotypes(T& destination)
+      {
+        read_genotypes(requested_data_format_, destination);
+      }
+
+      /**
+       * Decodes data_format from the stored FORMAT field it is derived from (see format_field()).
+       * The other fields of the record are skipped. Fields must be requested in header order.
+       */
+      template <typename T>
+      void read_genotypes(fmt data_format, T& destination)
+      {
+        read_genotypes(data_format, destination, std::false_type());
+      }
+
+      /**
+       * Decodes data_format (fmt::gt or fmt::hds) as dosage codes (see dosage_code.hpp) into a
+       * destination with a std::uint8_t value_type. Other formats set failbit.
+       */
+      template <typename T>
+      void read_dosage_codes(fmt data_format, T& destination)
+      {
+        read_genotypes(data_format, destination, std::true_type());
+      }
+
+      template <typename T, typename Quantized>
+      void read_genotypes(fmt data_format, T& destination, Quantized quantized)
       {
         destination.resize(0);
-        if (true) //requested_data_formats_[idx] == file_data_format_)
-        {
-          if (requested_data_format_ == fmt::gt)
-            file_data_format_ == fmt::gt ? read_genotypes_al<1>(annotations, destination) : read_genotypes_al<7>(annotations, destination);
-          else if (requested_data_format_== fmt::ac)
-            file_data_format_ == fmt::gt ? read_genotypes_gt<1>(annotations, destination) : read_genotypes_gt<7>(annotations, destination);
-          else if (requested_data_format_ == fmt::gp)
-            file_data_format_ == fmt::gt ? read_genotypes_gp<1>(annotations, destination) : read_genotypes_gp<7>(annotations, destination);
-          else if (requested_data_format_ == fmt::ds)
-            file_data_format_ == fmt::gt ? read_genotypes_ds<1>(annotations, destination) : read_genotypes_ds<7>(annotations, destination);
-          else if (requested_data_format_ == fmt::hds)
-            file_data_format_ == fmt::gt ? read_genotypes_hds<1>(annotations, destination) : read_genotypes_hds<7>(annotations, destination);
-          else
-            input_stream_->setstate(std::ios::failbit);
+        const std::size_t field = begin_genotype_field(data_format);
+        if (field < file_data_formats_.size())
+        {
+          read_genotypes_field(data_format, field, destination, quantized);
+          end_genotype_field();
         }
-        else
+      }
+
+      /**
+       * Decodes data_format from a stored field with the field's pair prefix width (1 for GT).
+       */
+      template <typename T, typename Quantized>
+      void read_genotypes_field(fmt data_format, std::size_t field, T& destination, Quantized quantized)
+      {
+        switch (file_bit_widths_[field])
         {
-          discard_genotypes();
+          case 1: read_genotypes_impl<1>(data_format, destination, quantized); break;
+          case 2: read_genotypes_impl<2>(data_format, destination, quantized); break;
+          case 3: read_genotypes_impl<3>(data_format, destination, quantized); break;
+          case 4: read_genotypes_impl<4>(data_format, destination, quantized); break;
+          case 5: read_genotypes_impl<5>(data_format, destination, quantized); break;
+          case 6: read_genotypes_impl<6>(data_format, destination, quantized); break;
+          default: read_genotypes_impl<7>(data_format, destination, quantized);
         }
       }
+
+      /**
+       * Quantized destinations only support haplotype level formats (fmt::gt and fmt::hds) since
+       * per sample sums don't fit in 8-bit codes.
+       */
+      template <std::size_t BitWidth, typename T>
+      void read_genotypes_impl(fmt data_format, T& destination, std::true_type /*quantized*/)
+      {
+        if (data_format == fmt::gt || data_format == fmt::hds)
+          read_genotypes_quantized<BitWidth>(destination, data_format == fmt::gt);
+        else
+          input_stream_->setstate(std::ios::failbit);
+      }
+
+      template <std::size_t BitWidth, typename T>
+      void read_genotypes_impl(fmt data_format, T& destination, std::false_type /*quantized*/)
+      {
+        if (data_format == fmt::gt)
+          read_genotypes_al<BitWidth>(destination);
+        else if (data_format == fmt::ac)
+          read_genotypes_gt<BitWidth>(destination);
+        else if (data_format == fmt::gp)
+          read_genotypes_gp<BitWidth>(destination);
+        else if (data_format == fmt::ds)
+          read_genotypes_ds<BitWidth>(destination);
+        else if (data_format == fmt::hds)
+          read_genotypes_hds<BitWidth>(destination);
+        else
+          input_stream_->setstate(std::ios::failbit);
+      }
+
+      template <typename T>
+      void read_genotypes(site_info& annotations, T& destination)
+      {
+        read_genotypes(destination);
+      }
     private:
       void parse_header();
+      void init_formats();
       void init_subset_map();
     protected:
       std::vector<std::string> sample_ids_;
       std::vector<std::uint64_t> subset_map_;
+      std::vector<std::uint64_t> subset_counts_; // Number of subset samples preceding each sample index (size is samples + 1).
       std::vector<std::pair<std::string, std::string>> headers_;
       std::vector<std::string> metadata_fields_;
       std::string file_path_;
       std::uint64_t subset_size_;
-      std::unique_ptr<std::istream> input_stream_;
+      std::unique_ptr<::savvy::detail::zstd_istream> input_stream_;
       fmt file_data_format_;
       fmt requested_data_format_;
+      std::vector<fmt> file_data_formats_;
+      std::vector<std::uint8_t> file_bit_widths_; // Pair prefix width of each stored field.
+      std::size_t format_cursor_ = 0; // FORMAT field of the current record whose genotype block is next in the stream.
       std::uint32_t ploidy_ = 0;
+      std::uint16_t minor_version_ = 0;
       std::array<std::uint8_t, 16> uuid_;
+      std::vector<char> dictionary_;
+      std::vector<std::uint8_t> allele_prefixes_;
+      std::vector<std::uint64_t> allele_offsets_;
+      std::vector<std::uint64_t> sample_block_sizes_;
+      std::uint32_t sample_block_size_ = 0;
+      bool genotypes_pending_ = false;
+      std::uint64_t features_ = 0;
+      detail::site_frame_buffer site_frame_;
+      std::streampos site_frame_offset_;
+      std::size_t sites_in_frame_ = 0;
+      std::size_t genotypes_in_frame_ = 0; // Genotype blocks of the current frame read or skipped so far.
+      std::size_t genotype_lag_ = 0; // Genotype blocks of discarded records that haven't been skipped yet.
+      std::string prev_site_chromosome_;
+      std::uint64_t prev_site_position_ = 0;
+      std::vector<::savvy::detail::pbwt_order> pbwt_; // One order per FORMAT field.
+      std::uint8_t gt_prefix_width_ = 1; // Pair prefix width of the current record's GT block.
+      bool split_multiallelic_ = false;
+      detail::split_record split_;
     };
     //################################################################//
 
@@ -771,22 +1870,84 @@ namespace savvy
       reader& read(site_info& annotations, T& destination)
       {
         this->read_variant_details(annotations);
-        this->read_genotypes(annotations, destination);
+        reader_base::read_genotypes(destination);
+        return *this;
+      }
+
+      /**
+       * Same as read(), but fills destination (e.g., std::vector<std::uint8_t>) with dosage codes
+       * (see dosage_code.hpp) instead of values. Only fmt::gt and fmt::hds can be read as codes.
+       */
+      template <typename T>
+      reader& read_dosage_codes(site_info& annotations, T& destination)
+      {
+        this->read_variant_details(annotations);
+        reader_base::read_dosage_codes(this->requested_data_format_, destination);
         return *this;
       }
 
       template <typename Pred, typename T>
       reader& read_if(Pred fn, site_info& annotations, T& destination)
       {
-        while (good())
+        while (this->read_site_info(annotations).good())
         {
-          this->read_variant_details(annotations);
-          this->read_genotypes(annotations, destination);
           if (fn(annotations))
+          {
+            reader_base::read_genotypes(destination);
             break;
+          }
         }
         return *this;
       }
+
+      /**
+       * Reads only the site info of the next record. Its genotypes are left undecoded until
+       * read_genotypes() or discard_genotypes() is called, and are skipped without being
+       * decoded if the next record is read first.
+       */
+      reader& read_site_info(site_info& annotations)
+      {
+        this->read_variant_details(annotations);
+        return *this;
+      }
+
+      /**
+       * Decodes the genotypes of the record last read with read_site_info().
+       */
+      template <typename T>
+      reader& read_genotypes(T& destination)
+      {
+        reader_base::read_genotypes(destination);
+        return *this;
+      }
+
+      /**
+       * Decodes data_format instead of the format requested at construction. With several
+       * FORMAT fields in the file (see data_formats()), this can be called once per field in
+       * header order to read, e.g., both GT and HDS of the same record.
+       */
+      template <typename T>
+      reader& read_genotypes(fmt data_format, T& destination)
+      {
+        reader_base::read_genotypes(data_format, destination);
+        return *this;
+      }
+
+      /**
+       * Decodes data_format of the record last read with read_site_info() as dosage codes.
+       */
+      template <typename T>
+      reader& read_dosage_codes(fmt data_format, T& destination)
+      {
+        reader_base::read_dosage_codes(data_format, destination);
+        return *this;
+      }
+
+      reader& discard_genotypes()
+      {
+        reader_base::discard_genotypes();
+        return *this;
+      }
     };
 
     class indexed_reader : public reader_base
@@ -794,7 +1955,12 @@ namespace savvy
     public:
       template <typename T>
       indexed_reader(const std::string& file_path, const std::string& index_file_path, const region& reg, bounding_point bound_type, T data_format)  :
-        reader_base(file_path, data_format),
+        indexed_reader(file_path, index_file_path, reg, bound_type, options(), data_format)
+      {
+      }
+
+      indexed_reader(const std::string& file_path, const std::string& index_file_path, const region& reg, bounding_point bound_type, const options& opts, savvy::fmt data_format)  :
+        reader_base(file_path, opts, data_format),
         index_(index_file_path.size() ? index_file_path : file_path + ".s1r"),
         query_(index_.create_query(reg)),
         i_(query_.begin()),
@@ -835,10 +2001,48 @@ namespace savvy
 
       template <typename T>
       indexed_reader& read(site_info& annotations, T& destination)
+      {
+        if (read_site_info(annotations).good())
+          reader_base::read_genotypes(destination);
+        return *this;
+      }
+
+      /**
+       * Same as read(), but fills destination with dosage codes (see reader::read_dosage_codes()).
+       */
+      template <typename T>
+      indexed_reader& read_dosage_codes(site_info& annotations, T& destination)
+      {
+        if (read_site_info(annotations).good())
+          reader_base::read_dosage_codes(this->requested_data_format_, destination);
+        return *this;
+      }
+
+      template <typename Pred, typename T>
+      indexed_reader& read_if(Pred fn, site_info& annotations, T& destination)
+      {
+        while (read_site_info(annotations).good())
+        {
+          if (fn(annotations))
+          {
+            reader_base::read_genotypes(destination);
+            break;
+          }
+        }
+
+        return *this;
+      }
+
+      /**
+       * Reads only the site info of the next record in the query region. Its genotypes are
+       * left undecoded until read_genotypes() or discard_genotypes() is called, and are
+       * skipped without being decoded if the next record is read first.
+       */
+      indexed_reader& read_site_info(site_info& annotations)
       {
         while (this->good())
         {
-          if (current_offset_in_block_ >= total_in_block_)
+          if (current_offset_in_block_ >= total_in_block_ && this->split_.alt_index >= this->split_.alts.size())
           {
             if (i_ == query_.end())
               this->input_stream_->setstate(std::ios::eofbit);
@@ -846,7 +2050,7 @@ namespace savvy
             {
               total_in_block_ = std::uint32_t(0x000000000000FFFF & i_->value()) + 1;
               current_offset_in_block_ = 0;
-              this->input_stream_->seekg(std::streampos((i_->value() >> 16) & 0x0000FFFFFFFFFFFF));
+              this->seek_block(std::streampos((i_->value() >> 16) & 0x0000FFFFFFFFFFFF));
               ++i_;
             }
           }
@@ -862,31 +2066,50 @@ namespace savvy
           }
           else
           {
-            ++current_offset_in_block_;
+            if (this->split_.alt_index <= 1)
+              ++current_offset_in_block_; // Split records after the first don't advance the block.
             if (region_compare(bounding_type_, annotations, reg_))
-            {
-              this->read_genotypes(annotations, destination);
               break;
-            }
             else
-            {
-              this->discard_genotypes();
-            }
+              reader_base::discard_genotypes();
           }
         }
         return *this;
       }
 
-      template <typename Pred, typename T>
-      indexed_reader& read_if(Pred fn, site_info& annotations, T& destination)
+      /**
+       * Decodes the genotypes of the record last read with read_site_info().
+       */
+      template <typename T>
+      indexed_reader& read_genotypes(T& destination)
       {
-        while (this->good())
-        {
-          read(annotations, destination);
-          if (fn(annotations))
-            break;
-        }
+        reader_base::read_genotypes(destination);
+        return *this;
+      }
+
+      /**
+       * Decodes data_format instead of the format requested at construction (see reader::read_genotypes()).
+       */
+      template <typename T>
+      indexed_reader& read_genotypes(fmt data_format, T& destination)
+      {
+        reader_base::read_genotypes(data_format, destination);
+        return *this;
+      }
+
+      /**
+       * Decodes data_format of the record last read with read_site_info() as dosage codes.
+       */
+      template <typename T>
+      indexed_reader& read_dosage_codes(fmt data_format, T& destination)
+      {
+        reader_base::read_dosage_codes(data_format, destination);
+        return *this;
+      }
 
+      indexed_reader& discard_genotypes()
+      {
+        reader_base::discard_genotypes();
         return *this;
       }
 
@@ -895,6 +2118,9 @@ namespace savvy
         current_offset_in_block_ = 0;
         total_in_block_ = 0;
         reg_ = reg;
+        this->genotypes_pending_ = false;
+        this->format_cursor_ = 0;
+        this->reset_split_record();
         this->input_stream_->clear();
         query_ = index_.create_query(reg);
         i_ = query_.begin();
@@ -918,11 +2144,36 @@ namespace savvy
       struct options
       {
         std::int8_t compression_level;
-        std::uint16_t block_size;
+        std::uint16_t block_size; ///< Maximum number of records per zstd frame. Zero disables all frame boundaries.
+        std::uint64_t block_max_bytes; ///< Frames are closed once their uncompressed size reaches this many bytes. Zero disables the byte budget.
+        std::uint32_t block_max_span; ///< Frames are closed before a record that starts this many base pairs past the frame's first position. Zero disables the span limit.
+        std::uint16_t minor_version; ///< Minor version to write. The default, auto_minor_version, writes the oldest version that holds the requested features (1.0 if none are requested). Explicit versions opt in to newer ones (e.g., 1.1+ for skipping genotypes without decoding them), and features an explicit version can't store are dropped.
+        std::uint32_t sample_block_size; ///< Number of samples per independently decodable genotype block (SAV 1.2+). Zero disables sample blocks.
+        std::size_t compression_threads; ///< Number of background threads compressing blocks. Zero compresses on the calling thread.
+        std::size_t dictionary_training_records; ///< Number of leading records used to train a zstd dictionary that is stored in the header (SAV 1.3+). Zero disables training.
+        std::size_t dictionary_max_size; ///< Maximum size in bytes of a trained dictionary.
+        std::vector<char> dictionary; ///< Existing zstd dictionary to store and compress with (e.g., reader::dictionary() when copying frames). Ignored when training.
+        bool columnar_frames; ///< Store each block as a frame of site fields followed by a frame of genotype blocks (SAV 1.4+), so that site-only reads skip genotype decompression.
+        bool delta_sites; ///< Store CHROM only when it changes, POS as a delta from the previous record and SNV alleles in one byte (SAV 1.4+).
+        bool pbwt; ///< Store allele pairs in positional Burrows-Wheeler transform order (SAV 1.4+), which shrinks phased GT of reference panels. Disables sample blocks.
+        bool multiallelic; ///< Store multi-allelic sites as single records with a comma separated ALT and GT values that are allele indices (SAV 1.4+, GT only).
+        std::uint8_t dosage_bit_width; ///< Pair prefix width (1-7) that HDS values are quantized to (SAV 1.4+). Values are multiples of 1 / 2^width, and a width of 1 stores hard calls.
         std::string index_path;
         options() :
           compression_level(3),
-          block_size(2048)
+          block_size(2048),
+          block_max_bytes(0),
+          block_max_span(0),
+          minor_version(auto_minor_version),
+          sample_block_size(0),
+          compression_threads(0),
+          dictionary_training_records(0),
+          dictionary_max_size(112640),
+          columnar_frames(false),
+          delta_sites(false),
+          pbwt(false),
+          multiallelic(false),
+          dosage_bit_width(7)
         {
         }
       };
@@ -935,8 +2186,21 @@ namespace savvy
 
       template <typename RandAccessStringIterator, typename RandAccessKVPIterator>
       writer(const std::string& file_path, const options& opts, RandAccessStringIterator samples_beg, RandAccessStringIterator samples_end, RandAccessKVPIterator headers_beg, RandAccessKVPIterator headers_end, fmt data_format) :
+        writer(file_path, opts, samples_beg, samples_end, headers_beg, headers_end, std::vector<fmt>(1, data_format))
+      {
+      }
+
+      /**
+       * Stores a FORMAT field per data format (SAV 1.4+), e.g., {fmt::gt, fmt::hds}, so that
+       * hard calls and dosages are read from the same records. Formats other than fmt::hds are
+       * stored as GT. Records are then written with write(annotations, data, second_data).
+       * Versions before 1.4 store only the first format.
+       */
+      template <typename RandAccessStringIterator, typename RandAccessKVPIterator>
+      writer(const std::string& file_path, const options& opts, RandAccessStringIterator samples_beg, RandAccessStringIterator samples_end, RandAccessKVPIterator headers_beg, RandAccessKVPIterator headers_end, const std::vector<fmt>& data_formats) :
         rng_(std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ std::clock() ^ (std::uint64_t)this),
-        output_buf_(create_out_streambuf(file_path, opts.compression_level)), //opts.compression == compression_type::zstd ? std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path)) : std::unique_ptr<std::streambuf>(new std::filebuf(file_path, std::ios::binary))),
+        output_buf_(create_out_streambuf(file_path, opts.compression_level, opts.compression_threads)),
+        zstd_buf_(dynamic_cast<::savvy::detail::zstd_obuf*>(output_buf_.get())), //opts.compression == compression_type::zstd ? std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path)) : std::unique_ptr<std::streambuf>(new std::filebuf(file_path, std::ios::binary))),
         output_stream_(output_buf_.get()),
         samples_(samples_beg, samples_end),
         file_path_(file_path),
@@ -948,8 +2212,34 @@ namespace savvy
         record_count_(0),
         record_count_in_block_(0),
         block_size_(opts.block_size),
-        data_format_(data_format)
+        block_max_bytes_(opts.block_max_bytes),
+        block_max_span_(opts.block_max_span),
+        block_bytes_(0),
+        minor_version_(opts.minor_version == auto_minor_version ? required_minor_version(opts, data_formats) : std::min(opts.minor_version, latest_minor_version)),
+        sample_block_size_(minor_version_ >= 2 ? opts.sample_block_size : 0),
+        data_formats_(stored_formats(data_formats, minor_version_)),
+        dictionary_training_records_(minor_version_ >= 3 && zstd_buf_ ? opts.dictionary_training_records : 0),
+        dictionary_max_size_(opts.dictionary_max_size),
+        features_(minor_version_ < 4 ? 0 : (zstd_buf_ && opts.columnar_frames ? feature_columnar_frames : 0) | (opts.delta_sites ? feature_delta_sites : 0) | (opts.pbwt ? feature_pbwt : 0) | (data_formats_.size() > 1 ? feature_multiple_formats : 0) | (opts.multiallelic && data_formats_ == std::vector<fmt>(1, fmt::gt) ? feature_multiallelic : 0)),
+        dosage_bit_width_(minor_version_ < 4 ? 7 : opts.dosage_bit_width),
+        pbwt_(data_formats_.size(), ::savvy::detail::pbwt_order(true))
       {
+        if (features_ & feature_pbwt)
+          sample_block_size_ = 0; // The PBWT order spans all haplotypes.
+
+        if (dosage_bit_width_ < 1 || dosage_bit_width_ > 7)
+          output_stream_.setstate(std::ios::failbit);
+        else if (dosage_bit_width_ != 7 && std::count(data_formats_.begin(), data_formats_.end(), fmt::hds))
+          features_ |= feature_dosage_bit_width;
+
+        // Each FORMAT field (GT or HDS) can only be stored once. Checked against the requested formats, since earlier versions drop all but the first.
+        const std::vector<fmt> requested_formats = stored_formats(data_formats, latest_minor_version);
+        if (data_formats.empty() || requested_formats.size() > 2 || (requested_formats.size() == 2 && requested_formats[0] == requested_formats[1]))
+          output_stream_.setstate(std::ios::failbit);
+
+        if (minor_version_ >= 3 && zstd_buf_ && !dictionary_training_records_)
+          dictionary_ = opts.dictionary;
+
         headers_.resize(std::distance(headers_beg, headers_end));
         auto copy_res = std::copy_if(headers_beg, headers_end, headers_.begin(), [](const std::pair<std::string,std::string>& kvp) { return kvp.first != "FORMAT" && kvp.first != "fileformat"; });
         headers_.resize(std::distance(headers_.begin(), copy_res));
@@ -965,26 +2255,10 @@ namespace savvy
 
       ~writer()
       {
-        // TODO: This is only a temp solution.
-        if (index_file_)
-        {
-          if (record_count_in_block_)
-          {
-            auto file_pos = std::uint64_t(output_stream_.tellp());
-            if (record_count_in_block_ > 0x10000) // Max records per block: 64*1024
-            {
-              assert(!"Too many records in zstd frame to be indexed!");
-            }
-
-            if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
-            {
-              assert(!"File size to large to be indexed!");
-            }
-
-            s1r::entry e(current_block_min_, current_block_max_, (file_pos << 16) | std::uint16_t(record_count_in_block_ - 1));
-            index_file_->write(current_chromosome_, e);
-          }
-        }
+        if (dictionary_training_records_ && !dictionary_sample_sizes_.empty())
+          end_dictionary_training();
+        end_block();
+        output_stream_.flush();
       }
 
       void write_header(std::int32_t ploidy)
@@ -994,6 +2268,8 @@ namespace savvy
           ploidy_ = ploidy;
 
           std::string version_string("sav\x00\x01\x00\x00", 7);
+          version_string[5] = char(minor_version_ >> 8);
+          version_string[6] = char(minor_version_ & 0xFF);
           output_stream_.write(version_string.data(), version_string.size());
 
           output_stream_.write((char*)uuid_.data(), uuid_.size());
@@ -1002,12 +2278,17 @@ namespace savvy
 
 
           // TODO: Handle unsupported formats.
-          std::string fmt_str;
-          if (data_format_ == fmt::hds)
-            fmt_str = "<ID=HDS,Type=Float,Number=" + std::to_string(ploidy_) + ",Description=\"Haplotype dosages\">";
-          else
-            fmt_str = "<ID=GT,Type=Integer,Number=" + std::to_string(ploidy_) + ",Description=\"Genotype\">";
-          headers_.push_back(std::make_pair(std::string("FORMAT"), fmt_str));
+          for (auto it = data_formats_.begin(); it != data_formats_.end(); ++it)
+          {
+            std::string fmt_str;
+            if (*it == fmt::hds && (features_ & feature_dosage_bit_width))
+              fmt_str = "<ID=HDS,Type=Float,Number=" + std::to_string(ploidy_) + ",BitWidth=" + std::to_string(dosage_bit_width_) + ",Description=\"Haplotype dosages\">";
+            else if (*it == fmt::hds)
+              fmt_str = "<ID=HDS,Type=Float,Number=" + std::to_string(ploidy_) + ",Description=\"Haplotype dosages\">";
+            else
+              fmt_str = "<ID=GT,Type=Integer,Number=" + std::to_string(ploidy_) + ",Description=\"Genotype\">";
+            headers_.push_back(std::make_pair(std::string("FORMAT"), fmt_str));
+          }
 
           std::unordered_set<std::string> unique_info_fields;
 
@@ -1042,6 +2323,13 @@ namespace savvy
             if (str_sz)
               output_stream_.write(&(*it)[0], str_sz);
           }
+
+          if (minor_version_ >= 4)
+            varint_encode(features_, out_it);
+
+          // A dictionary that is still being trained is written once training ends.
+          if (minor_version_ >= 3 && !dictionary_training_records_)
+            write_dictionary();
         }
       }
 
@@ -1115,6 +2403,40 @@ namespace savvy
 #else
       template <typename VecT>
       void write(const site_info& annotations, const VecT& data)
+      {
+        if (data_formats_.size() > 1)
+          output_stream_.setstate(std::ios::failbit); // Every stored FORMAT field needs data.
+        else
+          write_impl(annotations, data, static_cast<const VecT*>(nullptr));
+      }
+
+      /**
+       * Writes a record of a writer that stores two FORMAT fields, with data and second_data in
+       * the order of the data formats given to the constructor. second_data is dropped if only one
+       * field is stored (i.e., before SAV 1.4).
+       */
+      template <typename VecT, typename VecU>
+      void write(const site_info& annotations, const VecT& data, const VecU& second_data)
+      {
+        if (data_formats_.size() > 1 && second_data.size() != data.size())
+          output_stream_.setstate(std::ios::failbit);
+        else
+          write_impl(annotations, data, data_formats_.size() > 1 ? &second_data : nullptr);
+      }
+#endif
+      explicit operator bool() const { return good(); }
+      bool good() const { return output_stream_.good() && (!index_file_ || index_file_->good()); }
+      bool fail() const { return output_stream_.fail(); }
+      bool bad() const { return output_stream_.bad(); }
+      bool eof() const { return output_stream_.eof(); }
+
+      static bool create_index(const std::string& input_file_path, std::string output_file_path = "");
+    protected:
+      /**
+       * Serializes a record with a genotype block for data and, if not null, one for second_data.
+       */
+      template <typename VecT, typename VecU>
+      void write_impl(const site_info& annotations, const VecT& data, const VecU* second_data)
       {
         if (this->good())
         {
@@ -1135,91 +2457,144 @@ namespace savvy
             }
             else
             {
-              // 1024*1024 non-ref GTs or 64*1024 records
-              //if (allele_count_ >= 0x100000 || (record_count_ % 0x10000) == 0 || annotations.chromosome() != current_chromosome_)
-              if (block_size_ != 0 && ((record_count_ % block_size_) == 0 || annotations.chromosome() != current_chromosome_))
-              {
-                if (index_file_ && record_count_in_block_)
-                {
-                  auto file_pos = std::uint64_t(output_stream_.tellp());
-                  if (record_count_in_block_ > 0x10000) // Max records per block: 64*1024
-                  {
-                    assert(!"Too many records in zstd frame to be indexed!");
-                    output_stream_.setstate(std::ios::badbit);
-                  }
+              // The whole record is encoded into record_buffer_ and handed to the stream with a single write.
+              record_buffer_.clear();
+              std::back_insert_iterator<std::vector<char>> rec_it(record_buffer_);
 
-                  if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
-                  {
-                    assert(!"File size to large to be indexed!");
-                    output_stream_.setstate(std::ios::badbit);
-                  }
+              // Held back dictionary training records are coded as block starts since their blocks aren't known yet.
+              const bool block_start = dictionary_training_records_ || starts_new_block(annotations);
 
-                  s1r::entry e(current_block_min_, current_block_max_, (file_pos << 16) | std::uint16_t(record_count_in_block_ - 1));
-                  index_file_->write(current_chromosome_, e);
-                }
-                output_stream_.flush();
-                allele_count_ = 0;
-                current_chromosome_ = annotations.chromosome();
-                record_count_in_block_ = 0;
-                current_block_min_ = std::numeric_limits<std::uint32_t>::max();
-                current_block_max_ = 0;
+              if (features_ & feature_delta_sites)
+              {
+                serialize_delta_site(annotations, block_start);
               }
+              else
+              {
+                varint_encode(annotations.chromosome().size(), rec_it);
+                record_buffer_.insert(record_buffer_.end(), annotations.chromosome().begin(), annotations.chromosome().end());
 
-              std::ostreambuf_iterator<char> os_it(output_stream_.rdbuf());
-
-              varint_encode(annotations.chromosome().size(), os_it);
-              std::copy(annotations.chromosome().begin(), annotations.chromosome().end(), os_it);
-
-              varint_encode(annotations.position(), os_it);
+                varint_encode(annotations.position(), rec_it);
 
-              varint_encode(annotations.ref().size(), os_it);
-              if (annotations.ref().size())
-                std::copy(annotations.ref().begin(), annotations.ref().end(), os_it);
-              //os.write(&source.ref_[0], source.ref_.size());
+                varint_encode(annotations.ref().size(), rec_it);
+                record_buffer_.insert(record_buffer_.end(), annotations.ref().begin(), annotations.ref().end());
 
-              varint_encode(annotations.alt().size(), os_it);
-              if (annotations.alt().size())
-                std::copy(annotations.alt().begin(), annotations.alt().end(), os_it);
-              //os.write(&source.alt_[0], source.alt_.size());
+                varint_encode(annotations.alt().size(), rec_it);
+                record_buffer_.insert(record_buffer_.end(), annotations.alt().begin(), annotations.alt().end());
+              }
 
               for (const std::string& key : property_fields_)
               {
-                std::string value(annotations.prop(key));
-                varint_encode(value.size(), os_it);
-                if (value.size())
-                  std::copy(value.begin(), value.end(), os_it);
+                const std::string& value = annotations.prop(key);
+                varint_encode(value.size(), rec_it);
+                record_buffer_.insert(record_buffer_.end(), value.begin(), value.end());
               }
 
-              if (data_format_ == fmt::hds)
+              std::uint8_t gt_prefix_width = 1;
+              if (features_ & feature_multiallelic)
               {
-                write_hap_dosages(data);
+                const std::size_t alt_count = detail::alt_allele_count(annotations.alt());
+                if (alt_count > 127)
+                {
+                  output_stream_.setstate(std::ios::failbit); // Allele indices don't fit in a 7-bit prefix.
+                  return;
+                }
+                gt_prefix_width = detail::allele_index_bit_width(alt_count);
+              }
+
+              const std::size_t site_size = record_buffer_.size();
+              write_genotype_field(0, data, block_start, gt_prefix_width);
+              if (second_data)
+                write_genotype_field(1, *second_data, block_start, 1);
+
+              if (dictionary_training_records_)
+              {
+                // Records are held back until the dictionary, which precedes them in the file, is trained.
+                dictionary_samples_.insert(dictionary_samples_.end(), record_buffer_.begin(), record_buffer_.end());
+                dictionary_sample_sizes_.push_back(record_buffer_.size());
+                dictionary_sample_site_sizes_.push_back(site_size);
+                dictionary_sample_sites_.emplace_back(std::string(annotations.chromosome()), annotations.position(), std::string(annotations.ref()), std::string(annotations.alt()), std::unordered_map<std::string, std::string>());
+                if (dictionary_sample_sizes_.size() == dictionary_training_records_)
+                  end_dictionary_training();
               }
-//            else if (data_format_ == fmt::genotype_probability)
-//            {
-//              write_probs(data);
-//            }
               else
               {
-                write_alleles(data);
+                write_record(annotations, record_buffer_.data(), site_size, record_buffer_.size());
               }
-
-              current_block_min_ = std::min(current_block_min_, std::uint32_t(annotations.position()));
-              current_block_max_ = std::max(current_block_max_, std::uint32_t(annotations.position() + std::max(annotations.ref().size(), annotations.alt().size())) - 1);
-              ++record_count_in_block_;
-              ++record_count_;
             }
           }
         }
       }
-#endif
-      explicit operator bool() const { return good(); }
-      bool good() const { return output_stream_.good() && (!index_file_ || index_file_->good()); }
-      bool fail() const { return output_stream_.fail(); }
-      bool bad() const { return output_stream_.bad(); }
-      bool eof() const { return output_stream_.eof(); }
 
-      static bool create_index(const std::string& input_file_path, std::string output_file_path = "");
-    protected:
+      /**
+       * Appends the genotype block of a stored FORMAT field to record_buffer_.
+       * @param gt_prefix_width Prefix width of GT allele pairs, which is wider than 1 for the
+       * allele indices of multi-allelic records.
+       */
+      template <typename VecT>
+      void write_genotype_field(std::size_t field, const VecT& data, bool block_start, std::uint8_t gt_prefix_width)
+      {
+        if (data_formats_[field] == fmt::hds)
+        {
+          switch (dosage_bit_width_)
+          {
+            case 1: write_allele_pair_array<1, detail::hard_call_encoder>(data, pbwt_[field], block_start); break;
+            case 2: write_allele_pair_array<2>(data, pbwt_[field], block_start); break;
+            case 3: write_allele_pair_array<3>(data, pbwt_[field], block_start); break;
+            case 4: write_allele_pair_array<4>(data, pbwt_[field], block_start); break;
+            case 5: write_allele_pair_array<5>(data, pbwt_[field], block_start); break;
+            case 6: write_allele_pair_array<6>(data, pbwt_[field], block_start); break;
+            default: write_allele_pair_array<7>(data, pbwt_[field], block_start);
+          }
+        }
+//        else if (data_formats_[field] == fmt::genotype_probability)
+//          write_probs(data);
+        else
+        {
+          switch (gt_prefix_width)
+          {
+            case 2: write_allele_pair_array<2, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            case 3: write_allele_pair_array<3, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            case 4: write_allele_pair_array<4, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            case 5: write_allele_pair_array<5, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            case 6: write_allele_pair_array<6, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            case 7: write_allele_pair_array<7, detail::allele_index_encoder>(data, pbwt_[field], block_start); break;
+            default: write_allele_pair_array<1>(data, pbwt_[field], block_start);
+          }
+        }
+      }
+
+      /**
+       * @return The oldest minor version that stores every feature requested by opts and data_formats.
+       */
+      static std::uint16_t required_minor_version(const options& opts, const std::vector<fmt>& data_formats)
+      {
+        const bool zstd = opts.compression_level > 0;
+        const std::vector<fmt> stored = stored_formats(data_formats, latest_minor_version);
+        const bool stores_hds = std::count(stored.begin(), stored.end(), fmt::hds) > 0;
+        if ((zstd && opts.columnar_frames) || opts.delta_sites || opts.pbwt || stored.size() > 1
+          || (opts.multiallelic && stored == std::vector<fmt>(1, fmt::gt))
+          || (opts.dosage_bit_width != 7 && (stores_hds || opts.dosage_bit_width < 1 || opts.dosage_bit_width > 7)))
+          return 4;
+        if (zstd && (opts.dictionary_training_records || !opts.dictionary.empty()))
+          return 3;
+        if (opts.sample_block_size)
+          return 2;
+        return 0;
+      }
+
+      /**
+       * @return The FORMAT fields to store for the requested data formats.
+       */
+      static std::vector<fmt> stored_formats(const std::vector<fmt>& data_formats, std::uint16_t minor_version)
+      {
+        std::vector<fmt> ret;
+        for (auto it = data_formats.begin(); it != data_formats.end() && (ret.empty() || minor_version >= 4); ++it)
+          ret.push_back(*it == fmt::hds ? fmt::hds : fmt::gt);
+        if (ret.empty())
+          ret.push_back(fmt::gt);
+        return ret;
+      }
+
       template <typename T>
       static std::size_t get_string_size(T str);
 
@@ -1230,105 +2605,435 @@ namespace savvy
         return ret;
       }
 
-      static std::unique_ptr<std::streambuf> create_out_streambuf(const std::string& file_path, std::int8_t compression_level);
+      static std::unique_ptr<std::streambuf> create_out_streambuf(const std::string& file_path, std::int8_t compression_level, std::size_t compression_threads);
+
+      /**
+       * Writes a serialized record, starting a new frame first if needed.
+       * @param site_size Size of the site fields at the beginning of data, which are followed by the genotype block.
+       */
+      void write_record(const site_info& annotations, const char* data, std::size_t site_size, std::size_t size)
+      {
+        if (record_count_ == 0 && (!dictionary_.empty() || features_ & feature_columnar_frames))
+        {
+          // The header frame holds the dictionary and columnar readers expect the first site frame to follow it.
+          end_block();
+          if (!dictionary_.empty() && !zstd_buf_->set_dictionary(dictionary_.data(), dictionary_.size()))
+            output_stream_.setstate(std::ios::badbit);
+        }
+
+        if (starts_new_block(annotations))
+        {
+          end_block();
+          allele_count_ = 0;
+          current_chromosome_ = annotations.chromosome();
+          record_count_in_block_ = 0;
+          block_bytes_ = 0;
+          current_block_min_ = std::numeric_limits<std::uint32_t>::max();
+          current_block_max_ = 0;
+        }
+
+        if (features_ & feature_columnar_frames)
+        {
+          output_stream_.write(data, site_size);
+          genotype_frame_.insert(genotype_frame_.end(), data + site_size, data + size);
+        }
+        else
+        {
+          output_stream_.write(data, size);
+        }
+        block_bytes_ += size;
+
+        current_block_min_ = std::min(current_block_min_, std::uint32_t(annotations.position()));
+        current_block_max_ = std::max(current_block_max_, std::uint32_t(annotations.position() + std::max(annotations.ref().size(), annotations.alt().size())) - 1);
+        ++record_count_in_block_;
+        ++record_count_;
+      }
+
+      /**
+       * Appends SITE_HDR, CHROM, POS, REF and ALT of a delta coded site to record_buffer_.
+       * Records that may start a block carry CHROM and an absolute POS so that readers can
+       * start decoding at any block.
+       */
+      void serialize_delta_site(const site_info& annotations, bool block_start)
+      {
+        std::back_insert_iterator<std::vector<char>> rec_it(record_buffer_);
+        const int ref_code = detail::snv_code(annotations.ref());
+        const int alt_code = detail::snv_code(annotations.alt());
+
+        std::uint8_t flags = 0;
+        if (ref_code >= 0 && alt_code >= 0)
+          flags |= detail::site_header_snv;
+
+        if (block_start || annotations.chromosome() != prev_site_chromosome_)
+        {
+          flags |= detail::site_header_chromosome;
+          two_bit_prefixed_varint::encode(flags, annotations.position(), rec_it);
+          varint_encode(annotations.chromosome().size(), rec_it);
+          record_buffer_.insert(record_buffer_.end(), annotations.chromosome().begin(), annotations.chromosome().end());
+          prev_site_chromosome_ = annotations.chromosome();
+        }
+        else
+        {
+          two_bit_prefixed_varint::encode(flags, zigzag_encode(std::int64_t(annotations.position() - prev_site_position_)), rec_it);
+        }
+        prev_site_position_ = annotations.position();
+
+        if (flags & detail::site_header_snv)
+        {
+          record_buffer_.push_back(char((ref_code << 2) | alt_code));
+        }
+        else
+        {
+          varint_encode(annotations.ref().size(), rec_it);
+          record_buffer_.insert(record_buffer_.end(), annotations.ref().begin(), annotations.ref().end());
+
+          varint_encode(annotations.alt().size(), rec_it);
+          record_buffer_.insert(record_buffer_.end(), annotations.alt().begin(), annotations.alt().end());
+        }
+      }
+
+      /**
+       * Appends the DICT_SZ and DICT fields of a 1.3+ header.
+       */
+      void write_dictionary()
+      {
+        std::ostreambuf_iterator<char> out_it(output_stream_);
+        varint_encode(dictionary_.size(), out_it);
+        if (dictionary_.size())
+          output_stream_.write(dictionary_.data(), dictionary_.size());
+      }
+
+      /**
+       * Trains the dictionary from the held back records, writes it to the header and then writes the records.
+       */
+      void end_dictionary_training();
+
+      /**
+       * A frame is closed before a record when the chromosome changes or when the frame has
+       * reached its record count, uncompressed byte budget or genomic span, whichever comes first.
+       * The first record always starts a new frame so that the header is compressed on its own.
+       */
+      bool starts_new_block(const site_info& annotations) const
+      {
+        if (block_size_ == 0)
+          return false;
+
+        if (record_count_ == 0 || annotations.chromosome() != current_chromosome_)
+          return true;
+
+        if (record_count_in_block_ >= block_size_)
+          return true;
+
+        if (block_max_bytes_ && block_bytes_ >= block_max_bytes_)
+          return true;
+
+        if (block_max_span_ && annotations.position() >= std::uint64_t(current_block_min_) + block_max_span_)
+          return true;
+
+        return false;
+      }
+
+      /**
+       * Ends the zstd frame holding the current block and adds its s1r entry. With compression
+       * threads, the entry is added once the frame has been written and its offset is known.
+       * With columnar frames, the entry points to the site frame, which is followed by the
+       * block's genotype frame.
+       */
+      void end_block()
+      {
+        if (index_file_ && record_count_in_block_)
+        {
+          if (record_count_in_block_ > 0x10000) // Max records per block: 64*1024
+          {
+            assert(!"Too many records in zstd frame to be indexed!");
+            output_stream_.setstate(std::ios::badbit);
+          }
+
+          const std::string chrom = current_chromosome_;
+          const std::uint32_t block_min = current_block_min_;
+          const std::uint32_t block_max = current_block_max_;
+          const std::uint16_t block_record_count = std::uint16_t(record_count_in_block_ - 1);
+          auto add_entry = [this, chrom, block_min, block_max, block_record_count](std::uint64_t file_pos)
+          {
+            if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
+            {
+              assert(!"File size to large to be indexed!");
+              output_stream_.setstate(std::ios::badbit);
+            }
+
+            s1r::entry e(block_min, block_max, (file_pos << 16) | block_record_count);
+            index_file_->write(chrom, e);
+          };
+
+          if (zstd_buf_)
+          {
+            if (!zstd_buf_->end_frame(add_entry))
+              output_stream_.setstate(std::ios::badbit);
+          }
+          else
+          {
+            add_entry(std::uint64_t(output_stream_.tellp()));
+            output_stream_.flush();
+          }
+        }
+        else if (zstd_buf_)
+        {
+          if (!zstd_buf_->end_frame())
+            output_stream_.setstate(std::ios::badbit);
+        }
+        else
+        {
+          output_stream_.flush();
+        }
+
+        if (features_ & feature_columnar_frames)
+        {
+          output_stream_.write(genotype_frame_.data(), genotype_frame_.size());
+          genotype_frame_.clear();
+          if (!zstd_buf_->end_frame())
+            output_stream_.setstate(std::ios::badbit);
+        }
+      }
 
-      template <std::size_t BitWidth, typename T, typename OutIt>
-      static void serialize_alleles(const std::vector<T>& m, OutIt os_it)
+      template <std::size_t BitWidth, typename Encoder, typename T, typename OutIt>
+      static std::uint64_t serialize_alleles(const std::vector<T>& m, OutIt os_it)
       {
+        std::uint64_t pair_count = 0;
         std::uint64_t last_pos = 0;
         const auto beg = m.begin();
         for (auto it = beg; it != m.end(); ++it)
         {
-          std::int8_t signed_allele = detail::allele_encoder<BitWidth>::encode(*it);
+          std::int8_t signed_allele = Encoder::encode(*it);
           if (signed_allele >= 0)
           {
             std::uint64_t dist = static_cast<std::uint64_t>(std::distance(beg, it));
             std::uint64_t offset = dist - last_pos;
             last_pos = dist + 1;
             prefixed_varint<BitWidth>::encode((std::uint8_t)(signed_allele), offset, os_it);
+            ++pair_count;
           }
         }
 
+        return pair_count;
       }
 
-      template <std::size_t BitWidth, typename T, typename OutIt>
-      static void serialize_alleles(const savvy::compressed_vector<T>& m, OutIt os_it)
+      template <std::size_t BitWidth, typename Encoder, typename T, typename IndexT, typename OutIt>
+      static std::uint64_t serialize_alleles(const savvy::compressed_vector<T, IndexT>& m, OutIt os_it)
       {
+        std::uint64_t pair_count = 0;
         std::uint64_t last_pos = 0;
         auto end = m.end();
         for (auto it = m.begin(); it != end; ++it)
         {
-          std::int8_t signed_allele = detail::allele_encoder<BitWidth>::encode(*it);
+          std::int8_t signed_allele = Encoder::encode(*it);
           if (signed_allele >= 0)
           {
             std::uint64_t dist = it.offset();
             std::uint64_t offset = dist - last_pos;
             last_pos = dist + 1;
             prefixed_varint<BitWidth>::encode((std::uint8_t)(signed_allele), offset, os_it);
+            ++pair_count;
           }
         }
 
+        return pair_count;
       }
 
-      template <typename T>
-      void write_alleles(const std::vector<T>& m)
+      template <typename Encoder, typename T>
+      void collect_pbwt_pairs(const std::vector<T>& m, const ::savvy::detail::pbwt_order& order)
       {
-        const T ref_value = T();
+        for (std::size_t i = 0; i < m.size(); ++i)
+        {
+          std::int8_t signed_allele = Encoder::encode(m[i]);
+          if (signed_allele >= 0)
+            pbwt_pairs_.push_back((order.position(i) << 8) | std::uint8_t(signed_allele));
+        }
+      }
 
-        std::ostreambuf_iterator<char> os_it(output_stream_.rdbuf());
+      template <typename Encoder, typename T, typename IndexT>
+      void collect_pbwt_pairs(const savvy::compressed_vector<T, IndexT>& m, const ::savvy::detail::pbwt_order& order)
+      {
+        auto end = m.end();
+        for (auto it = m.begin(); it != end; ++it)
+        {
+          std::int8_t signed_allele = Encoder::encode(*it);
+          if (signed_allele >= 0)
+            pbwt_pairs_.push_back((order.position(it.offset()) << 8) | std::uint8_t(signed_allele));
+        }
+      }
 
-        std::uint64_t non_zero_count =  m.size() - static_cast<std::size_t>(std::count(m.begin(), m.end(), ref_value));
-        allele_count_ += non_zero_count;
-        varint_encode(non_zero_count, os_it);
+      /**
+       * Like serialize_alleles(), but with haplotypes in PBWT order, which is then advanced past m.
+       * @param reset Restart from sample order. Set to true if the order had to be restarted anyway.
+       */
+      template <std::size_t BitWidth, typename Encoder, typename VecT, typename OutIt>
+      std::uint64_t serialize_pbwt_alleles(const VecT& m, ::savvy::detail::pbwt_order& order, bool& reset, OutIt os_it)
+      {
+        if (reset || order.size() != m.size())
+        {
+          order.reset(m.size());
+          reset = true;
+        }
+
+        pbwt_pairs_.clear();
+        collect_pbwt_pairs<Encoder>(m, order);
+        std::sort(pbwt_pairs_.begin(), pbwt_pairs_.end());
+
+        pbwt_positions_.resize(pbwt_pairs_.size());
+        std::uint64_t last_pos = 0;
+        for (std::size_t i = 0; i < pbwt_pairs_.size(); ++i)
+        {
+          const std::uint64_t pos = pbwt_pairs_[i] >> 8;
+          prefixed_varint<BitWidth>::encode(std::uint8_t(pbwt_pairs_[i] & 0xFF), pos - last_pos, os_it);
+          last_pos = pos + 1;
+          pbwt_positions_[i] = pos;
+        }
 
-        serialize_alleles<1>(m, os_it);
+        order.update(pbwt_positions_.data(), pbwt_positions_.size());
+        return pbwt_pairs_.size();
       }
 
-      template <typename T>
-      void write_alleles(const savvy::compressed_vector<T>& m)
+      /**
+       * Appends a sample block (APA_SZ followed by pairs relative to the block start) to
+       * sample_block_buffer_ from the pairs staged in sample_pair_buffer_.
+       */
+      void end_sample_block(std::uint64_t pair_count)
       {
-        std::ostreambuf_iterator<char> os_it(output_stream_.rdbuf());
+        const std::size_t beg = sample_block_buffer_.size();
+        std::back_insert_iterator<std::vector<char>> out_it(sample_block_buffer_);
+        varint_encode(pair_count, out_it);
+        sample_block_buffer_.insert(sample_block_buffer_.end(), sample_pair_buffer_.begin(), sample_pair_buffer_.end());
+        sample_block_sizes_.push_back(sample_block_buffer_.size() - beg);
+        sample_pair_buffer_.clear();
+      }
 
-        allele_count_ += m.non_zero_size();
-        varint_encode(m.non_zero_size(), os_it);
+      template <std::size_t BitWidth, typename Encoder, typename T>
+      std::uint64_t serialize_allele_blocks(const std::vector<T>& m, std::uint64_t block_haps)
+      {
+        sample_block_buffer_.clear();
+        sample_block_sizes_.clear();
+        sample_pair_buffer_.clear();
+        std::back_insert_iterator<std::vector<char>> pair_it(sample_pair_buffer_);
+        std::uint64_t total_pair_count = 0;
+        for (std::uint64_t block_beg = 0; block_beg < m.size(); block_beg += block_haps)
+        {
+          const std::uint64_t block_end = std::min(block_beg + block_haps, std::uint64_t(m.size()));
+          std::uint64_t pair_count = 0;
+          std::uint64_t last_pos = block_beg;
+          for (std::uint64_t i = block_beg; i < block_end; ++i)
+          {
+            std::int8_t signed_allele = Encoder::encode(m[i]);
+            if (signed_allele >= 0)
+            {
+              prefixed_varint<BitWidth>::encode((std::uint8_t)(signed_allele), i - last_pos, pair_it);
+              last_pos = i + 1;
+              ++pair_count;
+            }
+          }
+          total_pair_count += pair_count;
+          end_sample_block(pair_count);
+        }
 
-        serialize_alleles<1>(m, os_it);
+        return total_pair_count;
       }
 
-      template <typename T>
-      void write_hap_dosages(const std::vector<T>& m)
+      template <std::size_t BitWidth, typename Encoder, typename T, typename IndexT>
+      std::uint64_t serialize_allele_blocks(const savvy::compressed_vector<T, IndexT>& m, std::uint64_t block_haps)
       {
-        std::ostreambuf_iterator<char> os_it(output_stream_.rdbuf());
-
-        std::uint64_t non_zero_count = 0;
-        for (auto it = m.begin(); it != m.end(); ++it)
+        sample_block_buffer_.clear();
+        sample_block_sizes_.clear();
+        sample_pair_buffer_.clear();
+        std::back_insert_iterator<std::vector<char>> pair_it(sample_pair_buffer_);
+        std::uint64_t total_pair_count = 0;
+        std::uint64_t block_beg = 0;
+        std::uint64_t pair_count = 0;
+        std::uint64_t last_pos = 0;
+        auto end = m.end();
+        for (auto it = m.begin(); it != end; ++it)
         {
-          if (detail::allele_encoder<7>::encode(*it) >= 0)
-            ++non_zero_count;
+          std::int8_t signed_allele = Encoder::encode(*it);
+          if (signed_allele >= 0)
+          {
+            std::uint64_t dist = it.offset();
+            for ( ; dist >= block_beg + block_haps; block_beg += block_haps)
+            {
+              end_sample_block(pair_count);
+              pair_count = 0;
+              last_pos = block_beg + block_haps;
+            }
+            prefixed_varint<BitWidth>::encode((std::uint8_t)(signed_allele), dist - last_pos, pair_it);
+            last_pos = dist + 1;
+            ++pair_count;
+            ++total_pair_count;
+          }
         }
 
-        allele_count_ += non_zero_count;
-        varint_encode(non_zero_count, os_it);
+        for ( ; block_beg < m.size(); block_beg += block_haps)
+        {
+          end_sample_block(pair_count);
+          pair_count = 0;
+        }
 
-        serialize_alleles<7>(m, os_it);
+        return total_pair_count;
       }
 
-      template <typename T>
-      void write_hap_dosages(const savvy::compressed_vector<T>& m)
+      /**
+       * Appends the genotype section of a record to record_buffer_ in a single pass over m.
+       * Pairs are staged in sample_pair_buffer_ (or sample_block_buffer_) while they are
+       * counted, so APA_SZ and GT_SZ are known before they're written.
+       * @param order PBWT order of the FORMAT field.
+       * @param block_start Whether the record may start a block, which restarts the PBWT order.
+       */
+      template <std::size_t BitWidth, typename Encoder = detail::allele_encoder<BitWidth>, typename VecT>
+      void write_allele_pair_array(const VecT& m, ::savvy::detail::pbwt_order& order, bool block_start)
       {
-        std::ostreambuf_iterator<char> os_it(output_stream_.rdbuf());
+        std::back_insert_iterator<std::vector<char>> rec_it(record_buffer_);
+
+        std::uint64_t block_haps = 0;
+        if (minor_version_ >= 2)
+          block_haps = std::uint64_t(sample_block_size_) * ploidy_;
 
-        std::uint64_t non_zero_count = 0;
-        for (auto it = m.begin(); it != m.end(); ++it)
+        if (block_haps)
         {
-          if (detail::allele_encoder<7>::encode(*it) >= 0)
-            ++non_zero_count;
-        }
+          allele_count_ += serialize_allele_blocks<BitWidth, Encoder>(m, block_haps);
+
+          std::uint64_t genotype_size = varint_encoded_byte_width(block_haps) + sample_block_buffer_.size();
+          for (auto it = sample_block_sizes_.begin(); it != sample_block_sizes_.end(); ++it)
+            genotype_size += varint_encoded_byte_width(*it);
 
-        allele_count_ += non_zero_count;
-        varint_encode(non_zero_count, os_it);
+          varint_encode(genotype_size, rec_it);
+          varint_encode(block_haps, rec_it);
+          for (auto it = sample_block_sizes_.begin(); it != sample_block_sizes_.end(); ++it)
+            varint_encode(*it, rec_it);
+          record_buffer_.insert(record_buffer_.end(), sample_block_buffer_.begin(), sample_block_buffer_.end());
+        }
+        else
+        {
+          sample_pair_buffer_.clear();
+          std::back_insert_iterator<std::vector<char>> pair_it(sample_pair_buffer_);
+          bool pbwt_reset = block_start;
+          const std::uint64_t non_zero_count = features_ & feature_pbwt
+            ? serialize_pbwt_alleles<BitWidth, Encoder>(m, order, pbwt_reset, pair_it)
+            : serialize_alleles<BitWidth, Encoder>(m, pair_it);
+          allele_count_ += non_zero_count;
+
+          if (minor_version_ >= 1)
+          {
+            std::uint64_t genotype_size = varint_encoded_byte_width(non_zero_count) + sample_pair_buffer_.size();
+            if (features_ & feature_pbwt)
+              genotype_size += 1;
+            if (minor_version_ >= 2)
+              genotype_size += varint_encoded_byte_width(block_haps);
+            varint_encode(genotype_size, rec_it);
+            if (features_ & feature_pbwt)
+              record_buffer_.push_back(char(pbwt_reset ? 1 : 0));
+            if (minor_version_ >= 2)
+              varint_encode(block_haps, rec_it);
+          }
 
-        serialize_alleles<7>(m, os_it);
+          varint_encode(non_zero_count, rec_it);
+          record_buffer_.insert(record_buffer_.end(), sample_pair_buffer_.begin(), sample_pair_buffer_.end());
+        }
       }
 
 //      template <typename T>
@@ -1383,6 +3088,7 @@ namespace savvy
     protected:
       std::mt19937_64 rng_;
       std::unique_ptr<std::streambuf> output_buf_;
+      ::savvy::detail::zstd_obuf* zstd_buf_;
       std::ostream output_stream_;
       std::vector<std::pair<std::string, std::string>> headers_;
       std::vector<std::string> property_fields_;
@@ -1398,14 +3104,38 @@ namespace savvy
       std::size_t record_count_;
       std::size_t record_count_in_block_;
       std::uint16_t block_size_;
-      fmt data_format_;
+      std::uint64_t block_max_bytes_;
+      std::uint32_t block_max_span_;
+      std::uint64_t block_bytes_;
+      std::uint16_t minor_version_;
+      std::uint32_t sample_block_size_;
+      std::vector<fmt> data_formats_;
+      std::vector<char> dictionary_;
+      std::size_t dictionary_training_records_;
+      std::size_t dictionary_max_size_;
+      std::vector<char> dictionary_samples_;
+      std::vector<std::size_t> dictionary_sample_sizes_;
+      std::vector<std::size_t> dictionary_sample_site_sizes_;
+      std::vector<site_info> dictionary_sample_sites_;
+      std::uint64_t features_;
+      std::uint8_t dosage_bit_width_;
+      std::vector<char> genotype_frame_;
+      std::string prev_site_chromosome_;
+      std::uint64_t prev_site_position_ = 0;
+      std::vector<::savvy::detail::pbwt_order> pbwt_; // One order per FORMAT field.
+      std::vector<std::uint64_t> pbwt_pairs_; // PBWT position << 8 | allele prefix.
+      std::vector<std::uint64_t> pbwt_positions_;
       std::int32_t ploidy_ = 0;
+      std::vector<char> record_buffer_;
+      std::vector<char> sample_block_buffer_;
+      std::vector<char> sample_pair_buffer_;
+      std::vector<std::uint64_t> sample_block_sizes_;
     };
 
 
     template <>
-    template <typename T>
-    inline std::tuple<T, std::uint64_t> detail::allele_decoder<0>::decode(std::istreambuf_iterator<char>& in_it, const std::istreambuf_iterator<char>& end_it, const T& missing_value)
+    template <typename T, typename InputIt>
+    inline std::tuple<T, std::uint64_t> detail::allele_decoder<0>::decode(InputIt& in_it, const InputIt& end_it, const T& missing_value)
     {
       std::tuple<T, std::uint64_t> ret{T(1), 0};
       in_it = varint_decode(in_it, end_it, std::get<1>(ret));
@@ -1413,8 +3143,8 @@ namespace savvy
     }
 
     template<>
-    template <typename T>
-    inline std::tuple<T, std::uint64_t> detail::allele_decoder<1>::decode(std::istreambuf_iterator<char>& in_it, const std::istreambuf_iterator<char>& end_it, const T& missing_value)
+    template <typename T, typename InputIt>
+    inline std::tuple<T, std::uint64_t> detail::allele_decoder<1>::decode(InputIt& in_it, const InputIt& end_it, const T& missing_value)
     {
       std::tuple<T, std::uint64_t> ret;
       std::uint8_t allele;
@@ -1424,8 +3154,8 @@ namespace savvy
     }
 
     template<std::uint8_t BitWidth>
-    template <typename T>
-    inline std::tuple<T, std::uint64_t> detail::allele_decoder<BitWidth>::decode(std::istreambuf_iterator<char>& in_it, const std::istreambuf_iterator<char>& end_it, const T& missing_value)
+    template <typename T, typename InputIt>
+    inline std::tuple<T, std::uint64_t> detail::allele_decoder<BitWidth>::decode(InputIt& in_it, const InputIt& end_it, const T& missing_value)
     {
       std::tuple<T, std::uint64_t> ret;
       std::uint8_t allele;
@@ -1434,6 +3164,27 @@ namespace savvy
       return ret;
     }
 
+    template<>
+    template <typename T>
+    inline T detail::allele_decoder<0>::decode_prefix(std::uint8_t, const T&)
+    {
+      return T(1);
+    }
+
+    template<>
+    template <typename T>
+    inline T detail::allele_decoder<1>::decode_prefix(std::uint8_t prefix, const T& missing_value)
+    {
+      return (prefix ? T(1) : missing_value);
+    }
+
+    template<std::uint8_t BitWidth>
+    template <typename T>
+    inline T detail::allele_decoder<BitWidth>::decode_prefix(std::uint8_t prefix, const T&)
+    {
+      return (static_cast<T>(prefix) + T(1)) / denom;
+    }
+
     template<>
     template <typename T>
     inline void detail::allele_encoder<0>::encode(const T& allele, std::uint64_t offset, std::ostreambuf_iterator<char>& os_it)
@@ -19,8 +19,14 @@
 
 namespace savvy
 {
+  namespace sav
+  {
+    class reader_base;
+  }
+
   class site_info
   {
+    friend class sav::reader_base; // Fills members in place to reuse their capacity.
   public:
 
     site_info()
@@ -43,6 +49,30 @@ namespace savvy
 
     }
 
+    // Property slots point into the nodes of properties_, so they are not copied.
+    site_info(const site_info& other) :
+      properties_(other.properties_),
+      chromosome_(other.chromosome_),
+      ref_(other.ref_),
+      alt_(other.alt_),
+      position_(other.position_)
+    {
+    }
+
+    site_info& operator=(const site_info& other)
+    {
+      if (&other != this)
+      {
+        property_slots_.clear();
+        properties_ = other.properties_;
+        chromosome_ = other.chromosome_;
+        ref_ = other.ref_;
+        alt_ = other.alt_;
+        position_ = other.position_;
+      }
+      return *this;
+    }
+
     virtual ~site_info() {}
 
     const std::string& chromosome() const { return chromosome_; }
@@ -64,6 +94,7 @@ namespace savvy
     }
   private:
     std::unordered_map<std::string, std::string> properties_;
+    std::vector<std::pair<const std::string, std::string>*> property_slots_; // Nodes of properties_ in the order of the reader's INFO fields.
     std::string chromosome_;
     std::string ref_;
     std::string alt_;
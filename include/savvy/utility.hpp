@@ -103,6 +103,41 @@ namespace savvy
         ret *= hap_probs[i];
       return ret;
     }
+
+    /**
+     * Writes the 2 genotype probabilities of a haploid sample to gp.
+     */
+    static void haploid(T hap_prob, T* gp)
+    {
+      gp[0] = T(1) - hap_prob;
+      gp[1] = hap_prob;
+    }
+
+    /**
+     * Writes the 3 genotype probabilities of a diploid sample to gp.
+     */
+    static void diploid(T hap_prob_a, T hap_prob_b, T* gp)
+    {
+      gp[0] = (T(1) - hap_prob_a) * (T(1) - hap_prob_b);
+      gp[1] = hap_prob_a * (T(1) - hap_prob_b) + hap_prob_b * (T(1) - hap_prob_a);
+      gp[2] = hap_prob_a * hap_prob_b;
+    }
+
+    /**
+     * Writes the ploidy + 1 genotype probabilities of a sample to gp by adding one haplotype at
+     * a time, which takes O(ploidy^2) operations instead of enumerating allele combinations.
+     */
+    static void polyploid(const T* hap_probs, std::size_t ploidy, T* gp)
+    {
+      gp[0] = T(1);
+      for (std::size_t h = 0; h < ploidy; ++h)
+      {
+        gp[h + 1] = gp[h] * hap_probs[h];
+        for (std::size_t k = h; k > 0; --k)
+          gp[k] = gp[k] * (T(1) - hap_probs[h]) + gp[k - 1] * hap_probs[h];
+        gp[0] *= T(1) - hap_probs[h];
+      }
+    }
   private:
     static void choose(const std::vector<T>& input, std::vector<T>& buf, T& output, std::size_t k, std::size_t offset)
     {
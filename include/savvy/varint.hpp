@@ -150,6 +150,21 @@ namespace savvy
     return input_it;
   }
   //----------------------------------------------------------------//
+
+  //----------------------------------------------------------------//
+  /**
+   * Maps signed integers to unsigned ones so that values close to zero have short VLIs.
+   */
+  inline std::uint64_t zigzag_encode(std::int64_t input)
+  {
+    return (std::uint64_t(input) << 1) ^ std::uint64_t(input >> 63);
+  }
+
+  inline std::int64_t zigzag_decode(std::uint64_t input)
+  {
+    return std::int64_t(input >> 1) ^ -std::int64_t(input & 1);
+  }
+  //----------------------------------------------------------------//
 }
 
 #endif //LIBSAVVY_VARINT_HPP
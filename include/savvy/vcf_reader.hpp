@@ -13,6 +13,7 @@
 #include "variant_iterator.hpp"
 #include "utility.hpp"
 #include "data_format.hpp"
+#include "packed_allele_vector.hpp"
 #include "savvy.hpp"
 
 #include <fstream>
@@ -46,6 +47,16 @@ namespace savvy
       skip,
       skip_with_warning
     };
+
+    /**
+     * How records with more than one ALT allele are read. With keep, ALT is comma separated
+     * and fmt::gt values are allele indices. Other formats can't be read from such records.
+     */
+    enum class multiallelic_policy : std::uint8_t
+    {
+      split = 0,
+      keep
+    };
     //################################################################//
 
     std::vector<std::string> query_chromosomes(const std::string& file_path);
@@ -77,7 +88,7 @@ namespace savvy
         virtual const char*const cur_fmt_field(std::size_t idx) const = 0;
         virtual std::size_t cur_num_alleles() const = 0;
         virtual bool read_next_record() = 0;
-        virtual site_info cur_site_info(std::size_t allele_index) const = 0;
+        virtual site_info cur_site_info(std::size_t allele_index) const = 0; ///< An allele_index of zero joins all ALT alleles with commas.
         virtual bool get_cur_format_values_int32(const char* tag, int**buf, int*sz) const = 0;
         virtual bool get_cur_format_values_float(const char* tag, int**buf, int*sz) const = 0;
       };
@@ -105,6 +116,7 @@ namespace savvy
         subset_size_(source.subset_size_),
         state_(source.state_),
         empty_vector_policy_(source.empty_vector_policy_),
+        multiallelic_policy_(source.multiallelic_policy_),
         gt_(source.gt_),
         gt_sz_(source.gt_sz_),
         allele_index_(source.allele_index_),
@@ -134,6 +146,7 @@ namespace savvy
       const std::vector<std::string>& info_fields() const;
       const std::vector<std::pair<std::string, std::string>>& headers() const { return headers_; }
       void set_policy(enum empty_vector_policy policy) { empty_vector_policy_ = policy; }
+      void set_multiallelic_policy(enum multiallelic_policy policy) { multiallelic_policy_ = policy; }
     protected:
       static const int bcf_gt_missing = 0;
       void init_sample_ids();
@@ -153,9 +166,12 @@ namespace savvy
       bool read_genos_to(fmt data_format, site_info& annotations, T1& vec);
       template <std::size_t Idx, typename T1, typename... T2>
       bool read_genos_to(fmt data_format, site_info& annotations, T1& vec, T2&... others);
+      template <std::size_t Idx>
+      bool read_genos_to(fmt data_format, site_info& annotations, packed_allele_vector& vec);
 
       template <typename T>
       void read_genotypes_al(site_info& annotations, T& destination);
+      void read_genotypes_al(site_info& annotations, packed_allele_vector& destination);
       template <typename T>
       void read_genotypes_gt(site_info& annotations, T& destination);
       template <typename T>
@@ -181,6 +197,7 @@ namespace savvy
       std::unique_ptr<detail::hts_file_base> hts_file_;
       std::uint64_t subset_size_;
       empty_vector_policy empty_vector_policy_ = empty_vector_policy::fail;
+      multiallelic_policy multiallelic_policy_ = multiallelic_policy::split;
       std::ios::iostate state_;
       int* gt_;
       int gt_sz_;
@@ -508,6 +525,12 @@ namespace savvy
       bool ret = true;
       if (requested_data_formats_[Idx] == data_format)
       {
+        if (multiallelic_policy_ == multiallelic_policy::keep && data_format != fmt::gt && hts_file_->cur_num_alleles() > 2)
+        {
+          state_ = std::ios::failbit; // Only GT can hold allele indices.
+          return ret;
+        }
+
         switch (data_format)
         {
           case fmt::gt:
@@ -555,6 +578,27 @@ namespace savvy
       }
     }
 
+    template <std::size_t VecCnt>
+    template <std::size_t Idx>
+    bool reader_base<VecCnt>::read_genos_to(fmt data_format, site_info& annotations, packed_allele_vector& destination)
+    {
+      bool ret = true;
+      if (requested_data_formats_[Idx] == data_format)
+      {
+        // Bit-packed destinations only support fmt::gt, which can't hold allele indices.
+        if (data_format == fmt::gt && (multiallelic_policy_ == multiallelic_policy::split || hts_file_->cur_num_alleles() <= 2))
+          read_genotypes_al(annotations, destination);
+        else
+          state_ = std::ios::failbit;
+      }
+      else
+      {
+        // Discard Genotypes
+        ret = false;
+      }
+      return ret;
+    }
+
     template <std::size_t VecCnt>
     void reader_base<VecCnt>::read_variant_details(site_info& destination)
     {
@@ -562,7 +606,7 @@ namespace savvy
       {
         bool res = true;
         ++allele_index_;
-        if (allele_index_ >= hts_file_->cur_num_alleles())
+        if (allele_index_ >= hts_file_->cur_num_alleles() || multiallelic_policy_ == multiallelic_policy::keep)
         {
           res = hts_file_->read_next_record();
 
@@ -572,7 +616,7 @@ namespace savvy
         
         if (res)
         {
-          destination = hts_file_->cur_site_info(allele_index_);
+          destination = hts_file_->cur_site_info(multiallelic_policy_ == multiallelic_policy::keep ? 0 : allele_index_);
         }
 
         if (!res)
@@ -599,6 +643,7 @@ namespace savvy
           {
             const int allele_index_plus_one = allele_index_ + 1;
             const std::uint64_t ploidy(gt_sz_ / samples().size());
+            const bool keep = multiallelic_policy_ == multiallelic_policy::keep; // Values are allele indices.
 
             if (subset_map_.size())
             {
@@ -611,11 +656,11 @@ namespace savvy
                 {
                   if (gt_[i] == bcf_gt_missing)
                   {
-                    destination[subset_map_[sample_index] * ploidy + (i % ploidy)] = std::numeric_limits<typename T::value_type>::quiet_NaN();
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy + (i % ploidy)) = std::numeric_limits<typename T::value_type>::quiet_NaN();
                   }
-                  else if ((gt_[i] >> 1) == allele_index_plus_one)
+                  else if (keep ? (gt_[i] >> 1) > 1 : (gt_[i] >> 1) == allele_index_plus_one)
                   {
-                    destination[subset_map_[sample_index] * ploidy + (i % ploidy)] = alt_value;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy + (i % ploidy)) = keep ? typename T::value_type((gt_[i] >> 1) - 1) : alt_value;
                   }
                 }
               }
@@ -628,11 +673,11 @@ namespace savvy
               {
                 if (gt_[i] == bcf_gt_missing)
                 {
-                  destination[i] = std::numeric_limits<typename T::value_type>::quiet_NaN();
+                  ::savvy::detail::sorted_element(destination, i) = std::numeric_limits<typename T::value_type>::quiet_NaN();
                 }
-                else if ((gt_[i] >> 1) == allele_index_plus_one)
+                else if (keep ? (gt_[i] >> 1) > 1 : (gt_[i] >> 1) == allele_index_plus_one)
                 {
-                  destination[i] = alt_value;
+                  ::savvy::detail::sorted_element(destination, i) = keep ? typename T::value_type((gt_[i] >> 1) - 1) : alt_value;
                 }
               }
             }
@@ -645,6 +690,49 @@ namespace savvy
       }
     }
 
+    template <std::size_t VecCnt>
+    void reader_base<VecCnt>::read_genotypes_al(site_info& annotations, packed_allele_vector& destination)
+    {
+      if (good())
+      {
+        if (allele_index_ > 1 || hts_file_->get_cur_format_values_int32("GT", &(gt_), &(gt_sz_)))
+        {
+          if (gt_sz_ % samples().size() != 0)
+          {
+            std::cerr << "ERROR: mixed ploidy at site" << std::endl;
+            state_ = std::ios::badbit;
+          }
+          else
+          {
+            const int allele_index_plus_one = allele_index_ + 1;
+            const std::uint64_t ploidy(gt_sz_ / samples().size());
+            destination.resize((subset_map_.size() ? subset_size_ : samples().size()) * ploidy);
+
+            for (std::size_t i = 0; i < gt_sz_; ++i)
+            {
+              std::uint64_t hap_index = i;
+              if (subset_map_.size())
+              {
+                const std::uint64_t sample_index = i / ploidy;
+                if (subset_map_[sample_index] == std::numeric_limits<std::uint64_t>::max())
+                  continue;
+                hap_index = subset_map_[sample_index] * ploidy + (i % ploidy);
+              }
+
+              if (gt_[i] == bcf_gt_missing)
+                destination.set_missing(hap_index);
+              else if ((gt_[i] >> 1) == allele_index_plus_one)
+                destination.set_alt(hap_index);
+            }
+
+            return;
+          }
+        }
+
+        this->state_ = std::ios::failbit;
+      }
+    }
+
     template <std::size_t VecCnt>
     template <typename T>
     void reader_base<VecCnt>::read_genotypes_gt(site_info& annotations, T& destination)
@@ -675,11 +763,11 @@ namespace savvy
                 {
                   if (gt_[i] == bcf_gt_missing)
                   {
-                    destination[subset_map_[sample_index]] += std::numeric_limits<typename T::value_type>::quiet_NaN();
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) += std::numeric_limits<typename T::value_type>::quiet_NaN();
                   }
                   else if ((gt_[i] >> 1) == allele_index_plus_one)
                   {
-                    destination[subset_map_[sample_index]] += alt_value;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) += alt_value;
                   }
                 }
               }
@@ -692,11 +780,11 @@ namespace savvy
               {
                 if (gt_[i] == bcf_gt_missing)
                 {
-                  destination[i / ploidy] += std::numeric_limits<typename T::value_type>::quiet_NaN();
+                  ::savvy::detail::sorted_element(destination, i / ploidy) += std::numeric_limits<typename T::value_type>::quiet_NaN();
                 }
                 else if ((gt_[i] >> 1) == allele_index_plus_one)
                 {
-                  destination[i / ploidy] += alt_value;
+                  ::savvy::detail::sorted_element(destination, i / ploidy) += alt_value;
                 }
               }
             }
@@ -749,7 +837,7 @@ namespace savvy
                   float cur_ds = ds[i];
                   if (cur_ds != zero_value)
                   {
-                    destination[subset_map_[sample_index]] = cur_ds;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index]) = cur_ds;
                   }
                 }
               }
@@ -763,7 +851,7 @@ namespace savvy
                 float cur_ds = ds[i];
                 if (cur_ds != zero_value)
                 {
-                  destination[i] = cur_ds;
+                  ::savvy::detail::sorted_element(destination, i) = cur_ds;
                 }
               }
             }
@@ -816,7 +904,7 @@ namespace savvy
                   float cur_hds = hds[i];
                   if (cur_hds != zero_value)
                   {
-                    destination[subset_map_[sample_index] * ploidy + (i % ploidy)] = cur_hds;
+                    ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy + (i % ploidy)) = cur_hds;
                   }
                 }
               }
@@ -830,7 +918,7 @@ namespace savvy
                 float cur_hds = hds[i];
                 if (cur_hds != zero_value)
                 {
-                  destination[i] = cur_hds;
+                  ::savvy::detail::sorted_element(destination, i) = cur_hds;
                 }
               }
             }
@@ -879,7 +967,7 @@ namespace savvy
               {
                 const std::uint64_t sample_index = i / ploidy_plus_one;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
-                  destination[subset_map_[sample_index] * ploidy_plus_one + (i % ploidy_plus_one)] = gp[i];
+                  ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy_plus_one + (i % ploidy_plus_one)) = gp[i];
               }
             }
             else
@@ -888,7 +976,7 @@ namespace savvy
 
               for (std::size_t i = 0; i < gt_sz_; ++i)
               {
-                destination[i] = gp[i];
+                ::savvy::detail::sorted_element(destination, i) = gp[i];
               }
             }
             return;
@@ -935,7 +1023,7 @@ namespace savvy
               {
                 const std::uint64_t sample_index = i / ploidy_plus_one;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
-                  destination[subset_map_[sample_index] * ploidy + (i % ploidy_plus_one)] = gl[i];
+                  ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy + (i % ploidy_plus_one)) = gl[i];
               }
             }
             else
@@ -944,7 +1032,7 @@ namespace savvy
 
               for (std::size_t i = 0; i < gt_sz_; ++i)
               {
-                destination[i] = gl[i];
+                ::savvy::detail::sorted_element(destination, i) = gl[i];
               }
             }
             return;
@@ -989,7 +1077,7 @@ namespace savvy
               {
                 const std::uint64_t sample_index = i / ploidy_plus_one;
                 if (subset_map_[sample_index] != std::numeric_limits<std::uint64_t>::max())
-                  destination[subset_map_[sample_index] * ploidy + (i % ploidy_plus_one)] = gt_[i];
+                  ::savvy::detail::sorted_element(destination, subset_map_[sample_index] * ploidy + (i % ploidy_plus_one)) = gt_[i];
               }
             }
             else
@@ -998,7 +1086,7 @@ namespace savvy
 
               for (std::size_t i = 0; i < gt_sz_; ++i)
               {
-                destination[i] = gt_[i];
+                ::savvy::detail::sorted_element(destination, i) = gt_[i];
               }
             }
             return;
@@ -0,0 +1,170 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_ZSTD_IBUF_HPP
+#define LIBSAVVY_ZSTD_IBUF_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <istream>
+#include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct ZSTD_DCtx_s;
+struct ZSTD_DDict_s;
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Input streambuf for SAV files that decompresses one zstd frame at a time into a
+     * contiguous buffer. The get area never spans two frames, which lets record parsers
+     * request a minimum number of contiguous bytes with fill() and decode them with raw
+     * pointers instead of going through std::istreambuf_iterator.
+     *
+     * Positions reported by tellg() and accepted by seekg() are compressed file offsets of
+     * frame starts, which is what s1r index entries store.
+     *
+     * When read_ahead_depth is non-zero, a background thread decompresses up to that many whole
+     * frames ahead of the consumer into a bounded ring of buffers. Seeking to a frame that is
+     * already in the ring (e.g., the next s1r block) reuses it, otherwise the thread is restarted
+     * at the new position.
+     *
+     * When memory_map is set (and supported by the platform), the file is mapped read-only and
+     * frames are decompressed straight from the mapped pages instead of through a filebuf.
+     * Readers of the same file then share the page cache and don't need a compressed input
+     * buffer of their own.
+     */
+    class zstd_ibuf : public std::streambuf
+    {
+    public:
+      zstd_ibuf(const std::string& file_path, std::size_t read_ahead_depth = 0, bool memory_map = false);
+      ~zstd_ibuf();
+
+      zstd_ibuf(const zstd_ibuf&) = delete;
+      zstd_ibuf& operator=(const zstd_ibuf&) = delete;
+
+      /**
+       * Makes decompressed bytes available at data().
+       * @param min_bytes Number of contiguous bytes requested.
+       * @return Number of bytes available, which is less than min_bytes only when the current frame ends first. Zero means end of file or error.
+       */
+      std::size_t fill(std::size_t min_bytes)
+      {
+        std::size_t avail = std::size_t(egptr() - gptr());
+        if (avail >= min_bytes)
+          return avail;
+        return replenish(min_bytes);
+      }
+
+      const char* data() const { return gptr(); }
+      const char* data_end() const { return egptr(); }
+
+      /**
+       * Marks bytes up to pos as read.
+       * @param pos Pointer within [data(), data_end()].
+       */
+      void consume(const char* pos) { setg(eback(), const_cast<char*>(pos), egptr()); }
+
+      /**
+       * Decompresses every frame after the current one with a zstd dictionary. The current
+       * frame must have been read to its end, which is where SAV headers store the dictionary.
+       * @param data Dictionary content.
+       * @param size Dictionary size in bytes.
+       * @return False if the dictionary could not be loaded or the current frame has unread data.
+       */
+      bool set_dictionary(const char* data, std::size_t size);
+
+      /**
+       * Reads the end of the current frame (e.g., its checksum) so that tellg() reports the
+       * offset of the next one.
+       * @return False if the current frame still has unread data.
+       */
+      bool finish_frame();
+
+      /**
+       * Skips the next frame without decompressing it. The current frame must be finished.
+       * @return False if the frame is truncated or missing.
+       */
+      bool skip_frame();
+    protected:
+      int_type underflow();
+      pos_type seekoff(off_type off, std::ios::seekdir way, std::ios::openmode which);
+      pos_type seekpos(pos_type pos, std::ios::openmode which);
+    private:
+      struct frame
+      {
+        std::vector<char> data;
+        std::size_t size;
+        std::uint64_t offset;
+        std::uint64_t next_offset;
+      };
+
+      std::size_t replenish(std::size_t min_bytes);
+      std::size_t read_compressed();
+      bool reset_input(std::uint64_t pos);
+      bool decompress_frame(frame& f, bool& error);
+      std::size_t next_ready_frame();
+      void read_ahead();
+      void start_read_ahead();
+      void stop_read_ahead();
+    private:
+      std::filebuf compressed_file_;
+      ZSTD_DCtx_s* zstd_context_;
+      ZSTD_DDict_s* dictionary_;
+      std::vector<char> compressed_buffer_;
+      const char* compressed_data_;
+      std::size_t compressed_pos_;
+      std::size_t compressed_end_;
+      std::uint64_t compressed_buffer_offset_;
+      std::vector<char> frame_buffer_;
+      std::uint64_t frame_offset_;
+      std::uint64_t next_frame_offset_;
+      bool frame_done_;
+      bool error_;
+
+      // Members below are only used in read-ahead mode. The worker thread owns the compressed
+      // file and decompression context while it runs.
+      std::size_t read_ahead_depth_;
+      std::thread worker_;
+      std::mutex mutex_;
+      std::condition_variable frame_ready_;
+      std::condition_variable slot_free_;
+      std::deque<frame> ready_frames_;
+      std::vector<std::vector<char>> free_buffers_;
+      std::uint64_t worker_offset_;
+      bool stop_worker_;
+      bool worker_done_;
+      bool worker_error_;
+
+      const char* mapped_data_;
+      std::size_t mapped_size_;
+      bool memory_mapped_;
+    };
+
+    class zstd_istream : public std::istream
+    {
+    public:
+      zstd_istream(const std::string& file_path, std::size_t read_ahead_depth = 0, bool memory_map = false) :
+        std::istream(&sbuf_),
+        sbuf_(file_path, read_ahead_depth, memory_map)
+      {
+      }
+
+      zstd_ibuf* rdbuf() { return &sbuf_; }
+    private:
+      zstd_ibuf sbuf_;
+    };
+  }
+}
+
+#endif //LIBSAVVY_ZSTD_IBUF_HPP
@@ -0,0 +1,128 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_ZSTD_OBUF_HPP
+#define LIBSAVVY_ZSTD_OBUF_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <fstream>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Output streambuf for SAV files that compresses everything written between calls to
+     * end_frame() as one independent zstd frame.
+     *
+     * Without compression threads, frames are compressed as a stream on the calling thread.
+     * When compression_threads is non-zero, each frame is buffered whole and compressed by a pool
+     * of worker threads while the caller keeps serializing records. Compressed frames are still
+     * written to the file in order on the calling thread, with at most two frames per thread in
+     * flight.
+     *
+     * The file offset of a frame is only known once every preceding frame has been compressed,
+     * so end_frame() accepts a callback that receives it (e.g., to emit an s1r entry). Callbacks
+     * run on the calling thread in frame order, at the latest during sync().
+     */
+    class zstd_obuf : public std::streambuf
+    {
+    public:
+      typedef std::function<void(std::uint64_t)> frame_callback;
+
+      zstd_obuf(const std::string& file_path, int compression_level, std::size_t compression_threads = 0);
+      ~zstd_obuf();
+
+      zstd_obuf(const zstd_obuf&) = delete;
+      zstd_obuf& operator=(const zstd_obuf&) = delete;
+
+      /**
+       * Ends the current frame and hands it to the compressor.
+       * @param on_written Invoked with the compressed file offset of the frame once it has been written.
+       * @return False if this or any earlier frame failed to compress or write.
+       */
+      bool end_frame(frame_callback on_written = frame_callback());
+
+      /**
+       * Compresses every following frame with a zstd dictionary. Must be called between frames.
+       * @param data Dictionary content (e.g., from train_zstd_dictionary()). Empty disables the dictionary.
+       * @param size Dictionary size in bytes.
+       * @return False if the dictionary could not be loaded or a frame is still being compressed.
+       */
+      bool set_dictionary(const char* data, std::size_t size);
+    protected:
+      int_type overflow(int_type c);
+      std::streamsize xsputn(const char* s, std::streamsize n);
+      int sync();
+      pos_type seekoff(off_type off, std::ios::seekdir way, std::ios::openmode which);
+    private:
+      struct frame
+      {
+        std::vector<char> data;
+        std::vector<char> compressed;
+        std::size_t size;
+        std::size_t compressed_size;
+        frame_callback on_written;
+        const ZSTD_CDict_s* dictionary;
+        bool done;
+        bool error;
+      };
+
+      void reserve_put_area(std::size_t min_free);
+      void bump_put_pointer(std::size_t n);
+      bool stream_put_area(bool end);
+      bool compress_frame(ZSTD_CCtx_s* ctx, frame& f);
+      void write_frames(bool wait_all);
+      void compress_worker();
+    private:
+      std::filebuf file_;
+      ZSTD_CCtx_s* zstd_context_;
+      ZSTD_CDict_s* dictionary_;
+      int compression_level_;
+      std::vector<char> frame_buffer_;
+      std::vector<char> stream_buffer_; // Compressed output of the streaming (no worker) path.
+      std::uint64_t file_offset_;
+      std::size_t frame_compressed_size_;
+      bool frame_started_;
+      bool error_;
+
+      // Frames in file order. Only the calling thread adds or removes entries. Workers take
+      // jobs from jobs_ and set done under mutex_.
+      std::deque<std::unique_ptr<frame>> pending_frames_;
+      std::vector<std::unique_ptr<frame>> free_frames_;
+      std::size_t max_pending_frames_;
+      std::vector<std::thread> workers_;
+      std::mutex mutex_;
+      std::condition_variable job_ready_;
+      std::condition_variable frame_done_;
+      std::deque<frame*> jobs_;
+      bool stop_workers_;
+    };
+
+    /**
+     * Trains a zstd dictionary from concatenated samples.
+     * @param samples Sample data, one sample after another.
+     * @param sample_sizes Size of each sample.
+     * @param max_size Maximum dictionary size in bytes.
+     * @return The dictionary, or an empty vector if training failed (e.g., too few samples).
+     */
+    std::vector<char> train_zstd_dictionary(const std::vector<char>& samples, const std::vector<std::size_t>& sample_sizes, std::size_t max_size);
+  }
+}
+
+#endif //LIBSAVVY_ZSTD_OBUF_HPP
@@ -104,8 +104,12 @@ int concat_main(int argc, char **argv)
   }
 
   std::size_t ploidy = 0;
+  std::uint16_t minor_version = 0;
+  std::vector<char> dictionary;
+  std::uint64_t features = 0;
   std::vector<std::string> samples;
-  savvy::fmt data_format;
+  std::vector<savvy::fmt> data_formats;
+  std::uint8_t dosage_bit_width = 7;
 
   std::vector<std::pair<std::string,std::string>> merged_headers;
   std::set<std::string> info_fields;
@@ -127,8 +131,36 @@ int concat_main(int argc, char **argv)
     if (it == args.input_paths().begin())
     {
       ploidy = sav_reader.ploidy();
+      minor_version = sav_reader.minor_version();
+      dictionary = sav_reader.dictionary();
+      features = sav_reader.features();
       samples = sav_reader.samples();
-      data_format = sav_reader.data_format();
+      data_formats = sav_reader.data_formats();
+      dosage_bit_width = sav_reader.dosage_bit_width();
+    }
+
+    if (minor_version != sav_reader.minor_version())
+    {
+      std::cerr << "Files do not have the same SAV version\n";
+      return EXIT_FAILURE;
+    }
+
+    if (dictionary != sav_reader.dictionary())
+    {
+      std::cerr << "Files do not have the same compression dictionary\n";
+      return EXIT_FAILURE;
+    }
+
+    if (features != sav_reader.features())
+    {
+      std::cerr << "Files do not have the same frame layout\n";
+      return EXIT_FAILURE;
+    }
+
+    if (data_formats != sav_reader.data_formats() || dosage_bit_width != sav_reader.dosage_bit_width())
+    {
+      std::cerr << "Files do not have the same FORMAT fields\n";
+      return EXIT_FAILURE;
     }
 
     if (ploidy != sav_reader.ploidy())
@@ -155,7 +187,15 @@ int concat_main(int argc, char **argv)
   }
 
   {
-    savvy::sav::writer header_writer(args.output_path(), samples.begin(), samples.end(), merged_headers.begin(), merged_headers.end(), data_format);
+    savvy::sav::writer::options opts;
+    opts.minor_version = minor_version;
+    opts.dictionary = dictionary;
+    opts.columnar_frames = (features & savvy::sav::feature_columnar_frames) != 0;
+    opts.delta_sites = (features & savvy::sav::feature_delta_sites) != 0;
+    opts.pbwt = (features & savvy::sav::feature_pbwt) != 0;
+    opts.multiallelic = (features & savvy::sav::feature_multiallelic) != 0;
+    opts.dosage_bit_width = dosage_bit_width;
+    savvy::sav::writer header_writer(args.output_path(), opts, samples.begin(), samples.end(), merged_headers.begin(), merged_headers.end(), data_formats);
     header_writer.write_header(ploidy);
   }
 
@@ -593,14 +593,18 @@ int export_main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
+  // Exported records are biallelic, like those of the VCF reader.
+  savvy::sav::reader::options opts;
+  opts.split_multiallelic = true;
+
   if (args.regions().size())
   {
-    savvy::sav::indexed_reader input(args.input_path(), args.regions().front(), args.bounding_point(), args.format());
+    savvy::sav::indexed_reader input(args.input_path(), "", args.regions().front(), args.bounding_point(), opts, args.format());
     return prep_reader_for_export(input, args);
   }
   else
   {
-    savvy::sav::reader input(args.input_path(), args.format());
+    savvy::sav::reader input(args.input_path(), opts, args.format());
     return prep_reader_for_export(input, args);
   }
 }
\ No newline at end of file
@@ -18,6 +18,7 @@
 #include <fstream>
 #include <vector>
 #include <set>
+#include <array>
 
 class import_prog_args
 {
@@ -34,9 +35,19 @@ private:
   int update_info_ = -1;
   int compression_level_ = -1;
   std::uint16_t block_size_ = default_block_size;
+  std::uint64_t block_max_bytes_ = 0;
+  std::uint32_t block_max_span_ = 0;
+  std::uint32_t sample_block_size_ = 0;
+  std::size_t threads_ = 0;
+  std::size_t dictionary_records_ = 0;
+  std::uint8_t dosage_bit_width_ = 7;
+  bool columnar_ = false;
+  bool delta_sites_ = false;
+  bool pbwt_ = false;
+  bool multiallelic_ = false;
   bool help_ = false;
   bool index_ = false;
-  savvy::fmt format_ = savvy::fmt::gt;
+  std::vector<savvy::fmt> formats_ = {savvy::fmt::gt};
   savvy::bounding_point bounding_point_ = savvy::bounding_point::beg;
   std::unique_ptr<savvy::s1r::sort_point> sort_type_ = nullptr;
   savvy::vcf::empty_vector_policy empty_vector_policy_ = savvy::vcf::empty_vector_policy::fail;
@@ -44,19 +55,29 @@ public:
   import_prog_args() :
     long_options_(
       {
+        {"block-bytes", required_argument, 0, '\x01'},
         {"block-size", required_argument, 0, 'b'},
+        {"block-span", required_argument, 0, '\x01'},
         {"bounding-point", required_argument, 0, 'p'},
+        {"columnar", no_argument, 0, '\x01'},
         {"data-format", required_argument, 0, 'd'},
+        {"delta-sites", no_argument, 0, '\x01'},
+        {"dictionary-records", required_argument, 0, '\x01'},
+        {"dosage-bit-width", required_argument, 0, '\x01'},
         {"help", no_argument, 0, 'h'},
         {"index", no_argument, 0, 'x'},
         {"index-file", required_argument, 0, 'X'},
+        {"multiallelic", no_argument, 0, '\x01'},
+        {"pbwt", no_argument, 0, '\x01'},
         {"regions", required_argument, 0, 'r'},
         {"regions-file", required_argument, 0, 'R'},
         {"sample-ids", required_argument, 0, 'i'},
+        {"sample-block-size", required_argument, 0, '\x01'},
         {"sample-ids-file", required_argument, 0, 'I'},
         {"skip-empty-vectors", no_argument, 0, '\x01'},
         {"sort", no_argument, 0, 's'},
         {"sort-point", required_argument, 0, 'S'},
+        {"threads", required_argument, 0, 't'},
         {"update-info", required_argument, 0, '\x01'},
         {0, 0, 0, 0}
       })
@@ -70,7 +91,18 @@ public:
   const std::vector<savvy::region>& regions() const { return regions_; }
   std::uint8_t compression_level() const { return std::uint8_t(compression_level_); }
   std::uint16_t block_size() const { return block_size_; }
-  savvy::fmt format() const { return format_; }
+  std::uint64_t block_max_bytes() const { return block_max_bytes_; }
+  std::uint32_t block_max_span() const { return block_max_span_; }
+  std::uint32_t sample_block_size() const { return sample_block_size_; }
+  std::size_t threads() const { return threads_; }
+  std::size_t dictionary_records() const { return dictionary_records_; }
+  std::uint8_t dosage_bit_width() const { return dosage_bit_width_; }
+  bool columnar() const { return columnar_; }
+  bool delta_sites() const { return delta_sites_; }
+  bool pbwt() const { return pbwt_; }
+  bool multiallelic() const { return multiallelic_; }
+  savvy::fmt format() const { return formats_.front(); }
+  const std::vector<savvy::fmt>& formats() const { return formats_; }
   savvy::bounding_point bounding_point() const { return bounding_point_; }
   const std::unique_ptr<savvy::s1r::sort_point>& sort_type() const { return sort_type_; }
   savvy::vcf::empty_vector_policy empty_vector_policy() const { return empty_vector_policy_; }
@@ -84,7 +116,7 @@ public:
     os << "\n";
     os << " -#                        Number (#) of compression level (1-19, default: " << default_compression_level << ")\n";
     os << " -b, --block-size          Number of markers in compression block (0-65535, default: " << default_block_size << ")\n";
-    os << " -d, --data-format         Format field to copy (GT or HDS, default: GT)\n";
+    os << " -d, --data-format         Format field(s) to copy (GT, HDS, GT,HDS or HDS,GT, default: GT)\n";
     os << " -h, --help                Print usage\n";
     os << " -i, --sample-ids          Comma separated list of sample IDs to subset\n";
     os << " -I, --sample-ids-file     Path to file containing list of sample IDs to subset\n";
@@ -93,9 +125,19 @@ public:
     os << " -R, --regions-file        Path to file containing list of regions formatted as chr<tab>start<tab>end\n";
     os << " -s, --sort                Enables sorting by first position of allele\n";
     os << " -S, --sort-point          Enables sorting and specifies which allele position to sort by (beg, mid or end)\n";
+    os << " -t, --threads             Number of background compression threads (default: 0)\n";
     os << " -x, --index               Enables indexing\n";
     os << " -X, --index-file          Enables indexing and specifies index output file\n";
     os << "\n";
+    os << "     --block-bytes         Closes compression blocks once they reach this many uncompressed bytes (default: 0, disabled)\n";
+    os << "     --block-span          Closes compression blocks before a marker that starts this many base pairs past the block's first marker (default: 0, disabled)\n";
+    os << "     --columnar            Compresses site fields and genotypes of each block separately so that site-only reads are faster\n";
+    os << "     --delta-sites         Stores chromosomes only when they change, positions as deltas and SNV alleles in one byte\n";
+    os << "     --dictionary-records  Number of leading markers used to train a zstd dictionary stored in the header, which shrinks files with small compression blocks (default: 0, disabled)\n";
+    os << "     --dosage-bit-width    Number of bits (1-7) HDS values are quantized to, where 1 stores hard calls (default: 7)\n";
+    os << "     --multiallelic        Stores multi-allelic variants as single markers with allele indices instead of splitting them (GT only)\n";
+    os << "     --pbwt                Stores alleles in positional Burrows-Wheeler transform order, which shrinks phased reference panels (disables sample blocks)\n";
+    os << "     --sample-block-size   Number of samples per independently decodable genotype block, which speeds up reading sample subsets (default: 0, disabled)\n";
     os << "     --skip-empty-vectors  Skips variants that don't contain the request data format (By default, the import fails)\n";
     os << "     --update-info      Specifies whether AC, AN, AF and MAF info fields should be updated (always, never or auto, default: auto)\n";
     os << std::flush;
@@ -105,7 +147,7 @@ public:
   {
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "0123456789b:d:f:hi:I:p:r:R:sS:xX:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "0123456789b:d:f:hi:I:p:r:R:sS:t:xX:", long_options_.data(), &long_index )) != -1)
     {
       char copt = char(opt & 0xFF);
       switch (copt)
@@ -117,6 +159,57 @@ public:
             empty_vector_policy_ = savvy::vcf::empty_vector_policy::skip;
             break;
           }
+          else if (std::string(long_options_[long_index].name) == "block-bytes")
+          {
+            block_max_bytes_ = std::uint64_t(std::strtoull(optarg, nullptr, 10));
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "block-span")
+          {
+            block_max_span_ = std::uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "columnar")
+          {
+            columnar_ = true;
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "delta-sites")
+          {
+            delta_sites_ = true;
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "pbwt")
+          {
+            pbwt_ = true;
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "multiallelic")
+          {
+            multiallelic_ = true;
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "dictionary-records")
+          {
+            dictionary_records_ = std::size_t(std::strtoull(optarg, nullptr, 10));
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "dosage-bit-width")
+          {
+            const unsigned long width = std::strtoul(optarg, nullptr, 10);
+            if (width < 1 || width > 7)
+            {
+              std::cerr << "Invalid --dosage-bit-width argument (" << optarg << ")." << std::endl;
+              return false;
+            }
+            dosage_bit_width_ = std::uint8_t(width);
+            break;
+          }
+          else if (std::string(long_options_[long_index].name) == "sample-block-size")
+          {
+            sample_block_size_ = std::uint32_t(std::strtoul(optarg, nullptr, 10));
+            break;
+          }
           std::cerr << "Invalid long only index (" << long_index << ")\n";
           return false;
         }
@@ -140,14 +233,27 @@ public:
           break;
         case 'd':
         {
-          std::string str_opt_arg(optarg ? optarg : "");
-          if (str_opt_arg == "HDS")
+          formats_.clear();
+          for (const auto& str_opt_arg : split_string_to_vector(optarg ? optarg : "", ','))
           {
-            format_ = savvy::fmt::hds;
+            if (str_opt_arg == "GT")
+            {
+              formats_.push_back(savvy::fmt::gt);
+            }
+            else if (str_opt_arg == "HDS")
+            {
+              formats_.push_back(savvy::fmt::hds);
+            }
+            else
+            {
+              std::cerr << "Invalid format field value (" << str_opt_arg << ")\n";
+              return false;
+            }
           }
-          else if (str_opt_arg != "GT")
+
+          if (formats_.empty() || formats_.size() > 2 || (formats_.size() > 1 && formats_.front() == formats_.back()))
           {
-            std::cerr << "Invalid format field value (" << str_opt_arg << ")\n";
+            std::cerr << "Invalid format field value (" << (optarg ? optarg : "") << ")\n";
             return false;
           }
           break;
@@ -234,6 +340,9 @@ public:
           }
           break;
         }
+        case 't':
+          threads_ = std::size_t(std::strtoul(optarg, nullptr, 10));
+          break;
         case 'x':
           index_ = true;
           break;
@@ -284,11 +393,29 @@ public:
       return false;
     }
 
+    if (formats_.size() > 1 && sort_type_)
+    {
+      std::cerr << "Sorting is not supported when importing multiple format fields." << std::endl;
+      return false;
+    }
+
+    if (multiallelic_ && (sort_type_ || formats_ != std::vector<savvy::fmt>{savvy::fmt::gt}))
+    {
+      std::cerr << "--multiallelic only supports unsorted imports of GT." << std::endl;
+      return false;
+    }
+
     if (update_info_ < 0)
     {
       update_info_ = subset_ids_.size() ? 1 : 0; // Automatically update info fields if samples are subset.
     }
 
+    if (multiallelic_ && update_info_)
+    {
+      std::cerr << "Info fields can't be updated from allele indices of multi-allelic variants (use --update-info never)." << std::endl;
+      return false;
+    }
+
     if (compression_level_ < 0)
       compression_level_ = default_compression_level;
     else if (compression_level_ > 19)
@@ -299,15 +426,38 @@ public:
 };
 
 
-int import_records(savvy::vcf::indexed_reader<1>& in, const std::vector<savvy::region>& regions, savvy::fmt data_format, bool update_info, savvy::sav::writer& out)
+template <typename Reader>
+bool read_record(Reader& in, savvy::site_info& variant, std::array<savvy::compressed_vector<float>, 1>& genotypes)
+{
+  return in.read(variant, genotypes[0]).good();
+}
+
+template <typename Reader>
+bool read_record(Reader& in, savvy::site_info& variant, std::array<savvy::compressed_vector<float>, 2>& genotypes)
+{
+  return in.read(variant, genotypes[0], genotypes[1]).good();
+}
+
+void write_record(savvy::sav::writer& out, const savvy::site_info& variant, const std::array<savvy::compressed_vector<float>, 1>& genotypes)
+{
+  out.write(variant, genotypes[0]);
+}
+
+void write_record(savvy::sav::writer& out, const savvy::site_info& variant, const std::array<savvy::compressed_vector<float>, 2>& genotypes)
+{
+  out.write(variant, genotypes[0], genotypes[1]);
+}
+
+template <std::size_t VecCnt>
+int import_records(savvy::vcf::indexed_reader<VecCnt>& in, const std::vector<savvy::region>& regions, savvy::fmt data_format, bool update_info, savvy::sav::writer& out)
 {
   savvy::site_info variant;
-  savvy::compressed_vector<float> genotypes;
-  while (out && in.read(variant, genotypes))
+  std::array<savvy::compressed_vector<float>, VecCnt> genotypes;
+  while (out && read_record(in, variant, genotypes))
   {
     if (update_info)
-      savvy::update_info_fields(variant, genotypes, data_format);
-    out.write(variant, genotypes);
+      savvy::update_info_fields(variant, genotypes[0], data_format);
+    write_record(out, variant, genotypes);
   }
 
   if (regions.size())
@@ -315,11 +465,11 @@ int import_records(savvy::vcf::indexed_reader<1>& in, const std::vector<savvy::r
     for (auto it = regions.begin() + 1; it != regions.end(); ++it)
     {
       in.reset_region(*it);
-      while (out && in.read(variant, genotypes))
+      while (out && read_record(in, variant, genotypes))
       {
         if (update_info)
-          savvy::update_info_fields(variant, genotypes, data_format);
-        out.write(variant, genotypes);
+          savvy::update_info_fields(variant, genotypes[0], data_format);
+        write_record(out, variant, genotypes);
       }
     }
   }
@@ -330,16 +480,17 @@ int import_records(savvy::vcf::indexed_reader<1>& in, const std::vector<savvy::r
   return out.good() && !in.bad() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int import_records(savvy::vcf::reader<1>& in, const std::vector<savvy::region>& regions, savvy::fmt data_format, bool update_info, savvy::sav::writer& out)
+template <std::size_t VecCnt>
+int import_records(savvy::vcf::reader<VecCnt>& in, const std::vector<savvy::region>& regions, savvy::fmt data_format, bool update_info, savvy::sav::writer& out)
 {
   // TODO: support regions without index.
   savvy::site_info variant;
-  savvy::compressed_vector<float> genotypes;
-  while (out && in.read(variant, genotypes))
+  std::array<savvy::compressed_vector<float>, VecCnt> genotypes;
+  while (out && read_record(in, variant, genotypes))
   {
     if (update_info)
-      savvy::update_info_fields(variant, genotypes, data_format);
-    out.write(variant, genotypes);
+      savvy::update_info_fields(variant, genotypes[0], data_format);
+    write_record(out, variant, genotypes);
   }
 
   if (out.fail())
@@ -347,6 +498,16 @@ int import_records(savvy::vcf::reader<1>& in, const std::vector<savvy::region>&
   return out.good() && !in.bad() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+template <typename Reader>
+int sort_and_import_records(Reader& in, const import_prog_args& args, savvy::sav::writer& out)
+{
+  return (sort_and_write_records<std::vector<float>>((*args.sort_type()), in, args.format(), args.regions(), out, args.format(), args.update_info()) && !in.bad() ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Sorting multiple format fields is rejected by import_prog_args::parse().
+int sort_and_import_records(savvy::vcf::reader<2>&, const import_prog_args&, savvy::sav::writer&) { return EXIT_FAILURE; }
+int sort_and_import_records(savvy::vcf::indexed_reader<2>&, const import_prog_args&, savvy::sav::writer&) { return EXIT_FAILURE; }
+
 template <typename T>
 int prep_reader_for_import(T& input, const import_prog_args& args)
 {
@@ -357,6 +518,8 @@ int prep_reader_for_import(T& input, const import_prog_args& args)
   }
 
   input.set_policy(args.empty_vector_policy());
+  if (args.multiallelic())
+    input.set_multiallelic_policy(savvy::vcf::multiallelic_policy::keep);
 
   std::vector<std::string> sample_ids(input.samples().size());
   std::copy(input.samples().begin(), input.samples().end(), sample_ids.begin());
@@ -374,16 +537,26 @@ int prep_reader_for_import(T& input, const import_prog_args& args)
     savvy::sav::writer::options opts;
     opts.compression_level = args.compression_level();
     opts.block_size = args.block_size();
+    opts.block_max_bytes = args.block_max_bytes();
+    opts.block_max_span = args.block_max_span();
+    opts.sample_block_size = args.sample_block_size();
+    opts.compression_threads = args.threads();
+    opts.dictionary_training_records = args.dictionary_records();
+    opts.columnar_frames = args.columnar();
+    opts.delta_sites = args.delta_sites();
+    opts.pbwt = args.pbwt();
+    opts.multiallelic = args.multiallelic();
+    opts.dosage_bit_width = args.dosage_bit_width();
     if (args.index_path().size())
       opts.index_path = args.index_path();
 
-    savvy::sav::writer output(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), headers.begin(), headers.end(), args.format());
+    savvy::sav::writer output(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), headers.begin(), headers.end(), args.formats());
 
     if (output.good())
     {
       if (args.sort_type())
       {
-        return (sort_and_write_records<std::vector<float>>((*args.sort_type()), input, args.format(), args.regions(), output, args.format(), args.update_info()) && !input.bad() ? EXIT_SUCCESS : EXIT_FAILURE);
+        return sort_and_import_records(input, args, output);
       }
       else
       {
@@ -411,6 +584,20 @@ int import_main(int argc, char** argv)
   }
 
 
+  if (args.formats().size() > 1)
+  {
+    if (args.regions().size())
+    {
+      savvy::vcf::indexed_reader<2> input(args.input_path(), args.regions().front(), args.bounding_point(), args.formats()[0], args.formats()[1]);
+      return prep_reader_for_import(input, args);
+    }
+    else
+    {
+      savvy::vcf::reader<2> input(args.input_path(), args.formats()[0], args.formats()[1]);
+      return prep_reader_for_import(input, args);
+    }
+  }
+
   if (args.regions().size())
   {
     savvy::vcf::indexed_reader<1> input(args.input_path(), args.regions().front(), args.bounding_point(), args.format());
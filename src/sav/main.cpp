@@ -12,6 +12,7 @@
 #include "sav/merge.hpp"
 #include "sav/rehead.hpp"
 #include "sav/sort.hpp"
+#include "sav/sort_samples.hpp"
 #include "sav/stat.hpp"
 #include "savvy/utility.hpp"
 
@@ -42,13 +43,14 @@ public:
     os << "or: sav [opts ...]\n";
     os << "\n";
     os << "Sub-commands:\n";
-    os << " export:      Exports SAV to VCF or SAV\n";
-    os << " head:        Prints SAV headers or samples IDs\n";
-    os << " import:      Imports VCF or BCF into SAV\n";
-    os << " index:       Indexes SAV file\n";
-    os << " merge:       Merges multiple files into one\n";
-    os << " rehead:      Replaces headers without recompressing variant blocks.\n";
-    os << " stat-index:  Gathers statistics on s1r index\n";
+    os << " export:       Exports SAV to VCF or SAV\n";
+    os << " head:         Prints SAV headers or samples IDs\n";
+    os << " import:       Imports VCF or BCF into SAV\n";
+    os << " index:        Indexes SAV file\n";
+    os << " merge:        Merges multiple files into one\n";
+    os << " rehead:       Replaces headers without recompressing variant blocks.\n";
+    os << " sort-samples: Reorders samples to reduce file size\n";
+    os << " stat-index:   Gathers statistics on s1r index\n";
     os << "\n";
     os << "Options:\n";
     os << " -h, --help     Print usage\n";
@@ -124,6 +126,10 @@ int main(int argc, char** argv)
   {
     return rehead_main(argc, argv);
   }
+  else if (args.sub_command() == "sort-samples")
+  {
+    return sort_samples_main(argc, argv);
+  }
   else if (args.sub_command() == "stat-index")
   {
     return stat_index_main(argc, argv);
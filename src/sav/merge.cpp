@@ -219,10 +219,13 @@ int merge_main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
+  savvy::sav::reader::options reader_opts;
+  reader_opts.split_multiallelic = true; // Sites are matched by their ALT allele.
+
   std::deque<savvy::sav::reader> input_files;
   for (auto it = args.input_paths().begin(); it != args.input_paths().end(); ++it)
   {
-    input_files.emplace_back(*it, args.format());
+    input_files.emplace_back(*it, reader_opts, args.format());
     if (!input_files.back().good())
     {
       std::cerr << "Could not open file (" << input_files.back().file_path() << ")\n";
@@ -400,10 +403,13 @@ int merge_main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
+  savvy::sav::reader_base::options reader_opts;
+  reader_opts.split_multiallelic = true; // Sites are matched by their ALT allele.
+
   std::deque<sav_reader> input_files;
   for (auto it = args.input_paths().begin(); it != args.input_paths().end(); ++it)
   {
-    input_files.emplace_back(*it, args.format());
+    input_files.emplace_back(*it, reader_opts, args.format());
     if (!input_files.back().good())
     {
       std::cerr << "Could not open file (" << input_files.back().file_path() << ")\n";
@@ -12,6 +12,7 @@
 #include <fstream>
 #include <getopt.h>
 #include <vector>
+#include <algorithm>
 #include <savvy/reader.hpp>
 
 class rehead_prog_args
@@ -163,7 +164,8 @@ int rehead_main(int argc, char **argv)
       else if (it->first == "FORMAT")
       {
         auto inf = savvy::parse_header_value(it->second);
-        if (((inf.id == "GT" && sav_reader.data_format() != savvy::fmt::gt) || (inf.id == "HDS" && sav_reader.data_format() != savvy::fmt::hds))
+        const auto& fmts = sav_reader.data_formats();
+        if (((inf.id == "GT" && std::find(fmts.begin(), fmts.end(), savvy::fmt::gt) == fmts.end()) || (inf.id == "HDS" && std::find(fmts.begin(), fmts.end(), savvy::fmt::hds) == fmts.end()))
           || atoi(inf.number.c_str()) != sav_reader.ploidy())
         {
           std::cerr << "Altering FORMAT header is not allowed\n";
@@ -191,7 +193,15 @@ int rehead_main(int argc, char **argv)
       else
       {
         {
-          savvy::sav::writer sav_writer(args.output_path(), sample_ids.begin(), sample_ids.end(), headers.begin(), headers.end(), sav_reader.data_format());
+          savvy::sav::writer::options opts;
+          opts.minor_version = sav_reader.minor_version(); // Variant frames are copied as is.
+          opts.dictionary = sav_reader.dictionary();
+          opts.columnar_frames = (sav_reader.features() & savvy::sav::feature_columnar_frames) != 0;
+          opts.delta_sites = (sav_reader.features() & savvy::sav::feature_delta_sites) != 0;
+          opts.pbwt = (sav_reader.features() & savvy::sav::feature_pbwt) != 0;
+          opts.multiallelic = (sav_reader.features() & savvy::sav::feature_multiallelic) != 0;
+          opts.dosage_bit_width = sav_reader.dosage_bit_width();
+          savvy::sav::writer sav_writer(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), headers.begin(), headers.end(), sav_reader.data_formats());
           sav_writer.write_header(sav_reader.ploidy());
           if (sav_writer.bad())
           {
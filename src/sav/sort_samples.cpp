@@ -0,0 +1,382 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "sav/sort_samples.hpp"
+#include "savvy/sav_reader.hpp"
+
+#include <fstream>
+#include <getopt.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+class sort_samples_prog_args
+{
+private:
+  static const int default_compression_level = 3;
+  static const int default_block_size = 2048;
+  static constexpr double default_max_af = 0.05;
+
+  std::vector<option> long_options_;
+  std::string input_path_;
+  std::string output_path_;
+  int compression_level_ = -1;
+  std::uint16_t block_size_ = default_block_size;
+  double max_af_ = default_max_af;
+  bool help_ = false;
+public:
+  sort_samples_prog_args() :
+    long_options_(
+      {
+        {"block-size", required_argument, 0, 'b'},
+        {"help", no_argument, 0, 'h'},
+        {"max-af", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
+      })
+  {
+  }
+
+  const std::string& input_path() const { return input_path_; }
+  const std::string& output_path() const { return output_path_; }
+  std::uint8_t compression_level() const { return std::uint8_t(compression_level_); }
+  std::uint16_t block_size() const { return block_size_; }
+  double max_af() const { return max_af_; }
+
+  bool help_is_set() const { return help_; }
+
+  void print_usage(std::ostream& os)
+  {
+    os << "Usage: sav sort-samples [opts ...] <in.sav> <out.sav> \n";
+    os << "\n";
+    os << " -#                Number (#) of compression level (1-19, default: " << default_compression_level << ")\n";
+    os << " -a, --max-af      Maximum allele frequency of variants used to order samples (default: " << default_max_af << ")\n";
+    os << " -b, --block-size  Number of markers in compression block (0-65535, default: " << default_block_size << ")\n";
+    os << " -h, --help        Print usage\n";
+    os << std::flush;
+  }
+
+  bool parse(int argc, char** argv)
+  {
+    int long_index = 0;
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "0123456789a:b:h", long_options_.data(), &long_index )) != -1)
+    {
+      char copt = char(opt & 0xFF);
+      switch (copt)
+      {
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        if (compression_level_ < 0)
+          compression_level_ = 0;
+        compression_level_ *= 10;
+        compression_level_ += copt - '0';
+        break;
+      case 'a':
+        max_af_ = std::atof(optarg ? optarg : "");
+        if (max_af_ <= 0.0 || max_af_ > 1.0)
+        {
+          std::cerr << "Invalid --max-af (" << (optarg ? optarg : "") << ")\n";
+          return false;
+        }
+        break;
+      case 'b':
+        block_size_ = std::uint16_t(std::atoi(optarg) > 0xFFFF ? 0xFFFF : std::atoi(optarg));
+        break;
+      case 'h':
+        help_ = true;
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    int remaining_arg_count = argc - optind;
+
+    if (remaining_arg_count < 2)
+    {
+      std::cerr << "Too few arguments\n";
+      return false;
+    }
+    else if (remaining_arg_count > 2)
+    {
+      std::cerr << "Too many arguments\n";
+      return false;
+    }
+    else
+    {
+      input_path_ = argv[optind];
+      output_path_ = argv[optind + 1];
+    }
+
+    if (compression_level_ < 0)
+      compression_level_ = default_compression_level;
+    else if (compression_level_ > 19)
+      compression_level_ = 19;
+
+    return true;
+  }
+};
+
+/**
+ * Orders samples so that carriers of the same rare alleles end up next to each other.
+ *
+ * Samples are chained greedily: each sample is followed by the not yet placed sample that shares
+ * the most informative variants with it (non-singleton variants with an allele frequency of at
+ * most max_af). When no remaining sample shares any, the chain restarts at the next remaining
+ * sample in file order. Samples of the same ancestry share many rare variants, so a stratified
+ * cohort ends up grouped by population and each rare variant's carriers lie close together.
+ *
+ * @return Sample indices in their new order, or an empty vector if reading the input failed.
+ */
+std::vector<std::size_t> compute_sample_order(savvy::sav::reader& in, double max_af, std::size_t& informative_count)
+{
+  const std::size_t sample_count = in.samples().size();
+  std::vector<std::vector<std::uint32_t>> carried(sample_count); // Informative variants carried by each sample.
+  std::vector<std::uint32_t> carriers; // Carriers of each informative variant, one variant after another.
+  std::vector<std::size_t> carriers_end;
+
+  savvy::site_info site;
+  savvy::compressed_vector<float> genotypes;
+  while (in.read(site, genotypes))
+  {
+    if (genotypes.size() == 0 || genotypes.size() % sample_count != 0)
+      continue;
+    const std::size_t ploidy = genotypes.size() / sample_count;
+    const std::size_t carriers_beg = carriers.size();
+
+    double ac = 0.0;
+    for (auto it = genotypes.begin(); it != genotypes.end(); ++it)
+    {
+      if (*it > 0.0f) // Skips NaN (missing).
+      {
+        ac += *it;
+        if (carriers.size() == carriers_beg || carriers.back() != it.offset() / ploidy)
+          carriers.push_back(std::uint32_t(it.offset() / ploidy));
+      }
+    }
+
+    if (carriers.size() - carriers_beg < 2 || ac / double(genotypes.size()) > max_af)
+    {
+      carriers.resize(carriers_beg);
+      continue;
+    }
+
+    const std::uint32_t variant_id = std::uint32_t(carriers_end.size());
+    for (std::size_t i = carriers_beg; i < carriers.size(); ++i)
+      carried[carriers[i]].push_back(variant_id);
+    carriers_end.push_back(carriers.size());
+  }
+
+  if (in.bad())
+    return {};
+
+  informative_count = carriers_end.size();
+
+  std::vector<std::size_t> order;
+  order.reserve(sample_count);
+  std::vector<bool> placed(sample_count, false);
+  std::vector<std::uint32_t> shared(sample_count, 0);
+  std::vector<std::uint32_t> touched;
+  std::size_t next_unplaced = 0;
+  std::size_t cur = sample_count;
+  while (true)
+  {
+    if (cur == sample_count)
+    {
+      // Samples without informative variants don't shrink anything and go last.
+      while (next_unplaced < sample_count && (placed[next_unplaced] || carried[next_unplaced].empty()))
+        ++next_unplaced;
+      if (next_unplaced == sample_count)
+        break;
+      cur = next_unplaced;
+    }
+
+    placed[cur] = true;
+    order.push_back(cur);
+
+    for (auto it = carried[cur].begin(); it != carried[cur].end(); ++it)
+    {
+      auto beg = carriers.begin() + (*it ? carriers_end[*it - 1] : 0);
+      auto end = carriers.begin() + carriers_end[*it];
+      for (auto jt = beg; jt != end; ++jt)
+      {
+        if (!placed[*jt] && shared[*jt]++ == 0)
+          touched.push_back(*jt);
+      }
+    }
+
+    std::size_t best = sample_count;
+    for (auto it = touched.begin(); it != touched.end(); ++it)
+    {
+      if (best == sample_count || shared[*it] > shared[best] || (shared[*it] == shared[best] && *it < best))
+        best = *it;
+    }
+    for (auto it = touched.begin(); it != touched.end(); ++it)
+      shared[*it] = 0;
+    touched.clear();
+
+    cur = best;
+  }
+
+  for (std::size_t i = 0; i < sample_count; ++i)
+  {
+    if (!placed[i])
+      order.push_back(i);
+  }
+
+  return order;
+}
+
+/**
+ * Moves each sample's values in genotypes to the sample's new index.
+ */
+void permute_samples(const savvy::compressed_vector<float>& genotypes, const std::vector<std::size_t>& new_index, savvy::compressed_vector<float>& destination)
+{
+  const std::size_t ploidy = genotypes.size() / new_index.size();
+  std::vector<std::pair<std::size_t, float>> permuted;
+  permuted.reserve(genotypes.non_zero_size());
+  for (auto it = genotypes.begin(); it != genotypes.end(); ++it)
+    permuted.emplace_back(new_index[it.offset() / ploidy] * ploidy + it.offset() % ploidy, *it);
+  std::sort(permuted.begin(), permuted.end(), [](const std::pair<std::size_t, float>& a, const std::pair<std::size_t, float>& b) { return a.first < b.first; });
+
+  std::vector<float> values(permuted.size());
+  std::vector<std::size_t> offsets(permuted.size());
+  for (std::size_t i = 0; i < permuted.size(); ++i)
+  {
+    offsets[i] = permuted[i].first;
+    values[i] = permuted[i].second;
+  }
+  destination.assign(values.begin(), values.end(), offsets.begin(), genotypes.size());
+}
+
+std::int64_t file_size(const std::string& file_path)
+{
+  std::ifstream ifs(file_path, std::ios::binary | std::ios::ate);
+  return ifs ? std::int64_t(ifs.tellg()) : -1;
+}
+
+int sort_samples_main(int argc, char **argv)
+{
+  sort_samples_prog_args args;
+  if (!args.parse(argc, argv))
+  {
+    args.print_usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  if (args.help_is_set())
+  {
+    args.print_usage(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  std::vector<std::size_t> order;
+  std::size_t informative_count = 0;
+  std::uint32_t sample_block_size = 0;
+  {
+    savvy::sav::reader first_pass(args.input_path());
+    if (!first_pass)
+    {
+      std::cerr << "Could not open input SAV file (" << args.input_path() << ")\n";
+      return EXIT_FAILURE;
+    }
+
+    order = compute_sample_order(first_pass, args.max_af(), informative_count);
+    if (order.size() != first_pass.samples().size())
+    {
+      std::cerr << "Failed reading input SAV file (" << args.input_path() << ")\n";
+      return EXIT_FAILURE;
+    }
+    sample_block_size = first_pass.sample_block_size();
+  }
+
+  savvy::sav::reader in(args.input_path());
+  if (!in)
+  {
+    std::cerr << "Could not open input SAV file (" << args.input_path() << ")\n";
+    return EXIT_FAILURE;
+  }
+
+  const std::size_t sample_count = in.samples().size();
+  std::vector<std::string> sample_ids(sample_count);
+  std::vector<std::size_t> new_index(sample_count);
+  for (std::size_t i = 0; i < sample_count; ++i)
+  {
+    sample_ids[i] = in.samples()[order[i]];
+    new_index[order[i]] = i;
+  }
+
+  std::size_t record_count = 0;
+  {
+    savvy::sav::writer::options opts;
+    opts.compression_level = args.compression_level();
+    opts.block_size = args.block_size();
+    opts.minor_version = in.minor_version();
+    opts.sample_block_size = sample_block_size;
+    opts.index_path = args.output_path() + ".s1r";
+    opts.dictionary = in.dictionary();
+    opts.columnar_frames = (in.features() & savvy::sav::feature_columnar_frames) != 0;
+    opts.delta_sites = (in.features() & savvy::sav::feature_delta_sites) != 0;
+    opts.pbwt = (in.features() & savvy::sav::feature_pbwt) != 0;
+    opts.multiallelic = (in.features() & savvy::sav::feature_multiallelic) != 0;
+    opts.dosage_bit_width = in.dosage_bit_width();
+    savvy::sav::writer out(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), in.headers().begin(), in.headers().end(), in.data_formats());
+
+    // Every stored FORMAT field is read as is, in header order.
+    const std::vector<savvy::fmt> data_formats = in.data_formats();
+    savvy::site_info site;
+    savvy::compressed_vector<float> genotypes;
+    std::vector<savvy::compressed_vector<float>> sorted_genotypes(data_formats.size());
+    while (out && in.read_site_info(site))
+    {
+      for (std::size_t i = 0; i < data_formats.size(); ++i)
+      {
+        in.read_genotypes(data_formats[i], genotypes);
+        permute_samples(genotypes, new_index, sorted_genotypes[i]);
+      }
+
+      if (!in.good())
+        break;
+
+      if (sorted_genotypes.size() > 1)
+        out.write(site, sorted_genotypes[0], sorted_genotypes[1]);
+      else
+        out.write(site, sorted_genotypes[0]);
+      ++record_count;
+    }
+
+    if (in.bad())
+    {
+      std::cerr << "Failed reading input SAV file (" << args.input_path() << ")\n";
+      return EXIT_FAILURE;
+    }
+
+    if (!out)
+    {
+      std::cerr << "Failed writing output SAV file (" << args.output_path() << ")\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  const std::int64_t in_size = file_size(args.input_path());
+  const std::int64_t out_size = file_size(args.output_path());
+  std::cerr << "Ordered " << sample_count << " samples using " << informative_count << " informative variants and rewrote " << record_count << " records\n";
+  if (in_size > 0 && out_size >= 0)
+  {
+    std::cerr << "Input size:  " << in_size << " bytes\n";
+    std::cerr << "Output size: " << out_size << " bytes (" << (100.0 * double(in_size - out_size) / double(in_size)) << "% smaller)\n";
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "savvy/allele_pair_array.hpp"
+
+namespace savvy
+{
+  namespace sav
+  {
+    namespace detail
+    {
+      template <std::uint8_t BitWidth>
+      std::size_t decode_allele_pair_array(const char*& input_it, const char* end_it, std::size_t count, std::uint8_t* prefixes, std::uint64_t* offsets)
+      {
+        // Local copy keeps the compiler from reloading the position after every (aliasing) prefix store.
+        const char* in_it = input_it;
+        std::uint64_t next_offset = 0;
+        std::size_t i = 0;
+        for ( ; i < count; ++i)
+        {
+          if (!decode_allele_pair<BitWidth>(in_it, end_it, prefixes[i], next_offset))
+            break;
+          offsets[i] = next_offset++;
+        }
+        input_it = in_it;
+        return i;
+      }
+
+      template std::size_t decode_allele_pair_array<1>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<2>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<3>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<4>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<5>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<6>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+      template std::size_t decode_allele_pair_array<7>(const char*&, const char*, std::size_t, std::uint8_t*, std::uint64_t*);
+    }
+  }
+}
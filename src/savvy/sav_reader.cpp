@@ -31,10 +31,11 @@ namespace savvy
     reader_base::reader_base(const std::string& file_path) :
       file_path_(file_path),
       subset_size_(0),
-      input_stream_(savvy::detail::make_unique<shrinkwrap::zstd::istream>(file_path)),
+      input_stream_(savvy::detail::make_unique<savvy::detail::zstd_istream>(file_path)),
       file_data_format_(fmt::gt)
     {
       parse_header();
+      init_formats();
       requested_data_format_ = file_data_format_;
       init_subset_map();
     }
@@ -42,17 +43,32 @@ namespace savvy
     reader_base::reader_base(const std::string& file_path, savvy::fmt data_format) :
       file_path_(file_path),
       subset_size_(0),
-      input_stream_(savvy::detail::make_unique<shrinkwrap::zstd::istream>(file_path)),
+      input_stream_(savvy::detail::make_unique<savvy::detail::zstd_istream>(file_path)),
       file_data_format_(fmt::gt),
       requested_data_format_(data_format)
     {
       parse_header();
+      init_formats();
+      init_subset_map();
+    }
+
+    reader_base::reader_base(const std::string& file_path, const options& opts, savvy::fmt data_format) :
+      file_path_(file_path),
+      subset_size_(0),
+      input_stream_(savvy::detail::make_unique<savvy::detail::zstd_istream>(file_path, opts.read_ahead_depth, opts.memory_map)),
+      file_data_format_(fmt::gt),
+      requested_data_format_(data_format),
+      split_multiallelic_(opts.split_multiallelic)
+    {
+      parse_header();
+      init_formats();
       init_subset_map();
     }
 
     reader_base::reader_base(reader_base&& source) :
       sample_ids_(std::move(source.sample_ids_)),
       subset_map_(std::move(source.subset_map_)),
+      subset_counts_(std::move(source.subset_counts_)),
       metadata_fields_(std::move(source.metadata_fields_)),
       //sbuf_(std::move(source.sbuf_)),
       //input_stream_(&sbuf_),
@@ -60,7 +76,26 @@ namespace savvy
       subset_size_(source.subset_size_),
       input_stream_(std::move(source.input_stream_)),
       file_data_format_(source.file_data_format_),
-      requested_data_format_(source.requested_data_format_)
+      requested_data_format_(source.requested_data_format_),
+      file_data_formats_(std::move(source.file_data_formats_)),
+      file_bit_widths_(std::move(source.file_bit_widths_)),
+      format_cursor_(source.format_cursor_),
+      minor_version_(source.minor_version_),
+      dictionary_(std::move(source.dictionary_)),
+      sample_block_size_(source.sample_block_size_),
+      genotypes_pending_(source.genotypes_pending_),
+      features_(source.features_),
+      site_frame_(std::move(source.site_frame_)),
+      site_frame_offset_(source.site_frame_offset_),
+      sites_in_frame_(source.sites_in_frame_),
+      genotypes_in_frame_(source.genotypes_in_frame_),
+      genotype_lag_(source.genotype_lag_),
+      prev_site_chromosome_(std::move(source.prev_site_chromosome_)),
+      prev_site_position_(source.prev_site_position_),
+      pbwt_(std::move(source.pbwt_)),
+      gt_prefix_width_(source.gt_prefix_width_),
+      split_multiallelic_(source.split_multiallelic_),
+      split_(std::move(source.split_))
     {
     }
 
@@ -70,6 +105,7 @@ namespace savvy
       {
         sample_ids_ = std::move(source.sample_ids_);
         subset_map_ = std::move(source.subset_map_);
+        subset_counts_ = std::move(source.subset_counts_);
         subset_size_ = source.subset_size_;
         //sbuf_ = std::move(source.sbuf_);
         //input_stream_->rdbuf(&sbuf_);
@@ -78,6 +114,25 @@ namespace savvy
         metadata_fields_ = std::move(source.metadata_fields_);
         file_data_format_ = source.file_data_format_;
         requested_data_format_ = source.requested_data_format_;
+        file_data_formats_ = std::move(source.file_data_formats_);
+        file_bit_widths_ = std::move(source.file_bit_widths_);
+        format_cursor_ = source.format_cursor_;
+        minor_version_ = source.minor_version_;
+        dictionary_ = std::move(source.dictionary_);
+        sample_block_size_ = source.sample_block_size_;
+        genotypes_pending_ = source.genotypes_pending_;
+        features_ = source.features_;
+        site_frame_ = std::move(source.site_frame_);
+        site_frame_offset_ = source.site_frame_offset_;
+        sites_in_frame_ = source.sites_in_frame_;
+        genotypes_in_frame_ = source.genotypes_in_frame_;
+        genotype_lag_ = source.genotype_lag_;
+        prev_site_chromosome_ = std::move(source.prev_site_chromosome_);
+        prev_site_position_ = source.prev_site_position_;
+        pbwt_ = std::move(source.pbwt_);
+        gt_prefix_width_ = source.gt_prefix_width_;
+        split_multiallelic_ = source.split_multiallelic_;
+        split_ = std::move(source.split_);
       }
       return *this;
     }
@@ -96,7 +151,10 @@ namespace savvy
           parse_ploidy = true;
       }
 
-      if (!input_stream_->good() || version_string.substr(0, 3) != "sav")
+      const std::uint16_t major_version = (std::uint16_t(std::uint8_t(version_string[3])) << 8) | std::uint8_t(version_string[4]);
+      minor_version_ = (std::uint16_t(std::uint8_t(version_string[5])) << 8) | std::uint8_t(version_string[6]);
+
+      if (!input_stream_->good() || version_string.substr(0, 3) != "sav" || major_version != 1 || minor_version_ > latest_minor_version)
       {
         input_stream_->setstate(std::ios::badbit);
       }
@@ -147,12 +205,16 @@ namespace savvy
                       if (format_header.id == "GT")
                       {
                         file_data_format_ = fmt::gt;
+                        file_data_formats_.push_back(fmt::gt);
+                        file_bit_widths_.push_back(1);
                         if (parse_ploidy)
                           ploidy_ = atoi(format_header.number.c_str());
                       }
                       else if (format_header.id == "HDS")
                       {
                         file_data_format_ = fmt::hds;
+                        file_data_formats_.push_back(fmt::hds);
+                        file_bit_widths_.push_back(std::uint8_t(std::min(atoi(parse_header_sub_field(val, "BitWidth").c_str()), 0xFF))); // Checked in init_formats().
                         if (parse_ploidy)
                           ploidy_ = atoi(format_header.number.c_str());
                       }
@@ -194,7 +256,34 @@ namespace savvy
               }
 
               if (!sample_size)
-                return;
+              {
+                if (minor_version_ < 3)
+                  return;
+
+                if (minor_version_ >= 4)
+                {
+                  if (varint_decode(in_it, end, features_) == end || (features_ & ~supported_features))
+                  {
+                    input_stream_->setstate(std::ios::badbit);
+                    return;
+                  }
+                  ++in_it;
+                }
+
+                std::uint64_t dict_sz;
+                if (varint_decode(in_it, end, dict_sz) != end)
+                {
+                  // Nothing past the dictionary may be read until it's set, since the next frame depends on it.
+                  ++in_it;
+                  if (dict_sz == 0)
+                    return;
+
+                  dictionary_.resize(dict_sz);
+                  if (!input_stream_->read(dictionary_.data(), dict_sz) || !input_stream_->rdbuf()->set_dictionary(dictionary_.data(), dictionary_.size()))
+                    input_stream_->setstate(std::ios::badbit);
+                  return;
+                }
+              }
             }
           }
         }
@@ -203,6 +292,42 @@ namespace savvy
       }
     }
 
+    void reader_base::init_formats()
+    {
+      if (features_ & feature_multiple_formats)
+      {
+        // Every FORMAT entry is a stored field and the first one is the primary format.
+        std::vector<fmt> unique_formats(file_data_formats_);
+        std::sort(unique_formats.begin(), unique_formats.end());
+        if (file_data_formats_.size() < 2 || std::unique(unique_formats.begin(), unique_formats.end()) != unique_formats.end())
+          input_stream_->setstate(std::ios::badbit);
+        else
+          file_data_format_ = file_data_formats_.front();
+      }
+      else
+      {
+        // Without the feature, the last FORMAT entry describes the only field.
+        file_data_formats_.assign(1, file_data_format_);
+        file_bit_widths_.assign(1, file_bit_widths_.empty() ? std::uint8_t(1) : file_bit_widths_.back());
+      }
+
+      for (std::size_t i = 0; i < file_data_formats_.size(); ++i)
+      {
+        if (file_data_formats_[i] != fmt::hds)
+          file_bit_widths_[i] = 1;
+        else if (!(features_ & feature_dosage_bit_width))
+          file_bit_widths_[i] = 7;
+        else if (file_bit_widths_[i] < 1 || file_bit_widths_[i] > 7)
+          input_stream_->setstate(std::ios::badbit);
+      }
+
+      // Allele indices only fit in GT pair prefixes.
+      if ((features_ & feature_multiallelic) && (file_data_formats_.size() != 1 || file_data_format_ != fmt::gt))
+        input_stream_->setstate(std::ios::badbit);
+
+      pbwt_.resize(file_data_formats_.size());
+    }
+
     void reader_base::init_subset_map()
     {
       subset_map_.resize(samples().size());
@@ -218,9 +343,11 @@ namespace savvy
 
       subset_map_.clear();
       subset_map_.resize(sample_ids_.size(), std::numeric_limits<std::uint64_t>::max());
+      subset_counts_.resize(sample_ids_.size() + 1);
       std::uint64_t subset_index = 0;
       for (auto it = sample_ids_.begin(); it != sample_ids_.end(); ++it)
       {
+        subset_counts_[std::distance(sample_ids_.begin(), it)] = subset_index;
         if (subset.find(*it) != subset.end())
         {
           subset_map_[std::distance(sample_ids_.begin(), it)] = subset_index;
@@ -228,6 +355,7 @@ namespace savvy
           ++subset_index;
         }
       }
+      subset_counts_.back() = subset_index;
 
       subset_size_ = subset_index;
 
@@ -239,14 +367,33 @@ namespace savvy
     const std::array<std::string, 0> writer::empty_string_array = {};
     const std::array<std::pair<std::string, std::string>, 0> writer::empty_string_pair_array = {};
 
-    std::unique_ptr<std::streambuf> writer::create_out_streambuf(const std::string& file_path, std::int8_t compression_level)
+    std::unique_ptr<std::streambuf> writer::create_out_streambuf(const std::string& file_path, std::int8_t compression_level, std::size_t compression_threads)
     {
       if (compression_level > 0)
-        return std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path, compression_level));
+        return std::unique_ptr<std::streambuf>(new ::savvy::detail::zstd_obuf(file_path, compression_level, compression_threads));
       else
         return std::unique_ptr<std::streambuf>(create_std_filebuf(file_path, std::ios::binary | std::ios::out));
     }
 
+    void writer::end_dictionary_training()
+    {
+      dictionary_ = ::savvy::detail::train_zstd_dictionary(dictionary_samples_, dictionary_sample_sizes_, dictionary_max_size_);
+      dictionary_training_records_ = 0;
+      write_dictionary(); // Training can fail (e.g., too few records), in which case the dictionary is empty.
+
+      const char* data = dictionary_samples_.data();
+      for (std::size_t i = 0; i < dictionary_sample_sites_.size(); ++i)
+      {
+        write_record(dictionary_sample_sites_[i], data, dictionary_sample_site_sizes_[i], dictionary_sample_sizes_[i]);
+        data += dictionary_sample_sizes_[i];
+      }
+
+      std::vector<char>().swap(dictionary_samples_);
+      std::vector<std::size_t>().swap(dictionary_sample_sizes_);
+      std::vector<std::size_t>().swap(dictionary_sample_site_sizes_);
+      std::vector<site_info>().swap(dictionary_sample_sites_);
+    }
+
     bool writer::create_index(const std::string& input_file_path, std::string output_file_path)
     {
       bool ret = false;
@@ -264,12 +411,15 @@ namespace savvy
       std::map<std::string, std::vector<s1r::entry>> index_data;
 
       site_info variant;
-      savvy::compressed_vector<float> variant_data;
 
       std::size_t records_in_block = 0;
       std::string current_chromosome;
-      while (r.read(variant, variant_data) && start_pos >= 0)
+      while (r.read_site_info(variant) && start_pos >= 0)
       {
+        // Every genotype block of the record (one per FORMAT field) has to be passed before
+        // tellg() can tell whether the next record starts a new frame.
+        r.discard_genotypes();
+
         if (records_in_block > 0 && variant.chromosome() != current_chromosome)
         {
           // TODO: Possibly make this an error case.
@@ -278,11 +278,26 @@ namespace savvy
           }
         }
 
+        std::string alt;
+        if (allele_index)
+        {
+          alt = rec_->n_allele > 1 ? rec_->d.allele[allele_index] : "";
+        }
+        else
+        {
+          for (std::size_t i = 1; i < rec_->n_allele; ++i)
+          {
+            if (i > 1)
+              alt += ",";
+            alt += rec_->d.allele[i];
+          }
+        }
+
         return site_info(
           std::string(bcf_hdr_id2name(hdr_, rec_->rid)),
           static_cast<std::uint64_t>(rec_->pos + 1),
           std::string(rec_->d.allele[0]),
-          std::string(rec_->n_allele > 1 ? rec_->d.allele[allele_index] : ""),
+          std::move(alt),
           std::move(props));
       }
     protected:
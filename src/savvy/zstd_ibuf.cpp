@@ -0,0 +1,557 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "savvy/zstd_ibuf.hpp"
+
+#include <zstd.h>
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SAVVY_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace savvy
+{
+  namespace detail
+  {
+    zstd_ibuf::zstd_ibuf(const std::string& file_path, std::size_t read_ahead_depth, bool memory_map) :
+      zstd_context_(ZSTD_createDStream()),
+      dictionary_(nullptr),
+      compressed_data_(nullptr),
+      compressed_pos_(0),
+      compressed_end_(0),
+      compressed_buffer_offset_(0),
+      frame_buffer_(ZSTD_DStreamOutSize()),
+      frame_offset_(0),
+      next_frame_offset_(0),
+      frame_done_(true),
+      error_(false),
+      read_ahead_depth_(read_ahead_depth),
+      worker_offset_(0),
+      stop_worker_(false),
+      worker_done_(true),
+      worker_error_(false),
+      mapped_data_(nullptr),
+      mapped_size_(0),
+      memory_mapped_(false)
+    {
+#ifdef SAVVY_HAVE_MMAP
+      if (memory_map)
+      {
+        int fd = ::open(file_path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && ::fstat(fd, &st) == 0)
+        {
+          memory_mapped_ = true;
+          mapped_size_ = std::size_t(st.st_size);
+          if (mapped_size_)
+          {
+            void* addr = ::mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED)
+              error_ = true;
+            else
+              mapped_data_ = static_cast<const char*>(addr);
+          }
+        }
+        else
+        {
+          error_ = true;
+        }
+
+        if (fd >= 0)
+          ::close(fd);
+      }
+#endif
+
+      if (!memory_mapped_)
+      {
+        compressed_buffer_.resize(ZSTD_DStreamInSize());
+        compressed_data_ = compressed_buffer_.data();
+        compressed_file_.open(file_path.c_str(), std::ios::binary | std::ios::in);
+        if (!compressed_file_.is_open())
+          error_ = true;
+      }
+
+      if (!zstd_context_ || ZSTD_isError(ZSTD_initDStream(zstd_context_)))
+        error_ = true;
+      setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+
+      if (read_ahead_depth_ && !error_)
+        start_read_ahead();
+    }
+
+    zstd_ibuf::~zstd_ibuf()
+    {
+      stop_read_ahead();
+      if (zstd_context_)
+        ZSTD_freeDStream(zstd_context_);
+      if (dictionary_)
+        ZSTD_freeDDict(dictionary_);
+#ifdef SAVVY_HAVE_MMAP
+      if (mapped_data_)
+        ::munmap(const_cast<char*>(mapped_data_), mapped_size_);
+#endif
+    }
+
+    std::size_t zstd_ibuf::read_compressed()
+    {
+      compressed_buffer_offset_ += compressed_end_;
+      compressed_pos_ = 0;
+      if (memory_mapped_)
+      {
+        // The whole remainder of the mapping is handed to zstd at once.
+        std::uint64_t offset = std::min(compressed_buffer_offset_, std::uint64_t(mapped_size_));
+        compressed_data_ = mapped_data_ + offset;
+        compressed_end_ = std::size_t(mapped_size_ - offset);
+      }
+      else
+      {
+        compressed_end_ = std::size_t(std::max(std::streamsize(0), compressed_file_.sgetn(compressed_buffer_.data(), compressed_buffer_.size())));
+      }
+      return compressed_end_;
+    }
+
+    std::size_t zstd_ibuf::replenish(std::size_t min_bytes)
+    {
+      std::size_t avail = std::size_t(egptr() - gptr());
+
+      if (read_ahead_depth_)
+      {
+        // Frames are fully decompressed by the worker, so nothing more is available until the current one is used up.
+        if (avail == 0 && !error_)
+          return next_ready_frame();
+        return avail;
+      }
+
+      if (avail == 0 && frame_done_)
+      {
+        // Current frame is exhausted, so the get area moves on to the next one.
+        frame_offset_ = next_frame_offset_;
+        frame_done_ = false;
+      }
+      else if (avail && gptr() != frame_buffer_.data())
+      {
+        std::memmove(frame_buffer_.data(), gptr(), avail);
+      }
+
+      if (frame_buffer_.size() < min_bytes)
+        frame_buffer_.resize(std::max(min_bytes, frame_buffer_.size() * 2));
+
+      while (!frame_done_ && !error_)
+      {
+        if (compressed_pos_ == compressed_end_)
+        {
+          if (avail >= min_bytes)
+            break; // Don't block on file reads once the request is satisfied.
+
+          if (read_compressed() == 0)
+          {
+            if (avail || compressed_buffer_offset_ != frame_offset_) // Truncated frame.
+              error_ = true;
+            else
+              frame_done_ = true; // End of file
+            break;
+          }
+        }
+
+        if (avail == frame_buffer_.size())
+        {
+          if (avail >= min_bytes)
+            break;
+          frame_buffer_.resize(frame_buffer_.size() * 2);
+        }
+
+        ZSTD_outBuffer output = {frame_buffer_.data(), frame_buffer_.size(), avail};
+        ZSTD_inBuffer input = {compressed_data_, compressed_end_, compressed_pos_};
+        std::size_t ret = ZSTD_decompressStream(zstd_context_, &output, &input);
+        compressed_pos_ = input.pos;
+        avail = output.pos;
+
+        if (ZSTD_isError(ret))
+        {
+          error_ = true;
+        }
+        else if (ret == 0)
+        {
+          frame_done_ = true;
+          next_frame_offset_ = compressed_buffer_offset_ + compressed_pos_;
+          if (avail == 0)
+          {
+            // Empty frame. Skip to the next one.
+            frame_offset_ = next_frame_offset_;
+            frame_done_ = false;
+          }
+        }
+      }
+
+      setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data() + avail);
+      return avail;
+    }
+
+    zstd_ibuf::int_type zstd_ibuf::underflow()
+    {
+      if (gptr() < egptr() || replenish(1))
+        return traits_type::to_int_type(*gptr());
+      return traits_type::eof();
+    }
+
+    zstd_ibuf::pos_type zstd_ibuf::seekoff(off_type off, std::ios::seekdir way, std::ios::openmode which)
+    {
+      if (off == 0 && way == std::ios::cur && (which & std::ios::in) && !error_)
+      {
+        if (gptr() == egptr() && frame_done_)
+          return pos_type(off_type(next_frame_offset_));
+        return pos_type(off_type(frame_offset_));
+      }
+      return pos_type(off_type(-1));
+    }
+
+    zstd_ibuf::pos_type zstd_ibuf::seekpos(pos_type pos, std::ios::openmode which)
+    {
+      if (!(which & std::ios::in))
+      {
+        error_ = true;
+        return pos_type(off_type(-1));
+      }
+
+      std::uint64_t target = std::uint64_t(off_type(pos));
+
+      if (read_ahead_depth_)
+      {
+        bool hit = false;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          while (true)
+          {
+            while (!ready_frames_.empty() && ready_frames_.front().offset < target)
+            {
+              free_buffers_.emplace_back(std::move(ready_frames_.front().data));
+              ready_frames_.pop_front();
+            }
+
+            if (!ready_frames_.empty())
+            {
+              hit = ready_frames_.front().offset == target;
+              break;
+            }
+
+            if (worker_done_ || worker_offset_ != target)
+              break;
+
+            // Worker is currently decompressing the requested frame.
+            frame_ready_.wait(lock);
+          }
+        }
+        slot_free_.notify_one();
+
+        if (!hit)
+        {
+          stop_read_ahead();
+          if (!reset_input(target))
+            return pos_type(off_type(-1));
+          start_read_ahead();
+        }
+
+        error_ = false;
+        frame_offset_ = target;
+        next_frame_offset_ = target;
+        frame_done_ = true;
+        setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+        return pos;
+      }
+
+      if (gptr() == egptr() && frame_done_ && next_frame_offset_ == target && !error_)
+      {
+        // Already positioned at the start of the requested frame.
+        frame_offset_ = target;
+        return pos;
+      }
+
+      if (!reset_input(target))
+        return pos_type(off_type(-1));
+
+      error_ = false;
+      frame_offset_ = target;
+      next_frame_offset_ = target;
+      frame_done_ = true;
+      setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+      return pos;
+    }
+
+    bool zstd_ibuf::reset_input(std::uint64_t pos)
+    {
+      bool seek_failed = memory_mapped_ ? pos > mapped_size_ : compressed_file_.pubseekpos(pos_type(off_type(pos)), std::ios::in) == pos_type(off_type(-1));
+      // ZSTD_initDStream() drops any referenced dictionary, so it has to be referenced again.
+      if (seek_failed || ZSTD_isError(ZSTD_initDStream(zstd_context_)) || (dictionary_ && ZSTD_isError(ZSTD_DCtx_refDDict(zstd_context_, dictionary_))))
+      {
+        error_ = true;
+        return false;
+      }
+
+      compressed_pos_ = 0;
+      compressed_end_ = 0;
+      compressed_buffer_offset_ = pos;
+      return true;
+    }
+
+    bool zstd_ibuf::set_dictionary(const char* data, std::size_t size)
+    {
+      if (gptr() != egptr() || error_)
+        return false;
+
+      if (read_ahead_depth_)
+      {
+        // Frames after the current one were decompressed without the dictionary, so they're discarded.
+        stop_read_ahead();
+      }
+      else if (!finish_frame())
+      {
+        return false;
+      }
+
+      if (dictionary_)
+        ZSTD_freeDDict(dictionary_);
+      dictionary_ = size ? ZSTD_createDDict(data, size) : nullptr;
+      if (size && !dictionary_)
+        return false;
+
+      const std::uint64_t next_offset = next_frame_offset_;
+      if (!reset_input(next_offset))
+        return false;
+
+      frame_offset_ = next_offset;
+      next_frame_offset_ = next_offset;
+      frame_done_ = true;
+      setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+
+      if (read_ahead_depth_)
+        start_read_ahead();
+      return true;
+    }
+
+    bool zstd_ibuf::finish_frame()
+    {
+      if (gptr() != egptr() || error_)
+        return false;
+
+      // Frames from the read-ahead thread are always complete.
+      while (!frame_done_ && !read_ahead_depth_)
+      {
+        if (compressed_pos_ == compressed_end_ && read_compressed() == 0)
+          return false;
+
+        ZSTD_outBuffer output = {frame_buffer_.data(), frame_buffer_.size(), 0};
+        ZSTD_inBuffer input = {compressed_data_, compressed_end_, compressed_pos_};
+        std::size_t ret = ZSTD_decompressStream(zstd_context_, &output, &input);
+        compressed_pos_ = input.pos;
+        if (ZSTD_isError(ret) || output.pos)
+          return false;
+
+        if (ret == 0)
+        {
+          frame_done_ = true;
+          next_frame_offset_ = compressed_buffer_offset_ + compressed_pos_;
+        }
+      }
+      return true;
+    }
+
+    bool zstd_ibuf::skip_frame()
+    {
+      if (gptr() != egptr() || !frame_done_ || error_)
+        return false;
+
+      if (read_ahead_depth_)
+      {
+        // The worker decompresses every frame anyway, so the next one is just dropped.
+        if (next_ready_frame() == 0)
+          return false;
+        setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+        return true;
+      }
+
+      while (true)
+      {
+        std::size_t ret = ZSTD_findFrameCompressedSize(compressed_data_ + compressed_pos_, compressed_end_ - compressed_pos_);
+        if (!ZSTD_isError(ret))
+        {
+          compressed_pos_ += ret;
+          frame_offset_ = compressed_buffer_offset_ + compressed_pos_;
+          next_frame_offset_ = frame_offset_;
+          return true;
+        }
+
+        // The frame isn't entirely in the compressed buffer yet.
+        if (memory_mapped_)
+        {
+          if (compressed_pos_ != compressed_end_ || read_compressed() == 0)
+            return false;
+        }
+        else
+        {
+          const std::size_t unread = compressed_end_ - compressed_pos_;
+          std::memmove(compressed_buffer_.data(), compressed_buffer_.data() + compressed_pos_, unread);
+          compressed_buffer_offset_ += compressed_pos_;
+          compressed_pos_ = 0;
+          compressed_end_ = unread;
+          if (compressed_end_ == compressed_buffer_.size())
+            compressed_buffer_.resize(compressed_buffer_.size() * 2);
+          compressed_data_ = compressed_buffer_.data();
+
+          std::streamsize cnt = compressed_file_.sgetn(compressed_buffer_.data() + compressed_end_, std::streamsize(compressed_buffer_.size() - compressed_end_));
+          if (cnt <= 0)
+            return false;
+          compressed_end_ += std::size_t(cnt);
+        }
+      }
+    }
+
+    bool zstd_ibuf::decompress_frame(frame& f, bool& error)
+    {
+      f.offset = compressed_buffer_offset_ + compressed_pos_;
+      f.size = 0;
+      if (f.data.empty())
+        f.data.resize(ZSTD_DStreamOutSize());
+
+      while (true)
+      {
+        if (compressed_pos_ == compressed_end_)
+        {
+          if (read_compressed() == 0)
+          {
+            error = f.size || compressed_buffer_offset_ != f.offset; // Truncated frame.
+            return false;
+          }
+        }
+
+        if (f.size == f.data.size())
+          f.data.resize(f.data.size() * 2);
+
+        ZSTD_outBuffer output = {f.data.data(), f.data.size(), f.size};
+        ZSTD_inBuffer input = {compressed_data_, compressed_end_, compressed_pos_};
+        std::size_t ret = ZSTD_decompressStream(zstd_context_, &output, &input);
+        compressed_pos_ = input.pos;
+        f.size = output.pos;
+
+        if (ZSTD_isError(ret))
+        {
+          error = true;
+          return false;
+        }
+
+        if (ret == 0)
+        {
+          f.next_offset = compressed_buffer_offset_ + compressed_pos_;
+          if (f.size)
+            return true;
+          f.offset = f.next_offset; // Empty frame. Skip to the next one.
+        }
+      }
+    }
+
+    void zstd_ibuf::read_ahead()
+    {
+      while (true)
+      {
+        frame f;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          slot_free_.wait(lock, [this]() { return stop_worker_ || ready_frames_.size() < read_ahead_depth_; });
+          if (stop_worker_)
+            return;
+          if (!free_buffers_.empty())
+          {
+            f.data.swap(free_buffers_.back());
+            free_buffers_.pop_back();
+          }
+          worker_offset_ = compressed_buffer_offset_ + compressed_pos_;
+        }
+
+        bool error = false;
+        bool success = decompress_frame(f, error);
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (success)
+          {
+            worker_offset_ = f.next_offset;
+            ready_frames_.emplace_back(std::move(f));
+          }
+          else
+          {
+            worker_done_ = true;
+            worker_error_ = error;
+          }
+        }
+        frame_ready_.notify_one();
+
+        if (!success)
+          return;
+      }
+    }
+
+    std::size_t zstd_ibuf::next_ready_frame()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      frame_ready_.wait(lock, [this]() { return !ready_frames_.empty() || worker_done_; });
+
+      if (ready_frames_.empty())
+      {
+        error_ = worker_error_;
+        frame_offset_ = next_frame_offset_;
+        setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data());
+        return 0;
+      }
+
+      frame& f = ready_frames_.front();
+      frame_buffer_.swap(f.data);
+      free_buffers_.emplace_back(std::move(f.data)); // Hand the previous frame's buffer back to the worker.
+      frame_offset_ = f.offset;
+      next_frame_offset_ = f.next_offset;
+      frame_done_ = true;
+      std::size_t sz = f.size;
+      ready_frames_.pop_front();
+      lock.unlock();
+      slot_free_.notify_one();
+
+      setg(frame_buffer_.data(), frame_buffer_.data(), frame_buffer_.data() + sz);
+      return sz;
+    }
+
+    void zstd_ibuf::start_read_ahead()
+    {
+      stop_worker_ = false;
+      worker_done_ = false;
+      worker_error_ = false;
+      worker_offset_ = compressed_buffer_offset_ + compressed_pos_;
+      worker_ = std::thread(&zstd_ibuf::read_ahead, this);
+    }
+
+    void zstd_ibuf::stop_read_ahead()
+    {
+      if (!worker_.joinable())
+        return;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_worker_ = true;
+      }
+      slot_free_.notify_one();
+      worker_.join();
+      worker_done_ = true;
+
+      for (auto it = ready_frames_.begin(); it != ready_frames_.end(); ++it)
+        free_buffers_.emplace_back(std::move(it->data));
+      ready_frames_.clear();
+    }
+  }
+}
@@ -0,0 +1,353 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "savvy/zstd_obuf.hpp"
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+namespace savvy
+{
+  namespace detail
+  {
+    zstd_obuf::zstd_obuf(const std::string& file_path, int compression_level, std::size_t compression_threads) :
+      zstd_context_(compression_threads ? nullptr : ZSTD_createCCtx()),
+      dictionary_(nullptr),
+      compression_level_(compression_level),
+      frame_buffer_(ZSTD_CStreamInSize()),
+      stream_buffer_(compression_threads ? 0 : ZSTD_CStreamOutSize()),
+      file_offset_(0),
+      frame_compressed_size_(0),
+      frame_started_(false),
+      error_(false),
+      max_pending_frames_(2 * compression_threads),
+      stop_workers_(false)
+    {
+      file_.open(file_path.c_str(), std::ios::binary | std::ios::out);
+      if (!file_.is_open() || (!compression_threads && !zstd_context_))
+        error_ = true;
+      else if (zstd_context_ && ZSTD_isError(ZSTD_CCtx_setParameter(zstd_context_, ZSTD_c_compressionLevel, compression_level)))
+        error_ = true;
+
+      setp(frame_buffer_.data(), frame_buffer_.data() + frame_buffer_.size());
+
+      if (!error_)
+      {
+        workers_.reserve(compression_threads);
+        for (std::size_t i = 0; i < compression_threads; ++i)
+          workers_.emplace_back(&zstd_obuf::compress_worker, this);
+      }
+    }
+
+    zstd_obuf::~zstd_obuf()
+    {
+      sync();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_workers_ = true;
+      }
+      job_ready_.notify_all();
+      for (auto it = workers_.begin(); it != workers_.end(); ++it)
+        it->join();
+
+      if (zstd_context_)
+        ZSTD_freeCCtx(zstd_context_);
+      if (dictionary_)
+        ZSTD_freeCDict(dictionary_);
+    }
+
+    bool zstd_obuf::set_dictionary(const char* data, std::size_t size)
+    {
+      // Frames already handed to the compressor may still reference the previous dictionary.
+      write_frames(true);
+      if (frame_started_)
+        return false;
+      if (dictionary_)
+        ZSTD_freeCDict(dictionary_);
+      dictionary_ = nullptr;
+
+      if (size)
+      {
+        dictionary_ = ZSTD_createCDict(data, size, compression_level_);
+        if (!dictionary_)
+          return false;
+      }
+      return true;
+    }
+
+    void zstd_obuf::reserve_put_area(std::size_t min_free)
+    {
+      std::size_t used = std::size_t(pptr() - pbase());
+      if (frame_buffer_.size() - used < min_free)
+      {
+        frame_buffer_.resize(std::max(used + min_free, frame_buffer_.size() * 2));
+        setp(frame_buffer_.data(), frame_buffer_.data() + frame_buffer_.size());
+        bump_put_pointer(used);
+      }
+    }
+
+    void zstd_obuf::bump_put_pointer(std::size_t n)
+    {
+      // pbump() takes an int, but a buffered frame can exceed 2 GiB (e.g., block_size 0 or very many samples).
+      const std::size_t max_step = std::size_t(std::numeric_limits<int>::max());
+      for (; n > max_step; n -= max_step)
+        pbump(int(max_step));
+      pbump(int(n));
+    }
+
+    bool zstd_obuf::stream_put_area(bool end)
+    {
+      const std::size_t size = std::size_t(pptr() - pbase());
+      setp(frame_buffer_.data(), frame_buffer_.data() + frame_buffer_.size());
+      if (error_)
+        return false;
+
+      if (!frame_started_)
+      {
+        if (size == 0)
+          return true;
+        // The dictionary is bound once per frame, so set_dictionary() only takes effect between frames.
+        if (ZSTD_isError(ZSTD_CCtx_refCDict(zstd_context_, dictionary_)))
+        {
+          error_ = true;
+          return false;
+        }
+        frame_started_ = true;
+      }
+
+      ZSTD_inBuffer in = {frame_buffer_.data(), size, 0};
+      std::size_t remaining = 0;
+      do
+      {
+        ZSTD_outBuffer out = {stream_buffer_.data(), stream_buffer_.size(), 0};
+        remaining = ZSTD_compressStream2(zstd_context_, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(remaining) || file_.sputn(stream_buffer_.data(), std::streamsize(out.pos)) != std::streamsize(out.pos))
+        {
+          error_ = true;
+          return false;
+        }
+        frame_compressed_size_ += out.pos;
+      } while (in.pos < in.size || (end && remaining));
+
+      if (end)
+        frame_started_ = false;
+      return true;
+    }
+
+    zstd_obuf::int_type zstd_obuf::overflow(int_type c)
+    {
+      if (error_)
+        return traits_type::eof();
+
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+        if (!workers_.empty())
+          reserve_put_area(1);
+        else if (pptr() == epptr() && !stream_put_area(false))
+          return traits_type::eof();
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize zstd_obuf::xsputn(const char* s, std::streamsize n)
+    {
+      if (error_)
+        return 0;
+
+      if (workers_.empty())
+      {
+        std::streamsize written = 0;
+        while (written < n)
+        {
+          if (pptr() == epptr() && !stream_put_area(false))
+            break;
+          std::size_t sz = std::min(std::size_t(n - written), std::size_t(epptr() - pptr()));
+          std::memcpy(pptr(), s + written, sz);
+          pbump(int(sz)); // Bounded by the fixed put area.
+          written += std::streamsize(sz);
+        }
+        return written;
+      }
+
+      reserve_put_area(std::size_t(n));
+      std::memcpy(pptr(), s, std::size_t(n));
+      bump_put_pointer(std::size_t(n));
+      return n;
+    }
+
+    bool zstd_obuf::end_frame(frame_callback on_written)
+    {
+      if (workers_.empty())
+      {
+        // Frames are streamed in file order, so the offset of this one is already known.
+        stream_put_area(true);
+        if (!error_ && on_written)
+          on_written(file_offset_);
+        file_offset_ += frame_compressed_size_;
+        frame_compressed_size_ = 0;
+        return !error_;
+      }
+
+      std::unique_ptr<frame> f;
+      if (free_frames_.empty())
+      {
+        f.reset(new frame());
+      }
+      else
+      {
+        f = std::move(free_frames_.back());
+        free_frames_.pop_back();
+      }
+
+      // The frame takes the put area and leaves its (recycled) buffer in its place.
+      f->size = std::size_t(pptr() - pbase());
+      f->data.swap(frame_buffer_);
+      if (frame_buffer_.size() < f->data.size())
+        frame_buffer_.resize(f->data.size());
+      setp(frame_buffer_.data(), frame_buffer_.data() + frame_buffer_.size());
+
+      f->compressed_size = 0;
+      f->on_written = std::move(on_written);
+      f->dictionary = dictionary_;
+      f->done = f->size == 0 || error_;
+      f->error = false;
+
+      frame* job = f.get();
+      const bool queue = !f->done;
+      pending_frames_.emplace_back(std::move(f));
+      if (queue)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          jobs_.push_back(job);
+        }
+        job_ready_.notify_one();
+      }
+
+      write_frames(false);
+      return !error_;
+    }
+
+    bool zstd_obuf::compress_frame(ZSTD_CCtx_s* ctx, frame& f)
+    {
+      if (!ctx)
+        return false;
+
+      f.compressed.resize(std::max(f.compressed.size(), ZSTD_compressBound(f.size)));
+      std::size_t ret = f.dictionary
+        ? ZSTD_compress_usingCDict(ctx, f.compressed.data(), f.compressed.size(), f.data.data(), f.size, f.dictionary)
+        : ZSTD_compressCCtx(ctx, f.compressed.data(), f.compressed.size(), f.data.data(), f.size, compression_level_);
+      if (ZSTD_isError(ret))
+        return false;
+      f.compressed_size = ret;
+      return true;
+    }
+
+    void zstd_obuf::write_frames(bool wait_all)
+    {
+      while (!pending_frames_.empty())
+      {
+        frame& f = *pending_frames_.front();
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          if (!f.done)
+          {
+            if (!wait_all && pending_frames_.size() <= max_pending_frames_)
+              return;
+            frame_done_.wait(lock, [&f]() { return f.done; });
+          }
+        }
+
+        if (f.error)
+          error_ = true;
+
+        if (!error_ && f.compressed_size)
+        {
+          if (file_.sputn(f.compressed.data(), std::streamsize(f.compressed_size)) != std::streamsize(f.compressed_size))
+            error_ = true;
+        }
+
+        if (!error_ && f.on_written)
+          f.on_written(file_offset_);
+        file_offset_ += f.compressed_size;
+
+        f.on_written = frame_callback();
+        free_frames_.emplace_back(std::move(pending_frames_.front()));
+        pending_frames_.pop_front();
+      }
+    }
+
+    void zstd_obuf::compress_worker()
+    {
+      ZSTD_CCtx* ctx = ZSTD_createCCtx();
+      while (true)
+      {
+        frame* f;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          job_ready_.wait(lock, [this]() { return stop_workers_ || !jobs_.empty(); });
+          if (jobs_.empty())
+            break;
+          f = jobs_.front();
+          jobs_.pop_front();
+        }
+
+        bool error = !compress_frame(ctx, *f);
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          f->error = error;
+          f->done = true;
+        }
+        frame_done_.notify_all();
+      }
+
+      if (ctx)
+        ZSTD_freeCCtx(ctx);
+    }
+
+    int zstd_obuf::sync()
+    {
+      if (pptr() != pbase() || frame_started_)
+        end_frame();
+      write_frames(true);
+      if (file_.pubsync() != 0)
+        error_ = true;
+      return error_ ? -1 : 0;
+    }
+
+    zstd_obuf::pos_type zstd_obuf::seekoff(off_type off, std::ios::seekdir way, std::ios::openmode which)
+    {
+      if (off == 0 && way == std::ios::cur && (which & std::ios::out) && !error_)
+      {
+        // Offset at which the current (unfinished) frame will start.
+        write_frames(true);
+        return pos_type(off_type(file_offset_));
+      }
+      return pos_type(off_type(-1));
+    }
+
+    std::vector<char> train_zstd_dictionary(const std::vector<char>& samples, const std::vector<std::size_t>& sample_sizes, std::size_t max_size)
+    {
+      std::vector<char> ret(max_size);
+      std::size_t sz = 0;
+      if (!sample_sizes.empty() && max_size)
+        sz = ZDICT_trainFromBuffer(ret.data(), ret.size(), samples.data(), sample_sizes.data(), unsigned(sample_sizes.size()));
+
+      if (sample_sizes.empty() || !max_size || ZDICT_isError(sz))
+        sz = 0;
+      ret.resize(sz);
+      return ret;
+    }
+  }
+}
@@ -0,0 +1,335 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "savvy/sav_reader.hpp"
+#include "savvy/site_info.hpp"
+#include "savvy/varint.hpp"
+#include "savvy/zstd_ibuf.hpp"
+#include "savvy/allele_pair_array.hpp"
+
+#include <shrinkwrap/zstd.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Compares decoding allele pair arrays through std::istreambuf_iterator, straight from the
+// frame buffer as the reader does, and into prefix and offset arrays first. Offsets are drawn
+// from [0, max_offset], so a max_offset of 63 or less only produces one byte pairs.
+int decode_speed_test(const std::string& path, std::uint64_t max_offset)
+{
+  const std::size_t num_haps = 200000;
+  const std::size_t num_records = 2000;
+  const std::size_t records_per_frame = 256;
+  std::uint64_t expected_sum = 0;
+
+  {
+    std::mt19937_64 rng(0);
+    std::uniform_int_distribution<std::uint64_t> offset_dist(0, max_offset);
+    shrinkwrap::zstd::obuf compressed_buf(path);
+    std::ostream compressed_ostream(&compressed_buf);
+    std::ostreambuf_iterator<char> output_it(compressed_ostream);
+    for (std::size_t r = 0; r < num_records; ++r)
+    {
+      std::vector<std::uint64_t> offsets;
+      for (std::uint64_t pos = offset_dist(rng); pos < num_haps; pos += offset_dist(rng) + 1)
+        offsets.push_back(pos);
+
+      savvy::varint_encode(offsets.size(), output_it);
+      std::uint64_t last_pos = 0;
+      for (auto it = offsets.begin(); it != offsets.end(); ++it)
+      {
+        savvy::prefixed_varint<1>::encode(1, *it - last_pos, output_it);
+        last_pos = *it + 1;
+        expected_sum += *it;
+      }
+
+      if ((r + 1) % records_per_frame == 0)
+        compressed_ostream.flush();
+    }
+  }
+  std::cout << "Expected: " << expected_sum << std::endl;
+
+  {
+    shrinkwrap::zstd::istream compressed_istream(path);
+    std::istreambuf_iterator<char> in_it(compressed_istream);
+    std::istreambuf_iterator<char> end_it;
+    std::uint64_t sum = 0;
+    const auto decode_start = std::chrono::high_resolution_clock::now();
+    for (std::size_t r = 0; r < num_records; ++r)
+    {
+      std::uint64_t sz;
+      in_it = ++savvy::varint_decode(in_it, end_it, sz);
+      std::uint64_t total_offset = 0;
+      for (std::size_t i = 0; i < sz; ++i, ++total_offset)
+      {
+        float allele;
+        std::uint64_t offset;
+        std::tie(allele, offset) = savvy::sav::detail::allele_decoder<1>::decode(in_it, end_it, std::numeric_limits<float>::quiet_NaN());
+        ++in_it;
+        total_offset += offset;
+        sum += total_offset;
+      }
+    }
+    auto decode_elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - decode_start).count();
+    std::cout << "istreambuf_iterator: " << sum << std::endl;
+    std::cout << "Decode elapsed time: " << decode_elapsed_time << "ms" << std::endl;
+    std::cout << std::endl;
+    if (sum != expected_sum)
+      return EXIT_FAILURE;
+  }
+
+  {
+    savvy::detail::zstd_ibuf compressed_buf(path);
+    std::uint64_t sum = 0;
+    const auto decode_start = std::chrono::high_resolution_clock::now();
+    for (std::size_t r = 0; r < num_records; ++r)
+    {
+      std::uint64_t sz;
+      compressed_buf.fill(10);
+      const char* in_it = savvy::varint_decode(compressed_buf.data(), compressed_buf.data_end(), sz);
+      compressed_buf.consume(++in_it);
+      compressed_buf.fill(sz * savvy::prefixed_varint<1>::encoded_byte_width(num_haps));
+      savvy::sav::detail::allele_pair_cursor<1> pairs;
+      pairs.stream(compressed_buf.data(), compressed_buf.data_end(), sz, num_haps);
+      std::uint8_t prefix;
+      std::uint64_t offset;
+      while (pairs.next(prefix, offset))
+        sum += offset;
+      if (!pairs.done())
+        return EXIT_FAILURE;
+      compressed_buf.consume(pairs.position());
+    }
+    auto decode_elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - decode_start).count();
+    std::cout << "Frame buffer: " << sum << std::endl;
+    std::cout << "Decode elapsed time: " << decode_elapsed_time << "ms" << std::endl;
+    if (sum != expected_sum)
+      return EXIT_FAILURE;
+  }
+
+  {
+    savvy::detail::zstd_ibuf compressed_buf(path);
+    std::vector<std::uint8_t> prefixes(num_haps);
+    std::vector<std::uint64_t> offsets(num_haps);
+    std::uint64_t sum = 0;
+    const auto decode_start = std::chrono::high_resolution_clock::now();
+    for (std::size_t r = 0; r < num_records; ++r)
+    {
+      std::uint64_t sz;
+      compressed_buf.fill(10);
+      const char* in_it = savvy::varint_decode(compressed_buf.data(), compressed_buf.data_end(), sz);
+      compressed_buf.consume(++in_it);
+      compressed_buf.fill(sz * savvy::prefixed_varint<1>::encoded_byte_width(num_haps));
+      in_it = compressed_buf.data();
+      if (savvy::sav::detail::decode_allele_pair_array<1>(in_it, compressed_buf.data_end(), sz, prefixes.data(), offsets.data()) != sz)
+        return EXIT_FAILURE;
+      compressed_buf.consume(in_it);
+      for (std::size_t i = 0; i < sz; ++i)
+        sum += offsets[i];
+    }
+    auto decode_elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - decode_start).count();
+    std::cout << std::endl;
+    std::cout << "Pair arrays: " << sum << std::endl;
+    std::cout << "Decode elapsed time: " << decode_elapsed_time << "ms" << std::endl;
+    if (sum != expected_sum)
+      return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Reads the records of a SAV 1.0 file the way reader_base did before records were decoded from
+// the frame buffer: every VLI, string and allele pair goes through the std::istream. Site fields
+// are collected in a new site_info as they were then. Expects a header ploidy and GT records.
+class istreambuf_record_reader
+{
+public:
+  istreambuf_record_reader(const std::string& path, std::streampos first_record, std::size_t info_field_count, std::size_t num_haps) :
+    input_stream_(path),
+    info_fields_(info_field_count),
+    num_haps_(num_haps)
+  {
+    input_stream_.seekg(first_record);
+    for (std::size_t i = 0; i < info_field_count; ++i)
+      info_fields_[i] = "INFO" + std::to_string(i);
+  }
+
+  /**
+   * @return false at the end of the file or if the file is truncated.
+   */
+  template <typename T>
+  bool read(savvy::site_info& annotations, T& destination)
+  {
+    std::istreambuf_iterator<char> in_it(input_stream_);
+    std::istreambuf_iterator<char> end_it;
+    if (in_it == end_it)
+      return false;
+
+    std::uint64_t sz;
+    std::string strings[3];
+    std::uint64_t locus = 0;
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+      if (savvy::varint_decode(in_it, end_it, sz) == end_it)
+        return false;
+      ++in_it;
+      strings[i].resize(sz);
+      if (sz)
+        input_stream_.read(&strings[i][0], sz);
+      if (i == 0)
+      {
+        if (savvy::varint_decode(in_it, end_it, locus) == end_it)
+          return false;
+        ++in_it;
+      }
+    }
+
+    std::unordered_map<std::string, std::string> props;
+    props.reserve(info_fields_.size());
+    std::string prop_val;
+    for (const std::string& key : info_fields_)
+    {
+      if (savvy::varint_decode(in_it, end_it, sz) == end_it)
+        return false;
+      ++in_it;
+      if (sz)
+      {
+        prop_val.resize(sz);
+        input_stream_.read(&prop_val[0], sz);
+        props[key] = prop_val;
+      }
+    }
+    annotations = savvy::site_info(std::move(strings[0]), locus, std::move(strings[1]), std::move(strings[2]), std::move(props));
+
+    if (savvy::varint_decode(in_it, end_it, sz) == end_it)
+      return false;
+    destination.resize(0);
+    destination.resize(num_haps_);
+    std::uint64_t total_offset = 0;
+    for (std::size_t i = 0; i < sz && in_it != end_it; ++i, ++total_offset)
+    {
+      float allele;
+      std::uint64_t offset;
+      std::tie(allele, offset) = savvy::sav::detail::allele_decoder<1>::decode(++in_it, end_it, std::numeric_limits<float>::quiet_NaN());
+      total_offset += offset;
+      destination[total_offset] = allele;
+    }
+    return input_stream_.get() != std::char_traits<char>::eof();
+  }
+private:
+  shrinkwrap::zstd::istream input_stream_;
+  std::vector<std::string> info_fields_;
+  std::size_t num_haps_;
+};
+
+// Same for both scans. Only the reads are timed.
+template <typename T>
+std::uint64_t record_checksum(const savvy::site_info& annotations, const T& genotypes)
+{
+  std::uint64_t ret = annotations.position();
+  for (auto it = genotypes.begin(); it != genotypes.end(); ++it)
+    ret += (*it != 0.f);
+  return ret;
+}
+
+template <typename Rdr, typename T>
+std::uint64_t timed_scan(Rdr& input, T& genotypes, std::chrono::high_resolution_clock::duration& elapsed_time)
+{
+  savvy::site_info annotations;
+  std::uint64_t checksum = 0;
+  elapsed_time = std::chrono::high_resolution_clock::duration(0);
+  while (true)
+  {
+    const auto read_start = std::chrono::high_resolution_clock::now();
+    const bool record_read = bool(input.read(annotations, genotypes));
+    elapsed_time += std::chrono::high_resolution_clock::now() - read_start;
+    if (!record_read)
+      break;
+    checksum += record_checksum(annotations, genotypes);
+  }
+  return checksum;
+}
+
+// Times whole-file record reads with sav::reader and with istreambuf_record_reader into T.
+template <typename T>
+int reader_scan_speed_test(const std::string& path)
+{
+  std::chrono::high_resolution_clock::duration scan_elapsed_time;
+  T genotypes;
+
+  savvy::sav::reader input(path);
+  const std::uint64_t expected = timed_scan(input, genotypes, scan_elapsed_time);
+  std::cout << "sav::reader: " << expected << std::endl;
+  std::cout << "Scan elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(scan_elapsed_time).count() << "ms" << std::endl;
+  if (input.bad())
+    return EXIT_FAILURE;
+
+  savvy::sav::reader header_reader(path);
+  istreambuf_record_reader legacy_input(path, header_reader.tellg(), header_reader.info_fields().size(), header_reader.samples().size() * header_reader.ploidy());
+  const std::uint64_t checksum = timed_scan(legacy_input, genotypes, scan_elapsed_time);
+  std::cout << "istreambuf_iterator: " << checksum << std::endl;
+  std::cout << "Scan elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(scan_elapsed_time).count() << "ms" << std::endl;
+  return checksum == expected ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Writes a SAV 1.0 GT file with mostly rare variants and a common one every tenth record.
+bool write_scan_test_file(const std::string& path)
+{
+  const std::size_t num_samples = 20000;
+  const std::size_t num_records = 2000;
+
+  std::vector<std::string> sample_ids(num_samples);
+  for (std::size_t i = 0; i < num_samples; ++i)
+    sample_ids[i] = "SAMPLE" + std::to_string(i);
+  std::vector<std::pair<std::string, std::string>> headers = {{"INFO", "<ID=INFO0,Number=1,Type=Float>"}, {"INFO", "<ID=INFO1,Number=1,Type=Float>"}};
+
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<float> unif(0.f, 1.f);
+  savvy::sav::writer output(path, sample_ids.begin(), sample_ids.end(), headers.begin(), headers.end(), savvy::fmt::gt);
+  std::vector<float> genotypes(num_samples * 2);
+  for (std::size_t r = 0; r < num_records; ++r)
+  {
+    const float af = r % 10 == 0 ? 0.3f : 0.005f;
+    for (auto it = genotypes.begin(); it != genotypes.end(); ++it)
+      *it = unif(rng) < af ? 1.f : 0.f;
+    output.write(savvy::site_info("20", 1000 + r * 10, "A", "G", {{"INFO0", std::to_string(af)}}), genotypes);
+  }
+  return output.good();
+}
+
+int main(int argc, char** argv)
+{
+  std::string path = argc > 1 ? argv[1] : "decode-speed.bin";
+  std::cout << "Offsets up to 99:" << std::endl;
+  int ret = decode_speed_test(path, 99);
+  if (ret == EXIT_SUCCESS)
+  {
+    std::cout << std::endl << "One byte pairs only:" << std::endl;
+    ret = decode_speed_test(path, 63);
+  }
+  if (ret == EXIT_SUCCESS)
+    ret = write_scan_test_file(path) ? EXIT_SUCCESS : EXIT_FAILURE;
+  if (ret == EXIT_SUCCESS)
+  {
+    std::cout << std::endl << "Whole-file scan into std::vector<float>:" << std::endl;
+    ret = reader_scan_speed_test<std::vector<float>>(path);
+  }
+  if (ret == EXIT_SUCCESS)
+  {
+    std::cout << std::endl << "Whole-file scan into savvy::compressed_vector<float>:" << std::endl;
+    ret = reader_scan_speed_test<savvy::compressed_vector<float>>(path);
+  }
+  std::remove(path.c_str());
+  return ret;
+}
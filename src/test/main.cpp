@@ -5,6 +5,9 @@
  */
 
 #include "savvy/sav_reader.hpp"
+#include "savvy/sav_parallel_scan.hpp"
+#include "sav/filter.hpp"
+#include "sav/sort_samples.hpp"
 #include "savvy/m3vcf_reader.hpp"
 #include "savvy/vcf_reader.hpp"
 #include "test/test_class.hpp"
@@ -14,6 +17,7 @@
 #include "savvy/reader.hpp"
 #include "savvy/site_info.hpp"
 #include "savvy/data_format.hpp"
+#include "savvy/genotype_matrix.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -24,7 +28,15 @@
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <random>
+#include <mutex>
+#include <thread>
+#include <set>
 #include <sys/stat.h>
+#include <getopt.h>
+
+#include <shrinkwrap/zstd.hpp>
+#include <zstd.h>
 
 #include <htslib/synced_bcf_reader.h>
 #include <htslib/tbx.h>
@@ -417,6 +429,79 @@ int varint_test()
   return 0;
 }
 
+template <std::uint8_t BitWidth>
+void allele_pair_array_test()
+{
+  const std::size_t counts[] = {0, 1, 15, 16, 17, 63, 64, 65, 100, 1007};
+  const std::uint64_t max_one_byte_offset = (1u << (7u - BitWidth)) - 1u;
+  std::mt19937_64 rng(BitWidth);
+
+  for (std::size_t count : counts)
+  {
+    // 0: one byte pairs only; 1: occasional multi-byte pairs; 2: mostly multi-byte pairs.
+    for (unsigned multi_byte_rate = 0; multi_byte_rate < 3; ++multi_byte_rate)
+    {
+      std::vector<std::uint8_t> expected_prefixes(count);
+      std::vector<std::uint64_t> expected_offsets(count);
+      std::string encoded;
+      std::back_insert_iterator<std::string> out_it(encoded);
+      std::uint64_t next_offset = 0;
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        std::uint64_t offset = rng() % (max_one_byte_offset + 1);
+        if (multi_byte_rate && rng() % (multi_byte_rate == 1 ? 40 : 2) == 0)
+          offset = max_one_byte_offset + 1 + rng() % 100000;
+        expected_prefixes[i] = std::uint8_t(rng() & ((1u << BitWidth) - 1u));
+        savvy::prefixed_varint<BitWidth>::encode(expected_prefixes[i], offset, out_it);
+        next_offset += offset;
+        expected_offsets[i] = next_offset++;
+      }
+
+      const std::size_t encoded_size = encoded.size();
+      encoded.append(64, char(0xFF)); // Stands in for the next field, which must not be consumed.
+      const char* encoded_end = encoded.data() + encoded_size;
+
+      std::vector<std::uint8_t> prefixes(count + 1, 0xFF);
+      std::vector<std::uint64_t> offsets(count + 1, 0);
+      const char* in_it = encoded.data();
+      assert(savvy::sav::detail::decode_allele_pair_array<BitWidth>(in_it, encoded.data() + encoded.size(), count, prefixes.data(), offsets.data()) == count);
+      assert(in_it == encoded_end);
+      assert(std::equal(expected_prefixes.begin(), expected_prefixes.end(), prefixes.begin()) && prefixes[count] == 0xFF);
+      assert(std::equal(expected_offsets.begin(), expected_offsets.end(), offsets.begin()));
+
+      // The reader's cursor decodes the same pairs one at a time.
+      savvy::sav::detail::allele_pair_cursor<BitWidth> pairs;
+      pairs.stream(encoded.data(), encoded.data() + encoded.size(), count, next_offset);
+      std::uint8_t prefix;
+      std::uint64_t offset;
+      std::size_t decoded = 0;
+      for ( ; pairs.next(prefix, offset); ++decoded)
+        assert(prefix == expected_prefixes[decoded] && offset == expected_offsets[decoded]);
+      assert(decoded == count && pairs.done() && pairs.position() == encoded_end);
+
+      if (count)
+      {
+        // Truncated input stops at the last complete pair.
+        const char* truncated_end = encoded_end - 1;
+        in_it = encoded.data();
+        decoded = savvy::sav::detail::decode_allele_pair_array<BitWidth>(in_it, truncated_end, count, prefixes.data(), offsets.data());
+        assert(decoded == count - 1 && in_it == truncated_end);
+        assert(std::equal(prefixes.begin(), prefixes.begin() + decoded, expected_prefixes.begin()));
+        assert(std::equal(offsets.begin(), offsets.begin() + decoded, expected_offsets.begin()));
+
+        pairs.stream(encoded.data(), truncated_end, count, next_offset);
+        for (decoded = 0; pairs.next(prefix, offset); ++decoded) { }
+        assert(decoded == count - 1 && !pairs.done());
+
+        // So does the cursor at an offset past the haplotype count.
+        pairs.stream(encoded.data(), encoded_end, count, expected_offsets.back());
+        for (decoded = 0; pairs.next(prefix, offset); ++decoded) { }
+        assert(decoded == count - 1 && !pairs.done());
+      }
+    }
+  }
+}
+
 template <typename Proc>
 class timed_procedure_call
 {
@@ -707,6 +792,64 @@ void generic_reader_test(const std::string& path, savvy::fmt format, std::size_t
   assert(cnt == expected_markers);
 }
 
+void batch_read_test(const std::string& path, savvy::fmt format)
+{
+  savvy::reader batch_rdr(path, format);
+  savvy::reader rdr(path, format);
+  assert(batch_rdr.good() && rdr.good());
+
+  const std::size_t rows = batch_rdr.samples().size() * savvy::sample_stride(format, 2);
+  std::vector<savvy::site_info> sites;
+  std::vector<float> matrix;
+  savvy::site_info i;
+  std::vector<float> d;
+  std::size_t cnt;
+  while ((cnt = savvy::read_batch(batch_rdr, sites, matrix, rows, 3)))
+  {
+    assert(sites.size() == cnt);
+    for (std::size_t j = 0; j < cnt; ++j)
+    {
+      assert(rdr.read(i, d));
+      assert(i.position() == sites[j].position() && d.size() == rows);
+      for (std::size_t k = 0; k < rows; ++k)
+        assert(d[k] == matrix[j * rows + k] || (std::isnan(d[k]) && std::isnan(matrix[j * rows + k])));
+    }
+  }
+  assert(!rdr.read(i, d));
+}
+
+void quantized_read_test(const std::string& path, savvy::fmt format)
+{
+  savvy::sav::reader code_rdr(path, format);
+  savvy::sav::reader rdr(path, format);
+  assert(code_rdr.good() && rdr.good());
+
+  savvy::dosage_code_table<float> table;
+  savvy::site_info i;
+  std::vector<std::uint8_t> codes;
+  std::vector<float> d;
+  while (code_rdr.read_dosage_codes(i, codes))
+  {
+    assert(rdr.read(i, d));
+    assert(codes.size() == d.size());
+    for (std::size_t k = 0; k < d.size(); ++k)
+      assert(table[codes[k]] == d[k] || (std::isnan(d[k]) && codes[k] == savvy::dosage_code_missing));
+  }
+  assert(!rdr.read(i, d));
+
+  // Plain 8-bit destinations still receive values.
+  savvy::sav::reader value_rdr(path, format);
+  savvy::sav::reader float_rdr(path, format);
+  std::vector<std::uint8_t> values;
+  while (value_rdr.read(i, values))
+  {
+    assert(float_rdr.read(i, d) && values.size() == d.size());
+    for (std::size_t k = 0; k < d.size(); ++k)
+      assert(std::isnan(d[k]) || values[k] == std::uint8_t(d[k]));
+  }
+  assert(!value_rdr.bad() && !float_rdr.read(i, d));
+}
+
 template <typename R, savvy::fmt F>
 void subset_test(const std::string& path)
 {
@@ -728,6 +871,1452 @@ void subset_test(const std::string& path)
   assert(cnt == (F == savvy::fmt::hds ? SAVVYT_MARKER_COUNT_DOSE : SAVVYT_MARKER_COUNT_HARD));
 }
 
+struct sav_test_record
+{
+  savvy::site_info site;
+  std::vector<float> gt;
+  std::vector<float> hds;
+};
+
+std::vector<std::string> sav_test_sample_ids(std::size_t sample_count)
+{
+  std::vector<std::string> ret;
+  for (std::size_t i = 0; i < sample_count; ++i)
+    ret.emplace_back("SAMPLE" + std::to_string(i));
+  return ret;
+}
+
+// Records on chromosomes 1 and 2 with sparse GT and HDS values that are exact at any dosage bit width of 2 or more.
+std::vector<sav_test_record> make_sav_test_records(std::size_t record_count, std::size_t haplotype_count)
+{
+  std::mt19937 rng(record_count);
+  std::vector<sav_test_record> ret(record_count);
+  for (std::size_t i = 0; i < record_count; ++i)
+  {
+    sav_test_record& rec = ret[i];
+    rec.site = savvy::site_info(i < record_count / 2 ? "1" : "2", 100 + i * 3, "A", i % 5 ? "C" : "T", {});
+    rec.gt.resize(haplotype_count);
+    rec.hds.resize(haplotype_count);
+    for (std::size_t j = 0; j < haplotype_count; ++j)
+    {
+      if (rng() % 4 == 0)
+      {
+        rec.hds[j] = float(rng() % 4 + 1) / 4.f;
+        rec.gt[j] = rec.hds[j] > 0.5f ? 1.f : 0.f;
+      }
+      if (rng() % 50 == 0)
+        rec.gt[j] = std::numeric_limits<float>::quiet_NaN();
+    }
+  }
+  return ret;
+}
+
+void write_sav_test_file(const std::string& path, const savvy::sav::writer::options& opts, const std::vector<savvy::fmt>& formats, const std::vector<sav_test_record>& records, std::size_t sample_count)
+{
+  std::vector<std::string> ids = sav_test_sample_ids(sample_count);
+  std::vector<std::pair<std::string, std::string>> headers;
+  savvy::sav::writer output(path, opts, ids.begin(), ids.end(), headers.begin(), headers.end(), formats);
+  for (auto it = records.begin(); it != records.end(); ++it)
+  {
+    const std::vector<float>& first = formats.front() == savvy::fmt::hds ? it->hds : it->gt;
+    if (formats.size() > 1)
+      output.write(it->site, first, formats[1] == savvy::fmt::hds ? it->hds : it->gt);
+    else
+      output.write(it->site, first);
+  }
+  assert(output.good());
+}
+
+bool same_genotypes(const std::vector<float>& a, const std::vector<float>& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); ++i)
+  {
+    if (a[i] != b[i] && !(std::isnan(a[i]) && std::isnan(b[i])))
+      return false;
+  }
+  return true;
+}
+
+std::vector<char> read_file_bytes(const std::string& path)
+{
+  std::ifstream ifs(path, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+// Minimal reader over in-memory records, which unlike SAV files may change ploidy between records.
+class record_list_reader
+{
+public:
+  record_list_reader(const std::vector<sav_test_record>& records) :
+    records_(records),
+    pos_(0)
+  {
+  }
+
+  template <typename T>
+  record_list_reader& read(savvy::site_info& annotations, T& destination)
+  {
+    if (pos_ < records_.size())
+    {
+      annotations = records_[pos_].site;
+      const std::vector<float>& gt = records_[pos_++].gt;
+      destination.resize(gt.size());
+      for (std::size_t i = 0; i < gt.size(); ++i)
+        destination[i] = gt[i];
+    }
+    else
+    {
+      pos_ = records_.size() + 1;
+    }
+    return *this;
+  }
+
+  bool good() const { return pos_ <= records_.size(); }
+  explicit operator bool() const { return good(); }
+private:
+  const std::vector<sav_test_record>& records_;
+  std::size_t pos_;
+};
+
+void batch_read_mismatch_test()
+{
+  const std::size_t rows = 8;
+  std::vector<sav_test_record> records = make_sav_test_records(6, rows);
+  records[4].gt.resize(rows / 2); // Haploid record.
+
+  record_list_reader rdr(records);
+  std::vector<savvy::site_info> sites;
+  std::vector<float> matrix;
+  std::vector<float> mismatched;
+  assert(savvy::read_batch(rdr, sites, matrix, rows, 3, &mismatched) == 3 && sites.size() == 3);
+  for (std::size_t j = 0; j < 3; ++j)
+    assert(sites[j].position() == records[j].site.position() && same_genotypes(std::vector<float>(matrix.begin() + j * rows, matrix.begin() + (j + 1) * rows), records[j].gt));
+
+  // The haploid record ends the batch early but is returned instead of being dropped.
+  assert(savvy::read_batch(rdr, sites, matrix, rows, 3, &mismatched) == 1 && rdr.good());
+  assert(sites.size() == 2 && sites[1].position() == records[4].site.position());
+  assert(same_genotypes(mismatched, records[4].gt));
+
+  assert(savvy::read_batch(rdr, sites, matrix, rows, 3, &mismatched) == 1 && sites.size() == 1);
+  assert(sites[0].position() == records[5].site.position() && !rdr.good());
+  assert(savvy::read_batch(rdr, sites, matrix, rows, 3) == 0 && sites.empty());
+}
+
+void create_index_test()
+{
+  const std::string path = "create-index-test.sav";
+  const std::size_t sample_count = 10;
+  std::vector<sav_test_record> records = make_sav_test_records(20, sample_count * 2);
+
+  savvy::sav::writer::options opts;
+  opts.block_size = 4;
+  opts.index_path = path + ".s1r";
+  write_sav_test_file(path, opts, {savvy::fmt::gt, savvy::fmt::hds}, records, sample_count);
+
+  assert(savvy::sav::writer::create_index(path, path + ".created.s1r"));
+  assert(read_file_bytes(path + ".created.s1r") == read_file_bytes(path + ".s1r"));
+
+  savvy::sav::indexed_reader rdr(path, path + ".created.s1r", {"2", 100 + 11 * 3, 100 + 14 * 3}, savvy::bounding_point::beg, savvy::fmt::hds);
+  savvy::site_info anno;
+  std::vector<float> buf;
+  for (std::size_t i = 11; i <= 14; ++i)
+  {
+    assert(rdr.read(anno, buf));
+    assert(anno.position() == records[i].site.position() && same_genotypes(buf, records[i].hds));
+  }
+  assert(!rdr.read(anno, buf) && !rdr.bad());
+
+  std::remove(path.c_str());
+  std::remove((path + ".s1r").c_str());
+  std::remove((path + ".created.s1r").c_str());
+}
+
+
+bool same_record(const sav_test_record& a, const sav_test_record& b)
+{
+  return a.site.chromosome() == b.site.chromosome() && a.site.position() == b.site.position() && a.site.ref() == b.site.ref() && a.site.alt() == b.site.alt()
+    && same_genotypes(a.gt, b.gt) && same_genotypes(a.hds, b.hds);
+}
+
+bool same_records(const std::vector<sav_test_record>& a, const std::vector<sav_test_record>& b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), same_record);
+}
+
+// Reads the remaining records of a reader with every stored FORMAT field. Genotypes of records
+// at positions where skip(position) is true are left undecoded.
+template <typename Rdr, typename Pred>
+std::vector<sav_test_record> read_sav_test_records(Rdr& rdr, Pred skip)
+{
+  std::vector<sav_test_record> ret;
+  sav_test_record rec;
+  while (rdr.read_site_info(rec.site).good())
+  {
+    rec.gt.clear();
+    rec.hds.clear();
+    if (!skip(rec.site.position()))
+    {
+      for (savvy::fmt f : rdr.data_formats())
+        rdr.read_genotypes(f, f == savvy::fmt::hds ? rec.hds : rec.gt);
+    }
+    ret.push_back(rec);
+  }
+  assert(!rdr.bad());
+  return ret;
+}
+
+bool skip_none(std::uint64_t) { return false; }
+bool skip_all(std::uint64_t) { return true; }
+bool skip_two_of_three(std::uint64_t pos) { return pos % 9 != 1; } // Positions are 100 + 3i, so every third record is decoded.
+
+// Merges records read from files that each store one of the fields of a.
+void merge_sav_test_records(std::vector<sav_test_record>& a, const std::vector<sav_test_record>& b)
+{
+  if (a.empty())
+  {
+    a = b;
+    return;
+  }
+
+  assert(a.size() == b.size());
+  for (std::size_t i = 0; i < a.size(); ++i)
+  {
+    if (a[i].gt.empty())
+      a[i].gt = b[i].gt;
+    if (a[i].hds.empty())
+      a[i].hds = b[i].hds;
+  }
+}
+
+// Drops the fields of records that a file with the given FORMAT fields doesn't store.
+std::vector<sav_test_record> stored_fields(std::vector<sav_test_record> records, const std::vector<savvy::fmt>& formats)
+{
+  for (auto it = records.begin(); it != records.end(); ++it)
+  {
+    if (std::find(formats.begin(), formats.end(), savvy::fmt::gt) == formats.end())
+      it->gt.clear();
+    if (std::find(formats.begin(), formats.end(), savvy::fmt::hds) == formats.end())
+      it->hds.clear();
+  }
+  return records;
+}
+
+/**
+ * Checks that records written with a SAV feature read back the same as when they are written
+ * without features (one file per FORMAT field): in full, when genotypes of some records are
+ * skipped, in a sample subset and in region queries through the index.
+ * @param opts Writer options that enable the feature. Block size and index path are overridden.
+ * @param reader_opts Reader options used for both files.
+ */
+void sav_feature_test(const std::string& path, savvy::sav::writer::options opts, const std::vector<savvy::fmt>& formats, std::uint16_t expected_minor_version, std::uint64_t expected_features,
+  const std::vector<sav_test_record>& records, const std::vector<sav_test_record>& baseline_records, const savvy::sav::reader::options& reader_opts = savvy::sav::reader::options())
+{
+  const std::size_t sample_count = records.front().gt.size() / 2;
+  const std::set<std::string> subset = {"SAMPLE1", "SAMPLE4", "SAMPLE5", "SAMPLE8"};
+  const std::vector<savvy::region> regions = {{"1", 110, 150}, {"1", 100, 100}, {"2", 0, 400}, {"2", 190, 230}, {"3", 0, 1000}};
+
+  std::vector<std::string> paths = {path};
+  opts.block_size = 4;
+  opts.index_path = path + ".s1r";
+  write_sav_test_file(path, opts, formats, records, sample_count);
+
+  for (savvy::fmt f : formats)
+  {
+    savvy::sav::writer::options baseline_opts;
+    baseline_opts.block_size = opts.block_size;
+    paths.push_back(path + (f == savvy::fmt::hds ? ".hds.sav" : ".gt.sav"));
+    baseline_opts.index_path = paths.back() + ".s1r";
+    write_sav_test_file(paths.back(), baseline_opts, {f}, baseline_records, sample_count);
+  }
+
+  {
+    savvy::sav::reader rdr(path, reader_opts, formats.front());
+    assert(rdr.good() && rdr.minor_version() == expected_minor_version && rdr.features() == expected_features);
+    assert(rdr.data_formats() == formats && rdr.samples() == sav_test_sample_ids(sample_count));
+  }
+
+  std::vector<std::vector<sav_test_record>> full(2), skipped(2), subsetted(2), queried(2);
+  for (std::size_t i = 0; i < paths.size(); ++i)
+  {
+    const std::size_t k = i ? 1 : 0;
+    savvy::sav::reader full_rdr(paths[i], reader_opts, formats.front());
+    merge_sav_test_records(full[k], read_sav_test_records(full_rdr, skip_none));
+
+    savvy::sav::reader skip_rdr(paths[i], reader_opts, formats.front());
+    merge_sav_test_records(skipped[k], read_sav_test_records(skip_rdr, skip_two_of_three));
+
+    savvy::sav::reader subset_rdr(paths[i], reader_opts, formats.front());
+    assert(subset_rdr.subset_samples(subset).size() == subset.size());
+    merge_sav_test_records(subsetted[k], read_sav_test_records(subset_rdr, skip_none));
+
+    std::vector<sav_test_record> query_results;
+    for (const savvy::region& reg : regions)
+    {
+      savvy::sav::indexed_reader query_rdr(paths[i], paths[i] + ".s1r", reg, savvy::bounding_point::beg, reader_opts, formats.front());
+      std::vector<sav_test_record> res = read_sav_test_records(query_rdr, skip_none);
+      query_results.insert(query_results.end(), res.begin(), res.end());
+    }
+    merge_sav_test_records(queried[k], query_results);
+  }
+
+  assert(same_records(full[1], stored_fields(baseline_records, formats)));
+  assert(same_records(full[0], full[1]));
+  assert(same_records(skipped[0], skipped[1]) && skipped[0].size() == full[0].size());
+  assert(same_records(subsetted[0], subsetted[1]) && std::max(subsetted[0].front().gt.size(), subsetted[0].front().hds.size()) == subset.size() * 2);
+  assert(same_records(queried[0], queried[1]) && !queried[0].empty());
+
+  for (const std::string& p : paths)
+  {
+    std::remove(p.c_str());
+    std::remove((p + ".s1r").c_str());
+  }
+}
+
+// Size of a file written with write_sav_test_file(), which is removed afterwards.
+std::size_t sav_test_file_size(const std::string& path, const savvy::sav::writer::options& opts, const std::vector<savvy::fmt>& formats, const std::vector<sav_test_record>& records, std::size_t sample_count)
+{
+  write_sav_test_file(path, opts, formats, records, sample_count);
+  std::size_t ret = read_file_bytes(path).size();
+  std::remove(path.c_str());
+  std::remove(opts.index_path.c_str());
+  return ret;
+}
+
+// Decompressed content of each zstd frame of a file.
+std::vector<std::string> read_zstd_frames(const std::string& path)
+{
+  const std::vector<char> compressed = read_file_bytes(path);
+  std::vector<std::string> ret;
+  ZSTD_DStream* zstd_context = ZSTD_createDStream();
+  std::vector<char> buf(ZSTD_DStreamOutSize());
+  for (std::size_t pos = 0; pos < compressed.size(); )
+  {
+    const std::size_t frame_size = ZSTD_findFrameCompressedSize(compressed.data() + pos, compressed.size() - pos);
+    assert(!ZSTD_isError(frame_size));
+    ZSTD_initDStream(zstd_context);
+    ZSTD_inBuffer input = {compressed.data() + pos, frame_size, 0};
+    ret.emplace_back();
+    std::size_t res;
+    do
+    {
+      ZSTD_outBuffer output = {buf.data(), buf.size(), 0};
+      res = ZSTD_decompressStream(zstd_context, &output, &input);
+      assert(!ZSTD_isError(res));
+      ret.back().append(buf.data(), output.pos);
+    } while (res != 0);
+    pos += frame_size;
+  }
+  ZSTD_freeDStream(zstd_context);
+  return ret;
+}
+
+// Replaces a file with one zstd frame per element of frames.
+void write_zstd_frames(const std::string& path, const std::vector<std::string>& frames)
+{
+  std::ofstream ofs(path, std::ios::binary);
+  for (auto it = frames.begin(); it != frames.end(); ++it)
+  {
+    std::vector<char> compressed(ZSTD_compressBound(it->size()));
+    const std::size_t sz = ZSTD_compress(compressed.data(), compressed.size(), it->data(), it->size(), 3);
+    assert(!ZSTD_isError(sz));
+    ofs.write(compressed.data(), sz);
+  }
+  assert(ofs.good());
+}
+
+std::uint64_t read_test_vli(const std::string& bytes, std::size_t& pos)
+{
+  std::uint64_t ret;
+  auto it = savvy::varint_decode(bytes.begin() + pos, bytes.end(), ret);
+  assert(it != bytes.end());
+  pos = std::size_t(++it - bytes.begin());
+  return ret;
+}
+
+/**
+ * Calls fn(bytes, beg, end, format_index) with the bounds of every genotype block (after GT_SZ)
+ * of every record, in file order, and writes back the modified frames. The file must be
+ * SAV 1.1+ without INFO fields, dictionary, columnar frames or delta coded sites.
+ */
+template <typename Fn>
+void rewrite_genotype_blocks(const std::string& path, std::size_t format_count, Fn fn)
+{
+  std::vector<std::string> frames = read_zstd_frames(path);
+  std::string& header = frames.front();
+  assert(header.compare(0, 3, "sav") == 0);
+  const std::uint16_t minor_version = std::uint16_t((std::uint8_t(header[5]) << 8) | std::uint8_t(header[6]));
+  assert(minor_version >= 1);
+
+  std::size_t pos = 7 + 16; // Version and UUID.
+  for (std::uint64_t n = read_test_vli(header, pos); n > 0; --n)
+  {
+    const std::uint64_t key_size = read_test_vli(header, pos);
+    pos += key_size;
+    if (key_size)
+      pos += read_test_vli(header, pos);
+  }
+  for (std::uint64_t n = read_test_vli(header, pos); n > 0; --n)
+    pos += read_test_vli(header, pos);
+  if (minor_version >= 4)
+    read_test_vli(header, pos); // FEATURES
+  if (minor_version >= 3)
+    assert(read_test_vli(header, pos) == 0); // DICT_SZ
+
+  for (auto it = frames.begin(); it != frames.end(); ++it, pos = 0)
+  {
+    while (pos < it->size())
+    {
+      pos += read_test_vli(*it, pos); // CHROM
+      read_test_vli(*it, pos); // POS
+      pos += read_test_vli(*it, pos); // REF
+      pos += read_test_vli(*it, pos); // ALT
+      for (std::size_t f = 0; f < format_count; ++f)
+      {
+        const std::uint64_t sz = read_test_vli(*it, pos);
+        assert(pos + sz <= it->size());
+        fn(*it, pos, std::size_t(pos + sz), f);
+        pos += sz;
+      }
+    }
+  }
+
+  write_zstd_frames(path, frames);
+}
+
+void genotype_block_size_test()
+{
+  // GT_SZ (SAV 1.1+) lets readers skip genotypes without decoding them.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.minor_version = 1;
+  sav_feature_test("genotype-block-size-test.sav", opts, {savvy::fmt::gt}, 1, 0, records, records);
+  sav_feature_test("genotype-block-size-test.sav", opts, {savvy::fmt::hds}, 1, 0, records, records);
+
+  // Skipped genotype blocks are passed without being decoded, so corrupting them doesn't affect reads that skip them.
+  const std::string path = "genotype-block-size-test.sav";
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, 10);
+  std::size_t record_index = 0;
+  rewrite_genotype_blocks(path, 1, [&records, &record_index](std::string& bytes, std::size_t beg, std::size_t end, std::size_t)
+  {
+    if (skip_two_of_three(records[record_index++].site.position()))
+      std::fill(bytes.begin() + beg, bytes.begin() + end, char(0xFF));
+  });
+  assert(record_index == records.size());
+
+  savvy::sav::reader rdr(path, savvy::fmt::gt);
+  std::vector<sav_test_record> skipped = read_sav_test_records(rdr, skip_two_of_three);
+  assert(skipped.size() == records.size());
+  for (std::size_t i = 0; i < records.size(); ++i)
+    assert(skipped[i].site.position() == records[i].site.position() && (skip_two_of_three(records[i].site.position()) || same_genotypes(skipped[i].gt, records[i].gt)));
+  std::remove(path.c_str());
+}
+
+void sample_blocks_test()
+{
+  // Three samples per block leaves a partial last block, and the subset spans several blocks.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.sample_block_size = 3;
+  sav_feature_test("sample-blocks-test.sav", opts, {savvy::fmt::gt}, 2, 0, records, records);
+  sav_feature_test("sample-blocks-test.sav", opts, {savvy::fmt::hds}, 2, 0, records, records);
+
+  // Blocks without requested samples are passed without being decoded, so corrupting them doesn't affect the subset.
+  const std::string path = "sample-blocks-test.sav";
+  const std::size_t sample_count = 10;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  std::size_t corrupted_blocks = 0;
+  rewrite_genotype_blocks(path, 1, [sample_count, &corrupted_blocks](std::string& bytes, std::size_t beg, std::size_t end, std::size_t)
+  {
+    const std::uint64_t block_haps = read_test_vli(bytes, beg);
+    const std::uint64_t block_count = (sample_count * 2 + block_haps - 1) / block_haps;
+    std::vector<std::uint64_t> block_sizes(block_count);
+    for (std::size_t b = 0; b < block_count; ++b)
+      block_sizes[b] = read_test_vli(bytes, beg);
+    beg += block_sizes[0];
+    std::fill(bytes.begin() + beg, bytes.begin() + end, char(0xFF)); // Every block after the first.
+    corrupted_blocks += block_count - 1;
+  });
+  assert(corrupted_blocks == records.size() * 3);
+
+  savvy::sav::reader rdr(path, savvy::fmt::gt);
+  assert(rdr.subset_samples({"SAMPLE0", "SAMPLE2"}).size() == 2);
+  std::vector<sav_test_record> subsetted = read_sav_test_records(rdr, skip_none);
+  assert(subsetted.size() == records.size());
+  for (std::size_t i = 0; i < records.size(); ++i)
+  {
+    const std::vector<float>& gt = records[i].gt;
+    assert(same_genotypes(subsetted[i].gt, {gt[0], gt[1], gt[4], gt[5]}));
+  }
+  std::remove(path.c_str());
+}
+
+void dictionary_test()
+{
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.dictionary_training_records = 16;
+  sav_feature_test("dictionary-test.sav", opts, {savvy::fmt::gt}, 3, 0, records, records);
+
+  // A dictionary taken from an existing file is stored and used as is.
+  opts.block_size = 4;
+  write_sav_test_file("dictionary-test.sav", opts, {savvy::fmt::gt}, records, 10);
+  savvy::sav::writer::options copy_opts;
+  copy_opts.dictionary = savvy::sav::reader("dictionary-test.sav").dictionary();
+  std::remove("dictionary-test.sav");
+  assert(!copy_opts.dictionary.empty());
+  sav_feature_test("dictionary-test.sav", copy_opts, {savvy::fmt::hds}, 3, 0, records, records);
+
+  // Frames of four records share little with each other, but recurring genotype patterns are learned by the dictionary.
+  std::vector<sav_test_record> recurring = make_sav_test_records(400, 200);
+  const std::vector<sav_test_record> patterns = make_sav_test_records(8, 200);
+  for (std::size_t i = 0; i < recurring.size(); ++i)
+    recurring[i].gt = patterns[i % patterns.size()].gt;
+  savvy::sav::writer::options small_frames;
+  small_frames.block_size = 4;
+  savvy::sav::writer::options dictionary_opts = small_frames;
+  dictionary_opts.dictionary_training_records = 64;
+  assert(sav_test_file_size("dictionary-test.sav", dictionary_opts, {savvy::fmt::gt}, recurring, 100) < sav_test_file_size("dictionary-test.sav", small_frames, {savvy::fmt::gt}, recurring, 100) * 3 / 4);
+}
+
+void columnar_frames_test()
+{
+  // Skipped records leave genotype blocks behind in the genotype frame, which later reads catch up with.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.columnar_frames = true;
+  sav_feature_test("columnar-frames-test.sav", opts, {savvy::fmt::gt}, 4, savvy::sav::feature_columnar_frames, records, records);
+  sav_feature_test("columnar-frames-test.sav", opts, {savvy::fmt::hds}, 4, savvy::sav::feature_columnar_frames, records, records);
+
+  // Site-only reads never decompress genotype frames, so replacing them with frames that don't decode doesn't affect them.
+  const std::string path = "columnar-frames-test.sav";
+  opts.block_size = 4;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, 10);
+  std::vector<std::string> frames = read_zstd_frames(path);
+  assert(frames.size() == 1 + records.size() / 4 * 2); // Header, then a site and a genotype frame per block.
+  for (std::size_t i = 2; i < frames.size(); i += 2)
+    frames[i].assign(frames[i].size(), char(0xFF));
+  write_zstd_frames(path, frames);
+
+  savvy::sav::reader rdr(path, savvy::fmt::gt);
+  std::vector<sav_test_record> sites = read_sav_test_records(rdr, skip_all);
+  assert(sites.size() == records.size());
+  for (std::size_t i = 0; i < records.size(); ++i)
+    assert(sites[i].site.position() == records[i].site.position() && sites[i].site.alt() == records[i].site.alt());
+  std::remove(path.c_str());
+}
+
+void delta_sites_test()
+{
+  // Queries start reading mid-chromosome, where positions are deltas. Indels are stored without the SNV shortcut.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  records[6].site = savvy::site_info("1", records[6].site.position(), "AT", "A", {});
+  records[25].site = savvy::site_info("2", records[25].site.position(), "G", "GCC", {});
+  savvy::sav::writer::options opts;
+  opts.delta_sites = true;
+  sav_feature_test("delta-sites-test.sav", opts, {savvy::fmt::gt}, 4, savvy::sav::feature_delta_sites, records, records);
+
+  opts.columnar_frames = true;
+  sav_feature_test("delta-sites-test.sav", opts, {savvy::fmt::hds}, 4, savvy::sav::feature_delta_sites | savvy::sav::feature_columnar_frames, records, records);
+
+  // A site-heavy file with one sample shrinks once CHROM, POS and SNV alleles are coded against the previous record.
+  const std::vector<sav_test_record> site_heavy = make_sav_test_records(400, 2);
+  savvy::sav::writer::options columnar_opts;
+  columnar_opts.columnar_frames = true;
+  columnar_opts.block_size = 64;
+  savvy::sav::writer::options delta_opts = columnar_opts;
+  delta_opts.delta_sites = true;
+  assert(sav_test_file_size("delta-sites-test.sav", delta_opts, {savvy::fmt::gt}, site_heavy, 1) < sav_test_file_size("delta-sites-test.sav", columnar_opts, {savvy::fmt::gt}, site_heavy, 1) * 3 / 4);
+}
+
+void pbwt_test()
+{
+  // The haplotype order is carried across records, so skipped genotypes and queries that start mid-file still have to be decoded in order.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.pbwt = true;
+  sav_feature_test("pbwt-test.sav", opts, {savvy::fmt::gt}, 4, savvy::sav::feature_pbwt, records, records);
+  sav_feature_test("pbwt-test.sav", opts, {savvy::fmt::hds}, 4, savvy::sav::feature_pbwt, records, records);
+
+  opts.columnar_frames = true;
+  sav_feature_test("pbwt-test.sav", opts, {savvy::fmt::gt}, 4, savvy::sav::feature_pbwt | savvy::sav::feature_columnar_frames, records, records);
+
+  // A panel whose haplotypes are copies of four founders, in random sample order, shrinks once carriers are grouped.
+  const std::size_t haplotype_count = 400;
+  std::mt19937 rng(haplotype_count);
+  std::vector<std::size_t> founders(haplotype_count);
+  for (std::size_t h = 0; h < haplotype_count; ++h)
+    founders[h] = rng() % 4;
+  std::vector<sav_test_record> panel(400);
+  for (std::size_t i = 0; i < panel.size(); ++i)
+  {
+    const unsigned founder_alleles = rng() % 15 + 1;
+    panel[i].site = savvy::site_info("1", 100 + i * 3, "A", "C", {});
+    panel[i].gt.resize(haplotype_count);
+    for (std::size_t h = 0; h < haplotype_count; ++h)
+      panel[i].gt[h] = float((founder_alleles >> founders[h]) & 1u);
+  }
+  savvy::sav::writer::options sample_order_opts;
+  sample_order_opts.block_size = 64;
+  savvy::sav::writer::options pbwt_opts = sample_order_opts;
+  pbwt_opts.pbwt = true;
+  assert(sav_test_file_size("pbwt-test.sav", pbwt_opts, {savvy::fmt::gt}, panel, haplotype_count / 2) < sav_test_file_size("pbwt-test.sav", sample_order_opts, {savvy::fmt::gt}, panel, haplotype_count / 2) * 3 / 4);
+}
+
+void multiple_formats_test()
+{
+  // Each stored field is compared with a file that stores only that field.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  sav_feature_test("multiple-formats-test.sav", opts, {savvy::fmt::gt, savvy::fmt::hds}, 4, savvy::sav::feature_multiple_formats, records, records);
+  sav_feature_test("multiple-formats-test.sav", opts, {savvy::fmt::hds, savvy::fmt::gt}, 4, savvy::sav::feature_multiple_formats, records, records);
+
+  // Reading only the second field passes the first one without decoding it, so corrupting it doesn't affect the read.
+  const std::string path = "multiple-formats-test.sav";
+  opts.block_size = 4;
+  write_sav_test_file(path, opts, {savvy::fmt::gt, savvy::fmt::hds}, records, 10);
+  rewrite_genotype_blocks(path, 2, [](std::string& bytes, std::size_t beg, std::size_t end, std::size_t format_index)
+  {
+    if (format_index == 0)
+      std::fill(bytes.begin() + beg, bytes.begin() + end, char(0xFF));
+  });
+  {
+    savvy::sav::reader rdr(path, savvy::fmt::hds);
+    savvy::site_info anno;
+    std::vector<float> buf;
+    for (auto it = records.begin(); it != records.end(); ++it)
+      assert(rdr.read(anno, buf) && anno.position() == it->site.position() && same_genotypes(buf, it->hds));
+    assert(!rdr.read(anno, buf) && !rdr.bad());
+  }
+  std::remove(path.c_str());
+
+  // No formats, a format stored twice (AC is stored as GT) or more than GT and HDS are rejected, whatever the version.
+  const std::vector<std::string> ids = sav_test_sample_ids(10);
+  const std::vector<std::pair<std::string, std::string>> headers;
+  const std::vector<std::vector<savvy::fmt>> invalid_formats = {{}, {savvy::fmt::hds, savvy::fmt::hds}, {savvy::fmt::gt, savvy::fmt::ac}, {savvy::fmt::gt, savvy::fmt::hds, savvy::fmt::gt}};
+  for (auto it = invalid_formats.begin(); it != invalid_formats.end(); ++it)
+  {
+    for (std::uint16_t minor_version : {std::uint16_t(1), std::uint16_t(4)})
+    {
+      savvy::sav::writer::options invalid_opts;
+      invalid_opts.minor_version = minor_version;
+      savvy::sav::writer output(path, invalid_opts, ids.begin(), ids.end(), headers.begin(), headers.end(), *it);
+      assert(!output.good());
+    }
+  }
+  std::remove(path.c_str());
+
+  opts.columnar_frames = true;
+  opts.pbwt = true;
+  sav_feature_test("multiple-formats-test.sav", opts, {savvy::fmt::gt, savvy::fmt::hds}, 4, savvy::sav::feature_multiple_formats | savvy::sav::feature_columnar_frames | savvy::sav::feature_pbwt, records, records);
+}
+
+// Gives a record ALT "C,G,T", with a random ALT allele index in place of each GT value of 1.
+void make_triallelic(sav_test_record& rec, std::mt19937& rng)
+{
+  const std::string chrom = rec.site.chromosome();
+  rec.site = savvy::site_info(std::string(chrom), rec.site.position(), "A", "C,G,T", {});
+  for (auto gt_it = rec.gt.begin(); gt_it != rec.gt.end(); ++gt_it)
+  {
+    if (*gt_it == 1.f)
+      *gt_it = float(rng() % 3 + 1);
+  }
+}
+
+// Appends one biallelic record per ALT allele of a record made by make_triallelic().
+void append_split_records(const sav_test_record& multiallelic, std::vector<sav_test_record>& split_records)
+{
+  const char* alts[] = {"C", "G", "T"};
+  for (std::size_t allele = 1; allele <= 3; ++allele)
+  {
+    sav_test_record rec;
+    rec.site = savvy::site_info(std::string(multiallelic.site.chromosome()), multiallelic.site.position(), "A", alts[allele - 1], {});
+    for (auto gt_it = multiallelic.gt.begin(); gt_it != multiallelic.gt.end(); ++gt_it)
+      rec.gt.push_back(std::isnan(*gt_it) ? *gt_it : float(*gt_it == float(allele)));
+    split_records.push_back(rec);
+  }
+}
+
+void multiallelic_test()
+{
+  // Every fourth record has three ALT alleles. Split into one record per ALT, it has to read back like the biallelic records of a file without the feature.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  std::vector<sav_test_record> split_records;
+  std::mt19937 rng(0);
+  for (auto it = records.begin(); it != records.end(); ++it)
+  {
+    if (it - records.begin() < 4 || (it - records.begin()) % 4)
+    {
+      split_records.push_back(*it);
+      continue;
+    }
+
+    make_triallelic(*it, rng);
+    append_split_records(*it, split_records);
+  }
+
+  savvy::sav::writer::options opts;
+  opts.multiallelic = true;
+  savvy::sav::reader::options split_opts;
+  split_opts.split_multiallelic = true;
+  sav_feature_test("multiallelic-test.sav", opts, {savvy::fmt::gt}, 4, savvy::sav::feature_multiallelic, records, split_records, split_opts);
+
+  // Without splitting, GT values are allele indices.
+  const std::string path = "multiallelic-test.sav";
+  opts.block_size = 4;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, 10);
+  {
+    savvy::sav::reader rdr(path, savvy::fmt::gt);
+    sav_test_record rec;
+    std::vector<sav_test_record> expected = stored_fields(records, {savvy::fmt::gt});
+    for (auto it = expected.begin(); it != expected.end(); ++it)
+      assert(rdr.read(rec.site, rec.gt) && same_record(rec, *it));
+    assert(!rdr.read(rec.site, rec.gt) && !rdr.bad());
+  }
+  std::remove(path.c_str());
+
+  // Sites with three ALT alleles each are stored once instead of once per ALT allele.
+  std::vector<sav_test_record> triallelic = make_sav_test_records(200, 20);
+  std::vector<sav_test_record> triallelic_split;
+  for (auto it = triallelic.begin(); it != triallelic.end(); ++it)
+  {
+    make_triallelic(*it, rng);
+    append_split_records(*it, triallelic_split);
+  }
+  savvy::sav::writer::options split_file_opts;
+  split_file_opts.block_size = opts.block_size = 64;
+  assert(sav_test_file_size(path, opts, {savvy::fmt::gt}, triallelic, 10) < sav_test_file_size(path, split_file_opts, {savvy::fmt::gt}, triallelic_split, 10) * 3 / 4);
+}
+
+void dosage_bit_width_test()
+{
+  // Test HDS values are multiples of 1/4, which widths of 2 or more store exactly.
+  std::vector<sav_test_record> records = make_sav_test_records(40, 20);
+  savvy::sav::writer::options opts;
+  opts.dosage_bit_width = 2;
+  sav_feature_test("dosage-bit-width-test.sav", opts, {savvy::fmt::hds}, 4, savvy::sav::feature_dosage_bit_width, records, records);
+  sav_feature_test("dosage-bit-width-test.sav", opts, {savvy::fmt::gt, savvy::fmt::hds}, 4, savvy::sav::feature_multiple_formats | savvy::sav::feature_dosage_bit_width, records, records);
+
+  opts.block_size = 4;
+  write_sav_test_file("dosage-bit-width-test.sav", opts, {savvy::fmt::hds}, records, 10);
+  assert(savvy::sav::reader("dosage-bit-width-test.sav").dosage_bit_width() == 2);
+  std::remove("dosage-bit-width-test.sav");
+
+  opts.dosage_bit_width = 5;
+  opts.pbwt = true;
+  sav_feature_test("dosage-bit-width-test.sav", opts, {savvy::fmt::hds}, 4, savvy::sav::feature_dosage_bit_width | savvy::sav::feature_pbwt, records, records);
+
+  // Narrower prefixes leave more offset bits in the first byte of each pair, which shrinks files with many haplotypes.
+  const std::vector<sav_test_record> dosages = make_sav_test_records(200, 400);
+  savvy::sav::writer::options seven_bit_opts;
+  seven_bit_opts.minor_version = 4;
+  seven_bit_opts.block_size = 64;
+  savvy::sav::writer::options three_bit_opts = seven_bit_opts;
+  three_bit_opts.dosage_bit_width = 3;
+  assert(sav_test_file_size("dosage-bit-width-test.sav", three_bit_opts, {savvy::fmt::hds}, dosages, 200) < sav_test_file_size("dosage-bit-width-test.sav", seven_bit_opts, {savvy::fmt::hds}, dosages, 200) * 5 / 6);
+}
+
+/**
+ * Checks that reads with reader_opts match reads with default options: in full, with skipped
+ * genotypes and in region queries. Files are written with plain, columnar and dictionary
+ * compressed frames.
+ */
+void reader_options_test(const std::string& path, const savvy::sav::reader::options& reader_opts)
+{
+  const std::size_t sample_count = 10;
+  const std::vector<sav_test_record> records = make_sav_test_records(200, sample_count * 2);
+  const std::vector<savvy::region> regions = {{"2", 450, 460}, {"1", 150, 250}, {"1", 390, 800}, {"1", 100, 110}, {"2", 0, 1000}};
+
+  std::vector<savvy::sav::writer::options> file_opts(3);
+  file_opts[1].columnar_frames = true;
+  file_opts[1].delta_sites = true;
+  file_opts[2].dictionary_training_records = 16;
+  for (auto it = file_opts.begin(); it != file_opts.end(); ++it)
+  {
+    it->block_size = 4;
+    it->index_path = path + ".s1r";
+    write_sav_test_file(path, *it, {savvy::fmt::gt, savvy::fmt::hds}, records, sample_count);
+
+    savvy::sav::reader rdr(path, reader_opts, savvy::fmt::gt);
+    assert(same_records(read_sav_test_records(rdr, skip_none), records));
+
+    savvy::sav::reader skip_rdr(path, reader_opts, savvy::fmt::gt);
+    savvy::sav::reader default_skip_rdr(path, savvy::fmt::gt);
+    assert(same_records(read_sav_test_records(skip_rdr, skip_two_of_three), read_sav_test_records(default_skip_rdr, skip_two_of_three)));
+
+    // Regions are queried through the same reader, so some of them seek backwards.
+    savvy::sav::indexed_reader query_rdr(path, path + ".s1r", regions.front(), savvy::bounding_point::beg, reader_opts, savvy::fmt::gt);
+    for (const savvy::region& reg : regions)
+    {
+      query_rdr.reset_region(reg);
+      savvy::sav::indexed_reader default_query_rdr(path, path + ".s1r", reg, savvy::bounding_point::beg, savvy::sav::reader::options(), savvy::fmt::gt);
+      std::vector<sav_test_record> res = read_sav_test_records(query_rdr, skip_none);
+      assert(!res.empty() && same_records(res, read_sav_test_records(default_query_rdr, skip_none)));
+    }
+  }
+
+  std::remove(path.c_str());
+  std::remove((path + ".s1r").c_str());
+}
+
+void read_ahead_test()
+{
+  savvy::sav::reader::options opts;
+  opts.read_ahead_depth = 1;
+  reader_options_test("read-ahead-test.sav", opts);
+  opts.read_ahead_depth = 8;
+  reader_options_test("read-ahead-test.sav", opts);
+}
+
+void memory_map_test()
+{
+  savvy::sav::reader::options opts;
+  opts.memory_map = true;
+  reader_options_test("memory-map-test.sav", opts);
+  opts.read_ahead_depth = 4;
+  reader_options_test("memory-map-test.sav", opts);
+}
+
+void parallel_scan_test()
+{
+  const std::string path = "parallel-scan-test.sav";
+  const std::size_t sample_count = 10;
+  const std::size_t thread_count = 4;
+  std::vector<sav_test_record> records = make_sav_test_records(203, sample_count * 2); // Leaves a partial last frame.
+  const std::vector<sav_test_record> expected = stored_fields(records, {savvy::fmt::hds});
+
+  std::vector<savvy::sav::writer::options> file_opts(2);
+  file_opts[1].columnar_frames = true;
+  file_opts[1].delta_sites = true;
+  for (auto it = file_opts.begin(); it != file_opts.end(); ++it)
+  {
+    it->block_size = 4;
+    it->index_path = path + ".s1r";
+    write_sav_test_file(path, *it, {savvy::fmt::gt, savvy::fmt::hds}, records, sample_count);
+
+    std::mutex mtx;
+    std::vector<sav_test_record> unordered;
+    assert(savvy::sav::parallel_scan<std::vector<float>>(path, thread_count, savvy::fmt::hds, [&](std::size_t worker, const savvy::site_info& site, const std::vector<float>& hds)
+    {
+      assert(worker < thread_count);
+      std::lock_guard<std::mutex> lock(mtx);
+      unordered.push_back({site, {}, hds});
+    }, savvy::sav::scan_order::unordered));
+    std::sort(unordered.begin(), unordered.end(), [](const sav_test_record& a, const sav_test_record& b) { return a.site.position() < b.site.position(); });
+    assert(same_records(unordered, expected));
+
+    // Shards are contiguous in worker order, so concatenating them restores file order.
+    std::vector<std::vector<sav_test_record>> shards(thread_count);
+    assert(savvy::sav::parallel_scan<std::vector<float>>(path, thread_count, savvy::fmt::hds, [&](std::size_t worker, const savvy::site_info& site, const std::vector<float>& hds)
+    {
+      shards[worker].push_back({site, {}, hds});
+    }, savvy::sav::scan_order::shard));
+    std::vector<sav_test_record> sharded;
+    for (auto shard = shards.begin(); shard != shards.end(); ++shard)
+    {
+      assert(!shard->empty());
+      sharded.insert(sharded.end(), shard->begin(), shard->end());
+    }
+    assert(same_records(sharded, expected));
+
+    const std::thread::id caller = std::this_thread::get_id();
+    std::vector<sav_test_record> global;
+    assert(savvy::sav::parallel_scan<std::vector<float>>(path, thread_count, savvy::fmt::hds, [&](std::size_t, const savvy::site_info& site, const std::vector<float>& hds)
+    {
+      assert(std::this_thread::get_id() == caller);
+      global.push_back({site, {}, hds});
+    }, savvy::sav::scan_order::global));
+    assert(same_records(global, expected));
+  }
+
+  assert(!savvy::sav::parallel_scan<std::vector<float>>("parallel-scan-missing.sav", thread_count, savvy::fmt::hds, [](std::size_t, const savvy::site_info&, const std::vector<float>&) { }));
+
+  std::remove(path.c_str());
+  std::remove((path + ".s1r").c_str());
+}
+
+// Checks a packed GT read against the same record read as floats.
+void check_packed_alleles(const savvy::packed_allele_vector& packed, const std::vector<float>& gt)
+{
+  assert(packed.size() == gt.size() && packed.word_count() == (gt.size() + 63) / 64);
+  std::size_t alt_count = 0, missing_count = 0;
+  for (std::size_t i = 0; i < gt.size(); ++i)
+  {
+    assert(packed.is_missing(i) == std::isnan(gt[i]));
+    assert(packed.is_alt(i) == (!std::isnan(gt[i]) && gt[i] != 0.f));
+    alt_count += packed.is_alt(i);
+    missing_count += packed.is_missing(i);
+  }
+  assert(packed.alt_count() == alt_count && packed.missing_count() == missing_count);
+}
+
+void packed_alleles_test()
+{
+  // 70 samples give 140 haplotypes, which leaves a partial last word.
+  const std::string path = "packed-alleles-test.sav";
+  const std::size_t sample_count = 70;
+  std::vector<sav_test_record> records = make_sav_test_records(40, sample_count * 2);
+  records[7].gt[139] = 2.f; // Multi-allelic record, where any ALT allele is packed as 1.
+  records[7].site = savvy::site_info("1", records[7].site.position(), "A", "C,G", {});
+
+  std::vector<std::vector<savvy::fmt>> file_formats = {{savvy::fmt::gt}, {savvy::fmt::hds}, {savvy::fmt::hds, savvy::fmt::gt}};
+  for (auto formats = file_formats.begin(); formats != file_formats.end(); ++formats)
+  {
+    savvy::sav::writer::options opts;
+    opts.multiallelic = *formats == std::vector<savvy::fmt>{savvy::fmt::gt};
+    write_sav_test_file(path, opts, *formats, records, sample_count);
+
+    for (int subset = 0; subset < 2; ++subset)
+    {
+      savvy::sav::reader packed_rdr(path, savvy::fmt::gt);
+      savvy::sav::reader float_rdr(path, savvy::fmt::gt);
+      if (subset)
+      {
+        assert(packed_rdr.subset_samples({"SAMPLE0", "SAMPLE33", "SAMPLE69"}).size() == 3);
+        float_rdr.subset_samples({"SAMPLE0", "SAMPLE33", "SAMPLE69"});
+      }
+
+      savvy::site_info anno;
+      savvy::packed_allele_vector packed, prev_packed;
+      std::vector<float> gt, prev_gt;
+      std::size_t cnt = 0;
+      while (packed_rdr.read(anno, packed) && float_rdr.read(anno, gt))
+      {
+        check_packed_alleles(packed, gt);
+        if (cnt++)
+        {
+          std::size_t both_alt = 0, both_present = 0;
+          for (std::size_t i = 0; i < gt.size(); ++i)
+          {
+            both_alt += packed.is_alt(i) && prev_packed.is_alt(i);
+            both_present += !std::isnan(gt[i]) && !std::isnan(prev_gt[i]);
+          }
+          assert(packed.intersection_count(prev_packed) == both_alt);
+          assert(packed.non_missing_intersection_count(prev_packed) == both_present);
+        }
+        std::swap(packed, prev_packed);
+        std::swap(gt, prev_gt);
+      }
+      assert(cnt == records.size() && !packed_rdr.bad());
+    }
+
+    // Only GT can be packed.
+    savvy::sav::reader hds_rdr(path, savvy::fmt::hds);
+    savvy::site_info anno;
+    savvy::packed_allele_vector packed;
+    assert(!hds_rdr.read(anno, packed) && !hds_rdr.bad());
+  }
+
+  std::remove(path.c_str());
+}
+
+// Genotype probabilities of one sample by enumerating allele combinations.
+std::vector<double> reference_gp(const std::vector<double>& hap_probs)
+{
+  std::vector<double> ret;
+  ret.push_back(savvy::hds_to_gp<double>::get_first_prob(hap_probs));
+  for (std::size_t g = 1; g < hap_probs.size(); ++g)
+    ret.push_back(savvy::hds_to_gp<double>::get_prob(hap_probs, g));
+  ret.push_back(savvy::hds_to_gp<double>::get_last_prob(hap_probs));
+  return ret;
+}
+
+void hds_to_gp_test()
+{
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<double> prob_dist(0., 1.);
+
+  // Closed-form kernels against enumeration. Probabilities include the exact 0 and 1 of hard calls.
+  for (std::size_t ploidy = 1; ploidy <= 6; ++ploidy)
+  {
+    for (std::size_t n = 0; n < 100; ++n)
+    {
+      std::vector<double> hap_probs(ploidy);
+      for (auto it = hap_probs.begin(); it != hap_probs.end(); ++it)
+        *it = n % 4 == 0 ? double(rng() % 2) : prob_dist(rng);
+
+      std::vector<double> expected = reference_gp(hap_probs);
+      std::vector<double> gp(ploidy + 1);
+      savvy::hds_to_gp<double>::polyploid(hap_probs.data(), ploidy, gp.data());
+      for (std::size_t g = 0; g <= ploidy; ++g)
+        assert(std::abs(gp[g] - expected[g]) < 1e-12);
+      assert(std::abs(std::accumulate(gp.begin(), gp.end(), 0.) - 1.) < 1e-12);
+
+      if (ploidy == 1)
+      {
+        savvy::hds_to_gp<double>::haploid(hap_probs[0], gp.data());
+        assert(gp == expected);
+      }
+      else if (ploidy == 2)
+      {
+        savvy::hds_to_gp<double>::diploid(hap_probs[0], hap_probs[1], gp.data());
+        assert(gp == expected);
+      }
+    }
+  }
+
+  // GP reads of haploid, diploid and triploid files (the ploidy dispatched paths), with and without a subset.
+  const std::string path = "hds-to-gp-test.sav";
+  const std::size_t sample_count = 9;
+  const std::set<std::string> subset = {"SAMPLE1", "SAMPLE2", "SAMPLE8"};
+  for (std::size_t ploidy = 1; ploidy <= 3; ++ploidy)
+  {
+    std::vector<sav_test_record> records = make_sav_test_records(20, sample_count * ploidy);
+    write_sav_test_file(path, savvy::sav::writer::options(), {savvy::fmt::hds}, records, sample_count);
+
+    for (int use_subset = 0; use_subset < 2; ++use_subset)
+    {
+      savvy::sav::reader rdr(path, savvy::fmt::gp);
+      std::vector<std::size_t> sample_indices;
+      for (std::size_t i = 0; i < sample_count; ++i)
+      {
+        if (!use_subset || subset.count("SAMPLE" + std::to_string(i)))
+          sample_indices.push_back(i);
+      }
+      if (use_subset)
+        rdr.subset_samples(subset);
+
+      savvy::site_info anno;
+      std::vector<float> gp;
+      for (auto rec = records.begin(); rec != records.end(); ++rec)
+      {
+        assert(rdr.read(anno, gp) && gp.size() == sample_indices.size() * (ploidy + 1));
+        for (std::size_t s = 0; s < sample_indices.size(); ++s)
+        {
+          std::vector<double> expected = reference_gp(std::vector<double>(rec->hds.begin() + sample_indices[s] * ploidy, rec->hds.begin() + (sample_indices[s] + 1) * ploidy));
+          for (std::size_t g = 0; g <= ploidy; ++g)
+            assert(std::abs(gp[s * (ploidy + 1) + g] - expected[g]) < 1e-6);
+        }
+      }
+      assert(!rdr.read(anno, gp) && !rdr.bad());
+    }
+  }
+
+  std::remove(path.c_str());
+}
+
+template <typename T, typename IndexT>
+std::vector<float> dense_copy(const savvy::compressed_vector<T, IndexT>& v)
+{
+  std::vector<float> ret(v.size());
+  for (std::size_t i = 0; i < v.non_zero_size(); ++i)
+  {
+    assert(v.index_data()[i] < v.size() && (i == 0 || v.index_data()[i - 1] < v.index_data()[i]));
+    ret[v.index_data()[i]] = v.value_data()[i];
+  }
+  return ret;
+}
+
+template <typename IndexT>
+void compressed_vector_reader_test(const std::string& path, savvy::fmt data_format, const std::set<std::string>& subset)
+{
+  savvy::sav::reader dense_rdr(path, data_format);
+  savvy::sav::reader sparse_rdr(path, data_format);
+  if (subset.size())
+  {
+    dense_rdr.subset_samples(subset);
+    sparse_rdr.subset_samples(subset);
+  }
+
+  savvy::site_info anno;
+  std::vector<float> dense;
+  savvy::compressed_vector<float, IndexT> sparse;
+  std::size_t cnt = 0;
+  while (dense_rdr.read(anno, dense))
+  {
+    assert(sparse_rdr.read(anno, sparse));
+    assert(same_genotypes(dense_copy(sparse), dense));
+    ++cnt;
+  }
+  assert(cnt && !sparse_rdr.read(anno, sparse) && !sparse_rdr.bad());
+}
+
+void compressed_vector_test()
+{
+  savvy::compressed_vector<float, std::uint32_t> v(10);
+  const savvy::compressed_vector<float, std::uint32_t>& cv = v; // Non-const operator[] inserts missing elements.
+  v.reserve(3);
+  v.append(2, 1.5f);
+  v.append(7) = 2.f;
+  assert(v.non_zero_size() == 2 && v.size() == 10 && cv[2] == 1.5f && cv[7] == 2.f && cv[3] == 0.f);
+
+  // Readers accumulate into the last element or append after it.
+  savvy::detail::sorted_element(v, 7) += 1.f;
+  savvy::detail::sorted_element(v, 9) = 4.f;
+  assert(v.non_zero_size() == 3 && cv[7] == 3.f && cv[9] == 4.f);
+  savvy::detail::reserve_non_zero(v, 100); // Capped at size().
+
+  const float values[] = {1.f, 2.f, 3.f};
+  const std::uint32_t offsets[] = {0, 4, 5};
+  v.assign(values, values + 3, offsets, 6);
+  assert(v.size() == 6 && v.non_zero_size() == 3 && dense_copy(v) == std::vector<float>({1.f, 0.f, 0.f, 0.f, 2.f, 3.f}));
+
+  std::vector<float> moved_values = {5.f};
+  std::vector<std::uint32_t> moved_offsets = {1};
+  v.assign(std::move(moved_values), std::move(moved_offsets), 3);
+  assert(dense_copy(v) == std::vector<float>({0.f, 5.f, 0.f}));
+
+  // Sparse reads of every format match dense reads.
+  const std::string path = "compressed-vector-test.sav";
+  const std::size_t sample_count = 10;
+  std::vector<sav_test_record> records = make_sav_test_records(20, sample_count * 2);
+  const std::vector<savvy::fmt> data_formats = {savvy::fmt::gt, savvy::fmt::ac, savvy::fmt::hds, savvy::fmt::ds, savvy::fmt::gp};
+  for (savvy::fmt file_format : {savvy::fmt::gt, savvy::fmt::hds})
+  {
+    write_sav_test_file(path, savvy::sav::writer::options(), {file_format}, records, sample_count);
+    for (savvy::fmt data_format : data_formats)
+    {
+      compressed_vector_reader_test<std::size_t>(path, data_format, {});
+      compressed_vector_reader_test<std::uint32_t>(path, data_format, {});
+      compressed_vector_reader_test<std::uint32_t>(path, data_format, {"SAMPLE0", "SAMPLE5", "SAMPLE9"});
+    }
+  }
+
+  std::remove(path.c_str());
+}
+
+// Frames of a SAV file as (chromosome, s1r entry) pairs in index order.
+std::vector<std::pair<std::string, savvy::s1r::entry>> read_index_entries(const std::string& index_path)
+{
+  std::vector<std::pair<std::string, savvy::s1r::entry>> ret;
+  savvy::s1r::reader index(index_path);
+  assert(index.good());
+  for (const std::string& chrom : index.tree_names())
+  {
+    auto query = index.create_query(savvy::region(chrom, 0));
+    for (auto it = query.begin(); it != query.end(); ++it)
+      ret.emplace_back(chrom, *it);
+  }
+  return ret;
+}
+
+std::size_t entry_record_count(const savvy::s1r::entry& e)
+{
+  return std::size_t(e.value() & 0xFFFF) + 1;
+}
+
+// Checks an indexed query against the records that start in the region.
+void check_region_query(const std::string& path, const std::vector<sav_test_record>& records, const savvy::region& reg)
+{
+  std::vector<sav_test_record> expected;
+  for (auto it = records.begin(); it != records.end(); ++it)
+  {
+    if (it->site.chromosome() == reg.chromosome() && it->site.position() >= reg.from() && it->site.position() <= reg.to())
+      expected.push_back(*it);
+  }
+
+  savvy::sav::indexed_reader rdr(path, path + ".s1r", reg, savvy::bounding_point::beg, savvy::sav::reader::options(), savvy::fmt::gt);
+  assert(same_records(read_sav_test_records(rdr, skip_none), stored_fields(expected, {savvy::fmt::gt})));
+}
+
+void frame_limits_test()
+{
+  const std::string path = "frame-limits-test.sav";
+  const std::size_t sample_count = 10;
+  std::vector<sav_test_record> records = make_sav_test_records(40, sample_count * 2); // 20 records 3 bp apart on each chromosome.
+  savvy::sav::writer::options opts;
+  opts.index_path = path + ".s1r";
+
+  // The record cap restarts at each chromosome.
+  opts.block_size = 7;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  std::vector<std::pair<std::string, savvy::s1r::entry>> entries = read_index_entries(opts.index_path);
+  assert(entries.size() == 6);
+  for (std::size_t i = 0; i < entries.size(); ++i)
+    assert(entries[i].first == (i < 3 ? "1" : "2") && entry_record_count(entries[i].second) == (i % 3 == 2 ? 6 : 7));
+  check_region_query(path, records, {"2", 160, 190});
+
+  // A span of 10 bp holds 4 records.
+  opts.block_size = 1000;
+  opts.block_max_span = 10;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  entries = read_index_entries(opts.index_path);
+  assert(entries.size() == 10);
+  for (auto it = entries.begin(); it != entries.end(); ++it)
+    assert(entry_record_count(it->second) == 4 && it->second.region_end() - it->second.region_start() < 10);
+  check_region_query(path, records, {"1", 110, 150});
+  check_region_query(path, records, {"2", 160, 190});
+
+  // A budget of one byte closes every frame after its first record.
+  opts.block_max_span = 0;
+  opts.block_max_bytes = 1;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  entries = read_index_entries(opts.index_path);
+  assert(entries.size() == records.size());
+  for (auto it = entries.begin(); it != entries.end(); ++it)
+    assert(entry_record_count(it->second) == 1);
+  check_region_query(path, records, {"1", 110, 150});
+
+  // A budget of a few records.
+  opts.block_max_bytes = 64;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  entries = read_index_entries(opts.index_path);
+  std::size_t total = 0;
+  for (auto it = entries.begin(); it != entries.end(); ++it)
+  {
+    assert(entry_record_count(it->second) < 20);
+    total += entry_record_count(it->second);
+  }
+  assert(total == records.size() && entries.size() > 2 && entries.size() < records.size() / 2);
+  check_region_query(path, records, {"2", 160, 190});
+
+  // Chromosomes after the first with more than one leaf node of entries (one per frame here).
+  opts.block_size = 1;
+  opts.block_max_bytes = 0;
+  records = make_sav_test_records(1200, 4);
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, 2);
+  assert(read_index_entries(opts.index_path).size() == records.size());
+  check_region_query(path, records, {"2", 2000, 2100});
+  check_region_query(path, records, {"2", 3500, 3600});
+  check_region_query(path, records, {"1", 1500, 1600});
+
+  std::remove(path.c_str());
+  std::remove(opts.index_path.c_str());
+}
+
+// Runs "sav sort-samples" on input_path and checks that every sample keeps its genotypes under its new index.
+void check_sort_samples(const std::string& input_path, const std::string& output_path)
+{
+  std::vector<std::string> args = {"sort-samples", "-a", "0.5", "-b", "5", input_path, output_path};
+  std::vector<char*> argv;
+  for (auto it = args.begin(); it != args.end(); ++it)
+    argv.push_back(&(*it)[0]);
+  optind = 1;
+  assert(sort_samples_main(int(argv.size()), argv.data()) == EXIT_SUCCESS);
+
+  savvy::sav::reader in(input_path);
+  savvy::sav::reader out(output_path);
+  assert(out.good() && out.data_formats() == in.data_formats() && out.features() == in.features());
+  assert(out.minor_version() == in.minor_version() && out.sample_block_size() == in.sample_block_size());
+
+  // Sample IDs are a permutation, and an informative cohort is reordered.
+  const std::vector<std::string>& in_ids = in.samples();
+  const std::vector<std::string>& out_ids = out.samples();
+  std::vector<std::size_t> old_index(out_ids.size());
+  for (std::size_t i = 0; i < out_ids.size(); ++i)
+  {
+    auto it = std::find(in_ids.begin(), in_ids.end(), out_ids[i]);
+    assert(it != in_ids.end());
+    old_index[i] = std::size_t(it - in_ids.begin());
+  }
+  assert(std::set<std::size_t>(old_index.begin(), old_index.end()).size() == in_ids.size());
+  assert(out_ids != in_ids);
+
+  std::vector<sav_test_record> in_records = read_sav_test_records(in, skip_none);
+  std::vector<sav_test_record> out_records = read_sav_test_records(out, skip_none);
+  assert(in_records.size() == out_records.size());
+  const std::size_t ploidy = in_records.front().gt.size() ? in_records.front().gt.size() / in_ids.size() : in_records.front().hds.size() / in_ids.size();
+  for (std::size_t r = 0; r < in_records.size(); ++r)
+  {
+    sav_test_record expected = in_records[r];
+    for (std::size_t i = 0; i < out_ids.size(); ++i)
+    {
+      for (std::size_t h = 0; h < ploidy; ++h)
+      {
+        if (expected.gt.size())
+          expected.gt[i * ploidy + h] = in_records[r].gt[old_index[i] * ploidy + h];
+        if (expected.hds.size())
+          expected.hds[i * ploidy + h] = in_records[r].hds[old_index[i] * ploidy + h];
+      }
+    }
+    assert(same_record(out_records[r], expected));
+  }
+
+  // The output is indexed.
+  std::vector<std::pair<std::string, savvy::s1r::entry>> entries = read_index_entries(output_path + ".s1r");
+  std::size_t indexed_records = 0;
+  for (auto it = entries.begin(); it != entries.end(); ++it)
+    indexed_records += entry_record_count(it->second);
+  assert(indexed_records == out_records.size() && entries.size() > 1);
+
+  std::remove(output_path.c_str());
+  std::remove((output_path + ".s1r").c_str());
+}
+
+void sort_samples_test()
+{
+  const std::string path = "sort-samples-test.sav";
+  const std::size_t sample_count = 12;
+  std::vector<sav_test_record> records = make_sav_test_records(60, sample_count * 2);
+
+  savvy::sav::writer::options opts;
+  opts.sample_block_size = 4;
+  write_sav_test_file(path, opts, {savvy::fmt::gt, savvy::fmt::hds}, records, sample_count);
+  check_sort_samples(path, path + ".sorted.sav");
+
+  opts = savvy::sav::writer::options();
+  opts.pbwt = true;
+  opts.delta_sites = true;
+  write_sav_test_file(path, opts, {savvy::fmt::gt}, records, sample_count);
+  check_sort_samples(path, path + ".sorted.sav");
+
+  std::remove(path.c_str());
+}
+
+// Records at these indices are accepted; with 4 records per frame, they come right after
+// rejected records (3, 12, 33), right after an accepted one across a frame boundary (4), after
+// a frame of only rejected records (12) and across the chromosome boundary (19, 20).
+bool read_if_accepted(std::size_t i)
+{
+  return i == 3 || i == 4 || i == 12 || i == 19 || i == 20 || i == 33;
+}
+
+bool read_if_predicate(const savvy::site_info& site)
+{
+  return read_if_accepted((site.position() - 100) / 3);
+}
+
+template <typename Rdr, typename Pred>
+void check_read_if(Rdr& rdr, Pred fn, const std::vector<sav_test_record>& records, savvy::fmt format, std::size_t& pos)
+{
+  savvy::site_info anno;
+  std::vector<float> buf;
+  while (rdr.read_if(fn, anno, buf))
+  {
+    while (pos < records.size() && !read_if_accepted(pos))
+      ++pos;
+    assert(pos < records.size() && anno.position() == records[pos].site.position() && anno.prop("KEEP") == "1");
+    assert(same_genotypes(buf, format == savvy::fmt::hds ? records[pos].hds : records[pos].gt));
+    ++pos;
+  }
+  assert(!rdr.bad());
+}
+
+void read_if_test()
+{
+  const std::string path = "read-if-test.sav";
+  const std::size_t sample_count = 10;
+  std::vector<sav_test_record> records = make_sav_test_records(40, sample_count * 2);
+  for (std::size_t i = 0; i < records.size(); ++i)
+    records[i].site.prop("KEEP", read_if_accepted(i) ? "1" : "0");
+
+  std::vector<savvy::sav::writer::options> file_opts(3);
+  file_opts[1].minor_version = 1;
+  file_opts[2].columnar_frames = true;
+  const std::vector<std::vector<savvy::fmt>> file_formats = {{savvy::fmt::gt}, {savvy::fmt::gt}, {savvy::fmt::gt, savvy::fmt::hds}};
+  const std::vector<std::string> ids = sav_test_sample_ids(sample_count);
+  const std::vector<std::pair<std::string, std::string>> headers = {{"INFO", "<ID=KEEP,Number=1,Type=Integer,Description=\"Accepted by read_if\">"}};
+
+  for (std::size_t f = 0; f < file_opts.size(); ++f)
+  {
+    file_opts[f].block_size = 4;
+    file_opts[f].index_path = path + ".s1r";
+    {
+      savvy::sav::writer output(path, file_opts[f], ids.begin(), ids.end(), headers.begin(), headers.end(), file_formats[f]);
+      for (auto it = records.begin(); it != records.end(); ++it)
+      {
+        if (file_formats[f].size() > 1)
+          output.write(it->site, it->gt, it->hds);
+        else
+          output.write(it->site, it->gt);
+      }
+      assert(output.good());
+    }
+
+    for (savvy::fmt format : file_formats[f])
+    {
+      // Same predicate as export_records() passes.
+      const filter keep_filter("KEEP==1");
+      assert(keep_filter);
+
+      std::size_t pos = 0;
+      savvy::sav::reader rdr(path, format);
+      check_read_if(rdr, read_if_predicate, records, format, pos);
+      assert(pos == 34);
+
+      pos = 0;
+      savvy::sav::reader filter_rdr(path, format);
+      check_read_if(filter_rdr, std::ref(keep_filter), records, format, pos);
+      assert(pos == 34);
+
+      pos = 0;
+      savvy::sav::indexed_reader query_rdr(path, path + ".s1r", {"1", 0, 1000}, savvy::bounding_point::beg, format);
+      check_read_if(query_rdr, std::ref(keep_filter), records, format, pos);
+      assert(pos == 20);
+      query_rdr.reset_region({"2", 0, 1000});
+      check_read_if(query_rdr, read_if_predicate, records, format, pos);
+      assert(pos == 34);
+    }
+  }
+
+  std::remove(path.c_str());
+  std::remove((path + ".s1r").c_str());
+}
+
+// Counts global allocations while count_allocations is set.
+std::size_t allocation_count = 0;
+bool count_allocations = false;
+
+void* operator new(std::size_t sz)
+{
+  if (count_allocations)
+    ++allocation_count;
+  void* ret = std::malloc(sz ? sz : 1);
+  if (!ret)
+    throw std::bad_alloc();
+  return ret;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void read_allocations_test()
+{
+  // Once the site_info and genotype buffers have grown to fit, records are read without allocating.
+  const std::string path = "read-allocations-test.sav";
+  const std::size_t sample_count = 10;
+  std::vector<sav_test_record> records = make_sav_test_records(48, sample_count * 2);
+  for (std::size_t i = 0; i < records.size(); ++i)
+  {
+    if (i % 4 == 3)
+      records[i].site = savvy::site_info(std::string(records[i].site.chromosome()), records[i].site.position(), "A", "C,G", {});
+    records[i].site.prop("AF", "0." + std::to_string(100 + i % 7));
+    records[i].site.prop("ID", "rs" + std::to_string(1000 + i));
+  }
+
+  std::vector<savvy::sav::writer::options> file_opts(3);
+  file_opts[1].columnar_frames = true;
+  file_opts[1].delta_sites = true;
+  file_opts[2].multiallelic = true;
+  std::vector<savvy::sav::reader::options> reader_opts(3);
+  reader_opts[2].split_multiallelic = true;
+  const std::vector<std::string> ids = sav_test_sample_ids(sample_count);
+  const std::vector<std::pair<std::string, std::string>> headers = {
+    {"INFO", "<ID=AF,Number=A,Type=Float,Description=\"Alternate allele frequency\">"},
+    {"INFO", "<ID=ID,Number=1,Type=String,Description=\"Variant identifier\">"}};
+
+  for (std::size_t f = 0; f < file_opts.size(); ++f)
+  {
+    file_opts[f].block_size = 4;
+    {
+      savvy::sav::writer output(path, file_opts[f], ids.begin(), ids.end(), headers.begin(), headers.end(), savvy::fmt::gt);
+      for (auto it = records.begin(); it != records.end(); ++it)
+        output.write(it->site, it->gt);
+      assert(output.good());
+    }
+
+    savvy::sav::reader rdr(path, reader_opts[f], savvy::fmt::gt);
+    savvy::site_info anno;
+    anno.prop("OTHER", "dropped"); // Properties from other sources are dropped.
+    std::vector<float> buf;
+    std::size_t cnt = 0;
+    for ( ; cnt < 16 && rdr.read(anno, buf); ++cnt) { }
+    assert(cnt == 16 && anno.prop("OTHER").empty() && !anno.prop("ID").empty());
+
+    allocation_count = 0;
+    count_allocations = true;
+    while (rdr.read(anno, buf))
+      ++cnt;
+    count_allocations = false;
+    assert(!rdr.bad() && cnt == (f == 2 ? records.size() + records.size() / 4 : records.size()));
+    assert(allocation_count == 0);
+  }
+
+  std::remove(path.c_str());
+}
 
 
 int main(int argc, char** argv)
@@ -737,20 +2326,84 @@ int main(int argc, char** argv)
   if (cmd.empty())
   {
     std::cout << "Enter Command:" << std::endl;
+    std::cout << "- allele-pair-array" << std::endl;
+    std::cout << "- batch-read" << std::endl;
+    std::cout << "- columnar-frames" << std::endl;
+    std::cout << "- compressed-vector" << std::endl;
     std::cout << "- convert-file" << std::endl;
+    std::cout << "- create-index" << std::endl;
+    std::cout << "- delta-sites" << std::endl;
+    std::cout << "- dictionary" << std::endl;
+    std::cout << "- dosage-bit-width" << std::endl;
+    std::cout << "- frame-limits" << std::endl;
     std::cout << "- generic-reader" << std::endl;
+    std::cout << "- genotype-block-size" << std::endl;
+    std::cout << "- hds-to-gp" << std::endl;
+    std::cout << "- memory-map" << std::endl;
+    std::cout << "- multiallelic" << std::endl;
+    std::cout << "- multiple-formats" << std::endl;
+    std::cout << "- packed-alleles" << std::endl;
+    std::cout << "- parallel-scan" << std::endl;
+    std::cout << "- pbwt" << std::endl;
     std::cout << "- random-access" << std::endl;
+    std::cout << "- read-ahead" << std::endl;
+    std::cout << "- read-allocations" << std::endl;
+    std::cout << "- read-if" << std::endl;
+    std::cout << "- sample-blocks" << std::endl;
+    std::cout << "- sort-samples" << std::endl;
     std::cout << "- subset" << std::endl;
     std::cout << "- varint" << std::endl;
     std::cin >> cmd;
   }
 
 
-  if (cmd == "convert-file")
+  if (cmd == "allele-pair-array")
+  {
+    allele_pair_array_test<1>();
+    allele_pair_array_test<2>();
+    allele_pair_array_test<3>();
+    allele_pair_array_test<4>();
+    allele_pair_array_test<5>();
+    allele_pair_array_test<6>();
+    allele_pair_array_test<7>();
+  }
+  else if (cmd == "batch-read")
+  {
+    batch_read_mismatch_test();
+  }
+  else if (cmd == "columnar-frames")
+  {
+    columnar_frames_test();
+  }
+  else if (cmd == "compressed-vector")
+  {
+    compressed_vector_test();
+  }
+  else if (cmd == "convert-file")
   {
     convert_file_test<savvy::fmt::gt>()();
     convert_file_test<savvy::fmt::hds>()();
   }
+  else if (cmd == "create-index")
+  {
+    create_index_test();
+  }
+  else if (cmd == "delta-sites")
+  {
+    delta_sites_test();
+  }
+  else if (cmd == "dictionary")
+  {
+    dictionary_test();
+  }
+  else if (cmd == "dosage-bit-width")
+  {
+    dosage_bit_width_test();
+  }
+  else if (cmd == "frame-limits")
+  {
+    frame_limits_test();
+  }
   else if (cmd == "generic-reader")
   {
     if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test<savvy::fmt::gt>()();
@@ -764,6 +2417,45 @@ int main(int argc, char** argv)
 
     generic_reader_test(SAVVYT_SAV_FILE_DOSE, savvy::fmt::gt, SAVVYT_MARKER_COUNT_DOSE);
     generic_reader_test(SAVVYT_SAV_FILE_DOSE, savvy::fmt::hds, SAVVYT_MARKER_COUNT_DOSE);
+
+    batch_read_test(SAVVYT_VCF_FILE, savvy::fmt::gt);
+    batch_read_test(SAVVYT_SAV_FILE_HARD, savvy::fmt::gt);
+    batch_read_test(SAVVYT_SAV_FILE_DOSE, savvy::fmt::hds);
+
+    quantized_read_test(SAVVYT_SAV_FILE_HARD, savvy::fmt::gt);
+    quantized_read_test(SAVVYT_SAV_FILE_DOSE, savvy::fmt::hds);
+  }
+  else if (cmd == "genotype-block-size")
+  {
+    genotype_block_size_test();
+  }
+  else if (cmd == "hds-to-gp")
+  {
+    hds_to_gp_test();
+  }
+  else if (cmd == "memory-map")
+  {
+    memory_map_test();
+  }
+  else if (cmd == "multiallelic")
+  {
+    multiallelic_test();
+  }
+  else if (cmd == "multiple-formats")
+  {
+    multiple_formats_test();
+  }
+  else if (cmd == "packed-alleles")
+  {
+    packed_alleles_test();
+  }
+  else if (cmd == "parallel-scan")
+  {
+    parallel_scan_test();
+  }
+  else if (cmd == "pbwt")
+  {
+    pbwt_test();
   }
   else if (cmd == "random-access")
   {
@@ -773,6 +2465,26 @@ int main(int argc, char** argv)
     sav_random_access_test(savvy::fmt::gt);
     sav_random_access_test(savvy::fmt::hds);
   }
+  else if (cmd == "read-ahead")
+  {
+    read_ahead_test();
+  }
+  else if (cmd == "read-allocations")
+  {
+    read_allocations_test();
+  }
+  else if (cmd == "read-if")
+  {
+    read_if_test();
+  }
+  else if (cmd == "sample-blocks")
+  {
+    sample_blocks_test();
+  }
+  else if (cmd == "sort-samples")
+  {
+    sort_samples_test();
+  }
   else if (cmd == "subset")
   {
     if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test<savvy::fmt::gt>()();